@@ -1,12 +1,15 @@
 #pragma once
 #include "peanuts/bb.hpp"
 #include "peanuts/deferred_file.hpp"
+#include "peanuts/extent_merger.hpp"
 #include "peanuts/extent_tree.hpp"
+#include "peanuts/flat_extent_index.hpp"
 #include "peanuts/sparse_extent.hpp"
 #include "peanuts/inspector.hpp"
 #include "peanuts/mpi.hpp"
 #include "peanuts/options.hpp"
 #include "peanuts/pmem2.hpp"
+#include "peanuts/progress_thread.hpp"
 #include "peanuts/ring_buffer.hpp"
 #include "peanuts/ring_tracker.hpp"
 #include "peanuts/rpm.hpp"
@@ -3,34 +3,88 @@
 #include "peanuts/config.hpp"
 #include "peanuts/deferred_file.hpp"
 #include "peanuts/extent_list.hpp"
+#include "peanuts/extent_merger.hpp"
+#include "peanuts/extent_spill.hpp"
 #include "peanuts/extent_tree.hpp"
+#include "peanuts/flat_extent_index.hpp"
+#include "peanuts/log_record.hpp"
+#include "peanuts/persistent_index.hpp"
+#include "peanuts/progress_thread.hpp"
 #include "peanuts/raii/fd.hpp"
 #include "peanuts/ring_buffer.hpp"
+#include "peanuts/ring_space.hpp"
 #include "peanuts/rpm.hpp"
 #include "peanuts/utils/fs.hpp"
+#include "peanuts/utils/power.hpp"
+#include "peanuts/utils/small_vector.hpp"
 #include "peanuts/utils/stopwatch.hpp"
+#include "peanuts/utils/system.hpp"
+#include "peanuts/utils/versioned.hpp"
 
 #include <zpp/file.h>
 #include <zpp_bits.h>
 
+#ifndef PEANUTS_PERSISTENT_INDEX_SHARE
+#define PEANUTS_PERSISTENT_INDEX_SHARE 16
+#endif
+
 #ifdef PEANUTS_ENABLE_PROFILER
 #include <fmt/format.h>
 #endif
 
 #include <sys/types.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <functional>
+#include <future>
+#include <limits>
 #include <memory>
+#include <memory_resource>
+#include <numeric>
 #include <span>
+#include <tuple>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace peanuts {
 
+// An immutable copy of the trees of a bb, which readers on other threads can
+// use while the trees change, see bb_handler::publish(). The trees no longer
+// change, so they are flattened for faster lookups.
+struct bb_snapshot {
+  flat_extent_index global_tree;
+  flat_extent_index local_tree;
+  size_t file_size;  // of the file as last seen by the publishing handler
+  // oldest data of this rank the trees refer to, kept in the local ring for
+  // as long as the snapshot lives
+  ring_space::pin pinned;
+};
+
 struct bb {
   ino_t ino;
-  extent_tree global_tree{};
-  extent_tree local_tree{};
-
-  using serialize = zpp::bits::members<3>;
+  // nodes of the trees below and of the deltas of the handlers, which are
+  // only used by one thread at a time, like the bb itself; not serialized
+  std::pmr::unsynchronized_pool_resource node_pool{};
+  extent_tree global_tree{&node_pool};
+  extent_tree local_tree{&node_pool};
+  // epoch of the latest sync merged into global_tree. Each sync takes the
+  // next epoch after the latest one any of its ranks has seen.
+  uint32_t global_epoch = 0;
+  // the latest snapshot of the trees, once published; not serialized
+  utils::versioned<bb_snapshot> published{};
+  // the part of global_tree spilled out of DRAM, see
+  // bb_store::set_global_tree_limit(); not serialized
+  cold_extents global_cold{};
+  // the ranges of local_tree written since the last sync of each handler,
+  // whichever handler wrote them; not serialized
+  std::vector<std::weak_ptr<extent_tree>> deltas{};
+
+  constexpr static auto serialize(auto& archive, auto& self) {
+    return archive(self.ino, self.global_tree, self.local_tree,
+                   self.global_epoch);
+  }
 };
 
 namespace detail {
@@ -46,17 +100,168 @@ struct bb_equal {
     return lhs->ino == rhs->ino;
   }
 };
+
+// all_gather buffers of different sizes. Returns the concatenation in rank
+// order. The sizes are exchanged in 64 bits, so that every rank fails with
+// EOVERFLOW if they do not fit in the int counts of MPI.
+inline auto all_gather_serialized(const mpi::comm& comm,
+                                  std::span<const std::byte> data)
+    -> std::vector<std::byte> {
+  auto sizes = std::vector<uint64_t>(comm.size());
+  comm.all_gather(static_cast<uint64_t>(data.size()), std::span{sizes});
+
+  auto total = std::accumulate(sizes.begin(), sizes.end(), uint64_t{0});
+  mpi::to_count(total);
+  auto counts = std::vector<int>(sizes.begin(), sizes.end());
+  auto result = std::vector<std::byte>(total);
+  comm.all_gather_v(data, std::span{result}, std::span<const int>{counts});
+  return result;
+}
+
+// [old_begin, old_end) of a ring has been moved to new_begin
+struct relocation {
+  uint64_t old_begin;
+  uint64_t old_end;
+  uint64_t new_begin;
+
+  using serialize = zpp::bits::members<3>;
+};
+
+// Call fn on every node of the trees of b, the spilled ones included.
+template <typename Fn>
+inline auto for_each_node(const bb& b, Fn&& fn) -> void {
+  for (const auto* tree : {&b.global_tree, &b.local_tree}) {
+    for (const auto& node : *tree) {
+      fn(node);
+    }
+  }
+  b.global_cold.for_each(fn);
+}
+
+// The global tree of b, the spilled nodes included, flattened. Nodes are
+// read back run by run rather than paged in.
+inline auto flatten_global_tree(const bb& b) -> flat_extent_index {
+  if (b.global_cold.empty()) {
+    return flat_extent_index{b.global_tree};
+  }
+  auto nodes = std::vector<extent_tree::node>(b.global_tree.begin(),
+                                              b.global_tree.end());
+  nodes.reserve(nodes.size() + b.global_cold.size());
+  b.global_cold.for_each([&](const auto& node) { nodes.push_back(node); });
+  std::sort(nodes.begin(), nodes.end(),
+            [](const auto& lhs, const auto& rhs) { return lhs.ex < rhs.ex; });
+  return flat_extent_index{std::move(nodes)};
+}
+
+// Publish a snapshot of the trees of b. The data of rank in space is pinned
+// until the snapshot is replaced and no reader holds it any more.
+inline auto publish(bb& b, int rank, size_t file_size, ring_space* space)
+    -> void {
+  auto oldest = std::numeric_limits<local_ring_buffer::lsn_t>::max();
+  for_each_node(b, [&](const auto& node) {
+    if (node.client_id == rank) {
+      oldest = std::min(oldest, node.ptr);
+    }
+  });
+  auto pinned = ring_space::pin{};
+  if (space != nullptr &&
+      oldest != std::numeric_limits<local_ring_buffer::lsn_t>::max()) {
+    pinned = space->pin_lsn(oldest);
+  }
+  b.published.publish(std::make_shared<const bb_snapshot>(
+      flatten_global_tree(b), flat_extent_index{b.local_tree},
+      file_size, std::move(pinned)));
+}
+
+// Point the nodes of client_id at the new location of their data.
+// relocations are sorted and disjoint. Returns the nodes that have moved.
+inline auto relocate(extent_tree& tree,
+                     int client_id,
+                     std::span<const relocation> relocations)
+    -> std::vector<extent_tree::node> {
+  auto moved = std::vector<extent_tree::node>{};
+  if (relocations.empty()) {
+    return moved;
+  }
+  for (const auto& node : tree) {
+    if (node.client_id != client_id) {
+      continue;
+    }
+    auto ptr_end = node.ptr + node.ex.size();
+    auto it = std::upper_bound(
+        relocations.begin(), relocations.end(), node.ptr,
+        [](uint64_t ptr, const relocation& r) { return ptr < r.old_end; });
+    for (; it != relocations.end() && it->old_begin < ptr_end; ++it) {
+      auto begin = std::max(node.ptr, it->old_begin);
+      auto end = std::min(ptr_end, it->old_end);
+      moved.emplace_back(node.ex.begin + (begin - node.ptr),
+                         node.ex.begin + (end - node.ptr),
+                         it->new_begin + (begin - it->old_begin), client_id,
+                         node.epoch);
+    }
+  }
+  for (const auto& node : moved) {
+    tree.add(node.ex.begin, node.ex.end, node.ptr, node.client_id,
+             node.epoch);
+  }
+  return moved;
+}
+
+// Call fn(piece, shadowed) on the pieces of node, a node of this rank in the
+// global tree of b. A piece is shadowed if the local tree of b maps it to
+// other data, i.e. the rank has overwritten it since it was synced.
+template <typename Fn>
+inline auto split_shadowed(const bb& b,
+                           const extent_tree::node& node,
+                           Fn&& fn) -> void {
+  auto pos = node.ex.begin;
+  for (auto it = b.local_tree.find(node.ex);
+       it != b.local_tree.end() && it->ex.begin < node.ex.end; ++it) {
+    auto begin = std::max(it->ex.begin, node.ex.begin);
+    auto end = std::min(it->ex.end, node.ex.end);
+    if (pos < begin) {
+      fn(node.slice(pos, begin), false);
+    }
+    auto piece = node.slice(begin, end);
+    fn(piece, piece.ptr != it->ptr + (begin - it->ex.begin));
+    pos = end;
+  }
+  if (pos < node.ex.end) {
+    fn(node.slice(pos, node.ex.end), false);
+  }
+}
 }  // namespace detail
 
 class bb_handler {
  public:
+  // default stripe size of flush_to_file()
+  static constexpr size_t default_stripe_size = 1ULL << 20;
+  // size of the buffer each aggregator uses in flush_to_file()
+  static constexpr size_t flush_buffer_size = 16ULL << 20;
+  // default size of the chunks read by each rank in stage_in()
+  static constexpr size_t default_stage_chunk_size = 4ULL << 20;
+
+  // What serialize_delta() sends: the extents of the rank and the epoch it
+  // proposes for the sync
+  struct sync_delta {
+    uint32_t epoch;
+    extent_tree tree;
+
+    using serialize = zpp::bits::members<2>;
+  };
+
   bb_handler(peanuts::rpm& rpm_ref,
              local_ring_buffer& local_ring,
              const std::vector<remote_ring_buffer>& remote_rings,
              std::shared_ptr<bb> bb,
-             mpi::comm comm,
+             std::shared_ptr<const mpi::comm> comm,
              peanuts::deferred_file&& file,
-             size_t initial_file_size)
+             size_t initial_file_size,
+             uint64_t log_epoch = 0,
+             persistent_extent_index* index = nullptr,
+             ring_space* space = nullptr,
+             extent_merger* merger = nullptr,
+             progress_thread* progress = nullptr)
       : rpm_ref_{std::ref(rpm_ref)},
         local_ring_{std::ref(local_ring)},
         remote_rings_{std::cref(remote_rings)},
@@ -64,7 +269,15 @@ class bb_handler {
         comm_{std::move(comm)},
         file_{std::move(file)},
         global_rank_{rpm().topo().rank()},
-        deferred_file_size_{initial_file_size} {}
+        deferred_file_size_{initial_file_size},
+        log_epoch_{log_epoch},
+        index_{index},
+        space_{space},
+        merger_{merger},
+        progress_{progress},
+        delta_{std::make_shared<extent_tree>(bb_->local_tree)} {
+    bb_->deltas.push_back(delta_);
+  }
 
   auto bb_ref() -> peanuts::bb& { return *bb_; }
 
@@ -73,6 +286,7 @@ class bb_handler {
     if (bb_->global_tree.size() != 0) {
       size = bb_->global_tree.back().ex.end;
     }
+    size = std::max(size, bb_->global_cold.end_offset());
     if (bb_->local_tree.size() != 0) {
       size = std::max(size, bb_->local_tree.back().ex.end);
     }
@@ -84,7 +298,7 @@ class bb_handler {
   // collective
   auto truncate(size_t size) -> void {
     int truncated = 0;
-    if (comm_.rank() == 0) {
+    if (comm_->rank() == 0) {
       try {
         file_.truncate(size);
       } catch (...) {
@@ -92,7 +306,7 @@ class bb_handler {
       }
     }
 
-    comm_.broadcast(truncated);
+    comm_->broadcast(truncated);
     if (truncated != 0) {
       throw std::system_error{errno, std::system_category(),
                               "Failed to truncate file"};
@@ -102,11 +316,26 @@ class bb_handler {
       bb_->local_tree.remove(size, UINT64_MAX);
     }
 
+    for_each_delta([&](extent_tree& delta) {
+      if (delta.size() != 0 && delta.back().ex.end > size) {
+        delta.remove(size, UINT64_MAX);
+      }
+    });
+
+    bb_->global_cold.truncate(bb_->global_tree, size);
     if (bb_->global_tree.size() != 0 && bb_->global_tree.back().ex.end > size) {
       bb_->global_tree.remove(size, UINT64_MAX);
     }
 
+    if (index_ != nullptr) {
+      index_->append_truncate(bb_->ino, size);
+    }
+    if (space_ != nullptr) {
+      space_->collect(bb_->ino);
+    }
+
     deferred_file_size_ = size;
+    republish();
   }
 
   // collective
@@ -116,71 +345,494 @@ class bb_handler {
   }
 
   // collective
+  // Only the extents written since the previous sync through this handler
+  // (or, for the first one, the whole local tree) are exchanged, including
+  // those written through other handlers of the file.
   void sync_extent() {
-    if (comm_.size() == 1) {
+    if (comm_->size() == 1) {
+      ++sync_epoch_;
+      last_delta_size_ = delta_->size();
+      if (rpm().topo().size() == 1) {
+        for_each_delta([](extent_tree& delta) { delta.clear(); });
+      } else {
+        delta_->clear();
+      }
+      republish();
       return;
     }
 
-    // serialize local extent tree
-    auto [ser_local_tree, out] = zpp::bits::data_out();
-    out(bb_->local_tree).or_throw();
+    // all_gather extents added since the last sync
+    auto [ser_delta, out] = zpp::bits::data_out();
+    serialize_delta(out);
+    auto ser_deltas = detail::all_gather_serialized(*comm_, ser_delta);
 
-    // all_gather serialized local tree size
-    const auto& topo = rpm().topo();
-    auto sizes = std::vector<int>(topo.size());
-    comm_.all_gather(static_cast<int>(ser_local_tree.size()), std::span{sizes});
+    // deserialize deltas and merge into global tree
+    auto in = zpp::bits::in{ser_deltas};
+    auto deltas = std::vector<sync_delta>(comm_->size());
+    for (auto& delta : deltas) {
+      in(delta).or_throw();
+    }
+    merge_deltas(deltas);
+  }
 
-    // all_gather_v serialized local tree
-    auto [ser_local_trees, in] = zpp::bits::data_in();
-    ser_local_trees.resize(std::accumulate(sizes.begin(), sizes.end(), 0ULL));
-    if (ser_local_trees.size() == 0) {
-      return;
+  // number of sync_extent() calls made through this handler
+  auto sync_epoch() const -> uint64_t { return sync_epoch_; }
+  // number of extents this rank contributed to the last of them
+  auto last_delta_size() const -> size_t { return last_delta_size_; }
+
+  // collective
+  // Merge the synced extents restored from the persistent index of every
+  // rank in the order they were originally synced, then sync as usual.
+  auto restore_extent(
+      std::vector<persistent_extent_index::restored_node> restored) -> void {
+    if (comm_->size() > 1) {
+      auto [ser_restored, out] = zpp::bits::data_out();
+      out(restored).or_throw();
+      auto ser_all_restored =
+          detail::all_gather_serialized(*comm_, ser_restored);
+
+      auto in = zpp::bits::in{ser_all_restored};
+      restored.clear();
+      auto tmp = std::vector<persistent_extent_index::restored_node>{};
+      for (int i = 0; i < comm_->size(); ++i) {
+        in(tmp).or_throw();
+        restored.insert(restored.end(), tmp.begin(), tmp.end());
+      }
     }
-    comm_.all_gather_v(std::as_bytes(std::span{ser_local_tree}),
-                       std::as_writable_bytes(std::span{ser_local_trees}),
-                       std::span{sizes});
+    merge_restored(std::move(restored));
+    sync_extent();
+  }
 
-    // deserialize remote local trees and merge into global tree
-    auto tmp_tree = extent_tree{};
-    for (size_t i = 0; i < sizes.size(); ++i) {
-      if (in.remaining_data().empty()) {
-        break;
+  // The two halves of sync_extent(), so that bb_store can sync the handlers
+  // of many files opened over the same communicator in one exchange.
+  template <typename Archive>
+  auto serialize_delta(Archive& out) -> void {
+    ++sync_epoch_;
+    page_in_global(*delta_);
+    auto resolved = resolve_delta();
+    last_delta_size_ = resolved.size();
+    out(sync_delta{bb_->global_epoch + 1, std::move(resolved)}).or_throw();
+    delta_->clear();
+  }
+
+  // deltas[i] is the delta serialized by comm rank i. The sync takes the
+  // latest epoch proposed, so that all ranks stamp the nodes alike; where
+  // deltas overlap, the nodes of higher client ids win, and the result does
+  // not depend on the order the deltas are merged in.
+  auto merge_deltas(std::vector<sync_delta>& deltas) -> void {
+    auto epoch = std::max_element(deltas.begin(), deltas.end(),
+                                  [](const auto& lhs, const auto& rhs) {
+                                    return lhs.epoch < rhs.epoch;
+                                  })
+                     ->epoch;
+    auto trees = std::vector<const extent_tree*>{};
+    for (auto& delta : deltas) {
+      delta.tree.stamp(epoch);
+      page_in_global(delta.tree);
+      trees.push_back(&delta.tree);
+    }
+    if (merger_ != nullptr) {
+      merger_->merge(bb_->global_tree, trees);
+    } else {
+      for (const auto* tree : trees) {
+        bb_->global_tree.merge(*tree);
       }
-      in(tmp_tree).or_throw();
-      bb_->global_tree.merge(tmp_tree);
+    }
+    bb_->global_epoch = epoch;
+
+    if (index_ != nullptr) {
+      index_->append_sync(bb_->ino);
     }
 
     // clear merged local tree if all ranks have been synced
-    if (comm_.size() == rpm().topo().size()) {
+    if (comm_->size() == rpm().topo().size()) {
       bb_->local_tree.clear();
+      for_each_delta([](extent_tree& delta) { delta.clear(); });
+      trim_global();
+      republish();
+      return;
+    }
+
+    // otherwise keep it for syncs over other communicators, but drop what
+    // other ranks have overwritten so that reads do not see stale data
+    for (int i = 0; i < comm_->size(); ++i) {
+      if (i == comm_->rank()) {
+        continue;
+      }
+      bb_->global_tree.query_sorted(
+          deltas[i].tree, [&](const extent& ex, const extent_tree::node& node) {
+            if (node.client_id != global_rank_) {
+              auto overwritten = node.ex.get_intersection(ex);
+              bb_->local_tree.remove(overwritten.begin, overwritten.end);
+              for_each_delta([&](extent_tree& delta) {
+                delta.remove(overwritten.begin, overwritten.end);
+              });
+            }
+          });
     }
+    trim_global();
+    republish();
+  }
+
+  // restored holds the nodes restored by every comm rank, in rank order;
+  // nodes of later ranks win within a sync, as in merge_deltas(). The nodes
+  // of the seq-th sync get epoch seq + 1.
+  auto merge_restored(std::vector<persistent_extent_index::restored_node>
+                          restored) -> void {
+    std::stable_sort(
+        restored.begin(), restored.end(),
+        [](const auto& lhs, const auto& rhs) { return lhs.seq < rhs.seq; });
+    for (const auto& r : restored) {
+      auto epoch = static_cast<uint32_t>(r.seq + 1);
+      page_in_global(r.node.ex);
+      bb_->global_tree.add(r.node.ex.begin, r.node.ex.end, r.node.ptr,
+                           r.node.client_id, epoch);
+      bb_->global_epoch = std::max(bb_->global_epoch, epoch);
+    }
+    trim_global();
   }
 
   // collective
   auto sync_file_size() -> void {
     ssize_t file_size = -1;
-    if (comm_.rank() == 0) {
+    if (comm_->rank() == 0) {
       try {
         file_size = file_.size();
       } catch (...) {
       }
     }
-    comm_.broadcast(file_size);
+    comm_->broadcast(file_size);
     if (file_size < 0) {
       throw std::system_error{errno, std::system_category(),
                               "Failed to get file size"};
     }
     deferred_file_size_ = file_size;
+    republish();
+  }
+
+  // Publish a snapshot of the trees for readers on other threads, see
+  // snapshot() and pread_snapshot(). Once published, snapshots are refreshed
+  // by every sync, truncate and compaction, but not by writes: the writes of
+  // this rank since then are only seen by snapshot readers after the next
+  // sync or publish().
+  auto publish() -> void {
+    // readers on other threads must not race on the deferred open
+    (void)file_.fd();
+    detail::publish(*bb_, global_rank_, deferred_file_size_, space_);
+  }
+
+  // The latest published snapshot, or nullptr. May be called on any thread.
+  auto snapshot() const -> std::shared_ptr<const bb_snapshot> {
+    return bb_->published.load();
+  }
+
+  // Read into buf at ofs as of snapshot. May be called on any thread, at the
+  // same time as the other methods are called on the thread that owns the
+  // handler, which must outlive the call.
+  auto pread_snapshot(const bb_snapshot& snapshot,
+                      std::span<std::byte> buf,
+                      off_t ofs) -> ssize_t {
+    // pread() of a remote ring may be called on several threads at once
+    auto read_remote = [&](const flat_extent_index::node& node, extent ex) {
+      rring(node.client_id)
+          .pread(buf.subspan(ex.begin - ofs, ex.size()),
+                 node.ptr + (ex.begin - node.ex.begin));
+    };
+    auto holes = hole_vector{};
+    auto eof = read_trees(snapshot.local_tree, snapshot.global_tree,
+                          snapshot.file_size, buf, ofs, holes, read_remote);
+    if (holes.empty()) {
+      return buf.size();
+    }
+    return read_holes_from_file(buf, ofs, holes, eof);
+  }
+
+  // The *_async() calls run on the progress thread of the store, if it has
+  // been started, and right away otherwise, so that the application can
+  // compute meanwhile. Until the future of a collective one is ready, the
+  // store and its handlers must not be used but for pread_snapshot().
+
+  // collective
+  auto sync_async() -> std::future<void> {
+    return submit([this] { sync(); });
+  }
+
+  // collective
+  auto flush_to_file_async(size_t stripe_size = default_stripe_size)
+      -> std::future<void> {
+    return submit([this, stripe_size] { flush_to_file(stripe_size); });
+  }
+
+  // Read into buf at ofs like pread_snapshot() from the latest snapshot,
+  // which is published first if there is none. Unlike the other calls, the
+  // handler may be used meanwhile; buf must outlive the read.
+  auto pread_async(std::span<std::byte> buf, off_t ofs)
+      -> std::future<ssize_t> {
+    auto snap = snapshot();
+    if (!snap) {
+      publish();
+      snap = snapshot();
+    }
+    return submit([this, snap = std::move(snap), buf, ofs] {
+      return pread_snapshot(*snap, buf, ofs);
+    });
+  }
+
+  // collective
+  // Write everything in the burst buffer back to the file, in two phases:
+  // the file is split into contiguous, stripe-aligned domains, one per node
+  // of comm, and the first rank of each node pulls the extents of its domain
+  // from the rings and writes them with large sequential writes. Ranges that
+  // were never written through peanuts are left untouched.
+  auto flush_to_file(size_t stripe_size = default_stripe_size) -> void {
+    sync_extent();
+    // the whole tree is written back, so it is paged in for the duration
+    bb_->global_cold.page_in_all(bb_->global_tree);
+
+    // a single rank never merges its local tree into the global tree
+    auto merged_tree = extent_tree{};
+    if (comm_->size() == 1) {
+      merged_tree = bb_->global_tree;
+      merged_tree.merge(bb_->local_tree);
+    }
+    const auto& tree = comm_->size() == 1 ? merged_tree : bb_->global_tree;
+
+    const auto& node_comm = this->node_comm();
+    int is_aggregator = node_comm.rank() == 0 ? 1 : 0;
+    auto aggregators = std::vector<int>(comm_->size());
+    comm_->all_gather(is_aggregator, std::span{aggregators});
+    auto naggs = std::count(aggregators.begin(), aggregators.end(), 1);
+    auto agg_index = std::count(aggregators.begin(),
+                                aggregators.begin() + comm_->rank(), 1);
+
+    int failed = 0;
+    if (is_aggregator != 0 && tree.size() != 0) {
+      auto begin = tree.begin()->ex.begin / stripe_size * stripe_size;
+      auto end = tree.back().ex.end;
+      auto nstripes = (end - begin + stripe_size - 1) / stripe_size;
+      auto domain_size = (nstripes + naggs - 1) / naggs * stripe_size;
+      auto domain_begin = std::min(end, begin + agg_index * domain_size);
+      auto domain_end = std::min(end, domain_begin + domain_size);
+      try {
+        flush_domain(tree, {domain_begin, domain_end}, stripe_size);
+      } catch (...) {
+        failed = 1;
+      }
+    }
+
+    auto failures = std::vector<int>(comm_->size());
+    comm_->all_gather(failed, std::span{failures});
+    if (std::find(failures.begin(), failures.end(), 1) != failures.end()) {
+      throw std::system_error{EIO, std::system_category(),
+                              "bb_handler::flush_to_file(): Failed to write"};
+    }
+    trim_global();
+    sync_file_size();
+  }
+
+  // collective
+  // Prefetch [begin, end) of the file into the burst buffer, so that later
+  // reads are served from the rings. The range is read in chunks that are
+  // dealt out to the ranks of each node in turn; only the parts of the file
+  // that are not in the burst buffer yet are read and appended to the ring.
+  auto stage_in(uint64_t begin = 0,
+                uint64_t end = UINT64_MAX,
+                size_t chunk_size = default_stage_chunk_size) -> void {
+    sync_extent();
+    sync_file_size();
+    end = std::min<uint64_t>(end, deferred_file_size_);
+
+    // chunk i goes to the (i % comm size)-th rank in (node rank, rank) order,
+    // so that consecutive chunks are read from different nodes
+    const auto& node_comm = this->node_comm();
+    auto node_ranks = std::vector<int>(comm_->size());
+    comm_->all_gather(node_comm.rank(), std::span{node_ranks});
+    auto order = std::vector<int>(comm_->size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int lhs, int rhs) {
+      return node_ranks[lhs] < node_ranks[rhs];
+    });
+    auto my_slot = static_cast<uint64_t>(
+        std::find(order.begin(), order.end(), comm_->rank()) - order.begin());
+
+    int failed = 0;
+    try {
+      auto buf = std::vector<std::byte>{};
+      auto stride = chunk_size * comm_->size();
+      for (auto chunk_begin = begin + my_slot * chunk_size; chunk_begin < end;
+           chunk_begin += stride) {
+        auto chunk =
+            extent{chunk_begin, std::min(end, chunk_begin + chunk_size)};
+        auto arena = extent_list::arena{};
+        for (const auto& hole : holes(chunk, arena.resource())) {
+          buf.resize(hole.size());
+          auto rsize = file_.pread(buf, hole.begin);
+          if (rsize < 0) {
+            throw std::system_error{errno, std::system_category(),
+                                    "Failed to read file"};
+          }
+          if (rsize > 0) {
+            pwrite(std::span{buf}.subspan(0, rsize), hole.begin);
+          }
+        }
+      }
+    } catch (...) {
+      failed = 1;
+    }
+
+    sync_extent();
+    auto failures = std::vector<int>(comm_->size());
+    comm_->all_gather(failed, std::span{failures});
+    if (std::find(failures.begin(), failures.end(), 1) != failures.end()) {
+      throw std::system_error{EIO, std::system_category(),
+                              "bb_handler::stage_in(): Failed to stage in"};
+    }
   }
 
   auto pwrite(std::span<const std::byte> buf, off_t ofs) const -> ssize_t {
+#ifdef PEANUTS_USE_LOG_RECORDS
+    auto reserved = sizeof(log_record_header) + buf.size();
+#else
+    auto reserved = buf.size();
+#endif
+    if (space_ != nullptr) {
+      space_->prepare(bb_->ino, reserved);
+    }
+
+#ifdef PEANUTS_USE_LOG_RECORDS
+    auto lsn =
+        append_log_record(ring(), log_record_header::record_type::data,
+                          log_epoch_, bb_->ino, ofs, buf);
+    if (!lsn) {
+      throw std::system_error{ENOSPC, std::system_category(),
+                              "ring buffer full"};
+    }
+#else
     auto lsn = ring().reserve_nb(buf.size());
     if (!lsn) {
       throw std::system_error{ENOSPC, std::system_category(),
                               "ring buffer full"};
     }
     ring().pwrite(buf, *lsn);
+#endif
+    if (space_ != nullptr) {
+      space_->add(bb_->ino, *lsn + buf.size() - reserved, reserved);
+    }
     bb_->local_tree.add(ofs, ofs + buf.size(), *lsn, global_rank_);
+    for_each_delta([&](extent_tree& delta) {
+      delta.add(ofs, ofs + buf.size(), *lsn, global_rank_);
+    });
+    if (index_ != nullptr) {
+      // does not fail once the write is in; a full index spills instead
+      index_->append_extent(bb_->ino, ofs, ofs + buf.size(), *lsn);
+    }
+    return buf.size();
+  }
+
+  // collective
+  // Write buf at ofs on every rank of comm at once. The writes of the ranks
+  // on a node are gathered to the first of them, which appends them to its
+  // ring as one extent per contiguous range, so that fine-grained writes do
+  // not leave one tree node each. Where writes overlap, later ranks win.
+  // The ranks of the node read the written ranges from the aggregator right
+  // away; like its other writes, they become visible to the other ranks with
+  // the next sync_extent().
+  auto pwrite_all(std::span<const std::byte> buf, off_t ofs) -> ssize_t {
+    const auto& node_comm = this->node_comm();
+    auto is_root = node_comm.rank() == 0;
+
+    auto write_ex = std::array<uint64_t, 2>{
+        static_cast<uint64_t>(ofs), static_cast<uint64_t>(ofs) + buf.size()};
+    auto write_exs = std::vector<uint64_t>(2 * node_comm.size());
+    node_comm.all_gather(std::span<const uint64_t>{write_ex},
+                         std::span{write_exs});
+
+    // every rank checks that the writes fit in the int counts of MPI, so
+    // that they all fail together
+    auto total = uint64_t{0};
+    for (size_t i = 0; i < write_exs.size(); i += 2) {
+      total += write_exs[i + 1] - write_exs[i];
+    }
+    mpi::to_count(total);
+    auto counts = std::vector<int>(node_comm.size());
+    for (size_t i = 0; i < counts.size(); ++i) {
+      counts[i] = static_cast<int>(write_exs[2 * i + 1] - write_exs[2 * i]);
+    }
+    auto data = std::vector<std::byte>(is_root ? total : 0);
+    node_comm.gather_v(buf, std::span{data}, std::span<const int>{counts});
+
+    int failed = 0;
+    auto placed = std::vector<uint64_t>{};  // begin, end and ptr of each run
+    if (is_root) {
+      try {
+        // merge the writes into contiguous runs laid out back to back
+        auto covered = extent_list{};
+        for (size_t i = 0; i < counts.size(); ++i) {
+          if (counts[i] > 0) {
+            covered.add({write_exs[2 * i], write_exs[2 * i + 1]});
+          }
+        }
+        auto runs = std::vector<extent>(covered.begin(), covered.end());
+        auto run_ofs = std::vector<size_t>(runs.size() + 1);
+        for (size_t i = 0; i < runs.size(); ++i) {
+          run_ofs[i + 1] = run_ofs[i] + runs[i].size();
+        }
+
+        auto staged = std::vector<std::byte>(run_ofs.back());
+        auto src = std::span<const std::byte>{data};
+        for (size_t i = 0; i < counts.size(); ++i) {
+          auto ex = extent{write_exs[2 * i], write_exs[2 * i + 1]};
+          if (ex.size() == 0) {
+            continue;
+          }
+          auto run = std::prev(std::upper_bound(
+              runs.begin(), runs.end(), ex.begin,
+              [](uint64_t begin, const extent& r) { return begin < r.begin; }));
+          auto dst = run_ofs[run - runs.begin()] + (ex.begin - run->begin);
+          std::copy_n(src.begin(), ex.size(), staged.begin() + dst);
+          src = src.subspan(ex.size());
+        }
+
+        for (size_t i = 0; i < runs.size(); ++i) {
+          pwrite(std::span<const std::byte>{staged}.subspan(run_ofs[i],
+                                                            runs[i].size()),
+                 runs[i].begin);
+          auto node = bb_->local_tree.find(runs[i].begin, runs[i].end);
+          placed.push_back(runs[i].begin);
+          placed.push_back(runs[i].end);
+          placed.push_back(node->ptr + (runs[i].begin - node->ex.begin));
+        }
+      } catch (...) {
+        failed = 1;
+      }
+    }
+
+    auto header = std::array<uint64_t, 3>{
+        static_cast<uint64_t>(failed), static_cast<uint64_t>(global_rank_),
+        placed.size()};
+    node_comm.broadcast(header);
+    if (header[0] != 0) {
+      throw std::system_error{ENOSPC, std::system_category(),
+                              "bb_handler::pwrite_all(): Failed to write"};
+    }
+    placed.resize(header[2]);
+    node_comm.broadcast(placed);
+    if (!is_root) {
+      // The runs are newer than what the ranks of the node wrote before, so
+      // those writes must neither be read nor synced any more.
+      auto root = static_cast<int>(header[1]);
+      for (size_t i = 0; i < placed.size(); i += 3) {
+        auto begin = placed[i];
+        auto end = placed[i + 1];
+        bb_->local_tree.remove(begin, end);
+        for_each_delta(
+            [&](extent_tree& delta) { delta.remove(begin, end); });
+        page_in_global({begin, end});
+        bb_->global_tree.add(begin, end, placed[i + 2], root,
+                             bb_->global_epoch);
+      }
+      trim_global();
+    }
     return buf.size();
   }
 
@@ -197,85 +849,245 @@ class bb_handler {
   }
 
   auto pread_noflush(std::span<std::byte> buf, off_t ofs) -> ssize_t {
-    auto el = extent_list{};
-    auto user_buf_extent = extent{static_cast<uint64_t>(ofs),
-                                  static_cast<uint64_t>(ofs) + buf.size()};
-    uint64_t eof = 0;
+    auto read_remote = [&](const extent_tree::node& node, extent ex) {
+      rring(node.client_id)
+#ifdef PEANUTS_USE_AGG_READ
+          .pread_noflush(
+#else
+#warning \
+    "PEANUTS_USE_AGG_READ is not defined. This may cause performance degradation."
+          .pread(
+#endif
+              buf.subspan(ex.begin - ofs, ex.size()),
+              node.ptr + (ex.begin - node.ex.begin));
+    };
+    page_in_global({static_cast<uint64_t>(ofs), ofs + buf.size()});
+    auto holes = hole_vector{};
+    auto eof = read_trees(bb_->local_tree, bb_->global_tree,
+                          deferred_file_size_, buf, ofs, holes, read_remote);
+    trim_global();
+    if (holes.empty()) {
+      return buf.size();
+    }
 
-    if (bb_->local_tree.size() != 0) {
-      eof = bb_->local_tree.back().ex.end;
+    // read remaining from file
+    return read_holes_from_file(buf, ofs, holes, eof);
+  }
 
-      // read from local ring
-      for (auto it = bb_->local_tree.find(user_buf_extent);
-           it != bb_->local_tree.end(); ++it) {
-        if (!it->ex.overlaps(user_buf_extent)) {
-          break;
-        }
-        auto valid_extent = it->ex.get_intersection(user_buf_extent);
-        el.add(valid_extent);
-        ring().pread(buf.subspan(valid_extent.begin - ofs, valid_extent.size()),
-                     it->ptr + (valid_extent.begin - it->ex.begin));
+  // collective
+  // Read into buf at ofs on every rank of comm at once. Rather than getting
+  // remote extents one by one with RMA, each rank sends its read requests to
+  // the owners of the extents, which read them from their own rings and
+  // send the data back in a single MPI_Alltoallv. Extents owned by ranks
+  // outside comm are still read with RMA.
+  auto pread_all(std::span<std::byte> buf, off_t ofs) -> ssize_t {
+    struct read_request {
+      local_ring_buffer::lsn_t lsn;
+      uint64_t size;
+    };
+
+    // requests[i] and dests[i] are sent to and served by comm rank i
+    auto requests = std::vector<std::vector<read_request>>(comm_->size());
+    auto dests = std::vector<std::vector<extent>>(comm_->size());
+    bool use_rma = false;
+    auto read_global = [&](const extent_tree::node& node, extent ex) {
+      auto dst = buf.subspan(ex.begin - ofs, ex.size());
+      auto lsn = node.ptr + (ex.begin - node.ex.begin);
+      if (node.client_id == global_rank_) {
+        ring().pread(dst, lsn);
+      } else if (auto rank = comm_rank_of(node.client_id);
+                 rank != MPI_UNDEFINED) {
+        requests[rank].push_back({lsn, ex.size()});
+        dests[rank].push_back(ex);
+      } else {
+        rring(node.client_id).pread_noflush(dst, lsn);
+        use_rma = true;
+      }
+    };
+    page_in_global({static_cast<uint64_t>(ofs), ofs + buf.size()});
+    auto holes = hole_vector{};
+    auto eof = read_trees(bb_->local_tree, bb_->global_tree,
+                          deferred_file_size_, buf, ofs, holes, read_global);
+    trim_global();
+
+    // exchange the sizes of the requests and of the data asked for, in 64
+    // bits, and check that those sent and received by each rank fit in the
+    // int counts of MPI
+    auto nranks = static_cast<size_t>(comm_->size());
+    auto send_sizes = std::vector<uint64_t>(2 * nranks);
+    auto send_requests = std::vector<read_request>{};
+    for (size_t i = 0; i < nranks; ++i) {
+      send_sizes[2 * i] = requests[i].size() * sizeof(read_request);
+      for (const auto& req : requests[i]) {
+        send_sizes[2 * i + 1] += req.size;
       }
+      send_requests.insert(send_requests.end(), requests[i].begin(),
+                           requests[i].end());
+    }
+    auto recv_sizes = std::vector<uint64_t>(2 * nranks);
+    comm_->all_to_all(std::span<const uint64_t>{send_sizes},
+                      std::span{recv_sizes});
+    auto to_counts = [&](const std::vector<uint64_t>& sizes, size_t field) {
+      auto counts = std::vector<int>(nranks);
+      auto total = uint64_t{0};
+      for (size_t i = 0; i < nranks; ++i) {
+        total += sizes[2 * i + field];
+        counts[i] = static_cast<int>(sizes[2 * i + field]);
+      }
+      mpi::to_count(total);
+      return counts;
+    };
+    auto send_counts = std::vector<int>{};
+    auto recv_counts = std::vector<int>{};
+    auto data_counts = std::vector<int>{};
+    auto reply_counts = std::vector<int>{};
+    int overflow = 0;
+    try {
+      send_counts = to_counts(send_sizes, 0);
+      recv_counts = to_counts(recv_sizes, 0);
+      data_counts = to_counts(send_sizes, 1);
+      reply_counts = to_counts(recv_sizes, 1);
+    } catch (const std::system_error&) {
+      overflow = 1;
+    }
+    auto overflows = std::vector<int>(nranks);
+    comm_->all_gather(overflow, std::span{overflows});
+    if (std::find(overflows.begin(), overflows.end(), 1) != overflows.end()) {
+      throw std::system_error{EOVERFLOW, std::generic_category(),
+                              "bb_handler::pread_all(): Too much data"};
+    }
+
+    // exchange the requests
+    auto recv_requests = std::vector<read_request>(
+        std::reduce(recv_counts.begin(), recv_counts.end(), size_t{0}) /
+        sizeof(read_request));
+    comm_->all_to_all_v(std::as_bytes(std::span{send_requests}),
+                        std::span<const int>{send_counts},
+                        std::as_writable_bytes(std::span{recv_requests}),
+                        std::span<const int>{recv_counts});
+
+    // serve the requests from the local ring, in the order they arrived
+    auto replies = std::vector<std::byte>(
+        std::reduce(reply_counts.begin(), reply_counts.end(), size_t{0}));
+    auto pos = size_t{0};
+    for (const auto& req : recv_requests) {
+      ring().pread(std::span{replies}.subspan(pos, req.size), req.lsn);
+      pos += req.size;
     }
 
-    auto hole_el = el.inverse(user_buf_extent);
-    if (hole_el.empty()) {
+    // exchange the data
+    auto data = std::vector<std::byte>(
+        std::reduce(data_counts.begin(), data_counts.end(), size_t{0}));
+    comm_->all_to_all_v(std::span<const std::byte>{replies},
+                        std::span<const int>{reply_counts}, std::span{data},
+                        std::span<const int>{data_counts});
+
+    auto src = std::span<const std::byte>{data};
+    for (const auto& rank_dests : dests) {
+      for (const auto& ex : rank_dests) {
+        std::copy_n(src.begin(), ex.size(), buf.begin() + (ex.begin - ofs));
+        src = src.subspan(ex.size());
+      }
+    }
+    if (use_rma) {
+      rring(0).flush();
+    }
+
+    if (holes.empty()) {
       return buf.size();
     }
+    return read_holes_from_file(buf, ofs, holes, eof);
+  }
 
-    // read remaining from remote rings
-    if (bb_->global_tree.size() != 0) {
-      eof = std::max(eof, bb_->global_tree.back().ex.end);
-
-      auto hole_it = hole_el.begin();
-      auto global_it = bb_->global_tree.find(hole_el.outer_extent());
-      while (hole_it != hole_el.end() && global_it != bb_->global_tree.end()) {
-        auto& hole_ex = *hole_it;
-        auto& global_ex = global_it->ex;
-
-        if (hole_ex.end <= global_ex.begin) {
-          ++hole_it;
-        } else if (global_ex.end <= hole_ex.begin) {
-          ++global_it;
-        } else {
-          // has overlap
-          auto valid_ex = hole_ex.get_intersection(global_ex);
-          el.add(valid_ex);
+ private:
+  // holes of a read, few enough in the common case to stay off the heap
+  using hole_vector = utils::small_vector<extent, 8>;
+
+  // Fill buf at ofs from the trees in a single pass over both. The parts the
+  // local tree covers are read from the local ring, the global extents in the
+  // gaps between them go to read_global(node, ex), and whatever is left is
+  // added to holes, in order. Returns the end of the file as seen from the
+  // trees and file_size.
+  template <typename Tree, typename ReadGlobal>
+  auto read_trees(const Tree& local,
+                  const Tree& global,
+                  uint64_t file_size,
+                  std::span<std::byte> buf,
+                  off_t ofs,
+                  hole_vector& holes,
+                  ReadGlobal&& read_global) const -> uint64_t {
+    auto eof = file_size;
+    eof = std::max(eof, local.size() != 0 ? local.back().ex.end : 0);
+    eof = std::max(eof, global.size() != 0 ? global.back().ex.end : 0);
+
+    auto pos = static_cast<uint64_t>(ofs);
+    const auto end = pos + buf.size();
+    if (pos == end) {
+      return eof;
+    }
+    auto add_hole = [&](uint64_t begin, uint64_t hole_end) {
+      if (!holes.empty() && holes.back().end == begin) {
+        holes.back().end = hole_end;
+      } else {
+        holes.push_back({begin, hole_end});
+      }
+    };
+
+    auto local_it = local.find(pos, end);
+    auto global_it = global.find(pos, end);
+    while (pos < end) {
+      if (local_it != local.end() && local_it->ex.begin <= pos) {
+        auto ex = extent{pos, std::min(end, local_it->ex.end)};
+        ring().pread(buf.subspan(pos - ofs, ex.size()),
+                     local_it->ptr + (pos - local_it->ex.begin));
+        pos = ex.end;
+        ++local_it;
+        continue;
+      }
 
-          // read from remote rings
-          rring(global_it->client_id)
-#ifdef PEANUTS_USE_AGG_READ
-              .pread_noflush(
-#else
-#warning \
-    "PEANUTS_USE_AGG_READ is not defined. This may cause performance degradation."
-              .pread(
-#endif
-                  buf.subspan(valid_ex.begin - ofs, valid_ex.size()),
-                  global_it->ptr + (valid_ex.begin - global_ex.begin));
-
-          if (hole_ex.end < global_ex.end) {
-            ++hole_it;
-          } else if (global_ex.end < hole_ex.end) {
-            ++global_it;
-          } else {
-            ++hole_it;
-            ++global_it;
-          }
+      // the gap up to the next local extent
+      auto gap_end = local_it != local.end() && local_it->ex.begin < end
+                         ? local_it->ex.begin
+                         : end;
+      while (global_it != global.end() && global_it->ex.end <= pos) {
+        ++global_it;
+      }
+      for (; global_it != global.end() && global_it->ex.begin < gap_end;
+           ++global_it) {
+        auto ex = extent{std::max(pos, global_it->ex.begin),
+                         std::min(gap_end, global_it->ex.end)};
+        if (pos < ex.begin) {
+          add_hole(pos, ex.begin);
+        }
+        read_global(*global_it, ex);
+        pos = ex.end;
+        if (global_it->ex.end > gap_end) {
+          break;
         }
       }
-
-      hole_el = el.inverse(user_buf_extent);
-      if (hole_el.empty()) {
-        return buf.size();
+      if (pos < gap_end) {
+        add_hole(pos, gap_end);
+        pos = gap_end;
       }
     }
+    return eof;
+  }
 
-    // read remaining from file
+  // Read hole_el from the file. eof is the end of the file as seen from the
+  // extent trees; holes the file does not cover before it are zero-filled.
+  auto read_holes_from_file(std::span<std::byte> buf,
+                            off_t ofs,
+                            std::span<const extent> hole_el,
+                            uint64_t eof) -> ssize_t {
     for (auto it = hole_el.begin(); it != hole_el.end(); ++it) {
       const auto& hole_ex = *it;
-      auto rsize = file_.pread(buf.subspan(hole_ex.begin - ofs, hole_ex.size()),
-                               hole_ex.begin);
+      // pread(2) rather than a seek and a read, for snapshot readers
+      auto rsize = ::pread(file_.fd(), buf.data() + (hole_ex.begin - ofs),
+                           hole_ex.size(), hole_ex.begin);
+      if (rsize < 0) {
+        throw std::system_error{errno, std::system_category(),
+                                "Failed to read file"};
+      }
       auto remain = hole_ex.size() - rsize;
       if (remain > 0) {
         // reach the end of file,
@@ -291,7 +1103,7 @@ class bb_handler {
         std::memset(buf.data() + (hole_ex.begin - ofs + rsize), 0, fill_size);
 
         // remaining holes should be filled with zeros
-        for (; it != hole_el.end(); ++it) {
+        for (++it; it != hole_el.end(); ++it) {
           const auto& hole_ex = *it;
           if (hole_ex.begin >= eof) {
             // reach true EOF
@@ -300,17 +1112,173 @@ class bb_handler {
           fill_size = std::min(hole_ex.size(), eof - hole_ex.begin);
           std::memset(buf.data() + (hole_ex.begin - ofs), 0, fill_size);
         }
+        break;
       }
     }
 
-    if (ofs + buf.size() >= eof) {
+    // like pread(2), nothing is read at or past eof, which takes the data
+    // of the file beyond the end of the trees into account
+    if (static_cast<uint64_t>(ofs) >= eof) {
+      return 0;
+    } else if (ofs + buf.size() >= eof) {
       return eof - ofs;
     } else {
       return buf.size();
     }
   }
 
- private:
+  // rank in comm of the given rank in the topology communicator, or
+  // MPI_UNDEFINED if it is not in comm
+  auto comm_rank_of(int global_rank) -> int {
+    if (comm_ranks_.empty()) {
+      const auto& topo_comm = rpm().topo().comm();
+      auto global_ranks = std::vector<int>(topo_comm.size());
+      std::iota(global_ranks.begin(), global_ranks.end(), 0);
+      comm_ranks_ = topo_comm.group().translate_ranks(
+          std::span<const int>{global_ranks}, comm_->group());
+    }
+    return comm_ranks_[global_rank];
+  }
+
+  // Write the extents of tree within domain to the file, reading them window
+  // by window into a buffer of whole stripes.
+  auto flush_domain(const extent_tree& tree,
+                    extent domain,
+                    size_t stripe_size) -> void {
+    auto window_size =
+        std::max<size_t>(1, flush_buffer_size / stripe_size) * stripe_size;
+    auto buf = std::vector<std::byte>(
+        std::min<size_t>(window_size, domain.size()));
+    auto runs = std::vector<extent>{};
+
+    for (auto window_begin = domain.begin; window_begin < domain.end;
+         window_begin += window_size) {
+      auto window = extent{window_begin,
+                           std::min(domain.end, window_begin + window_size)};
+
+      // pull the data of the window, coalescing it into contiguous runs
+      runs.clear();
+      for (auto it = tree.find(window);
+           it != tree.end() && it->ex.overlaps(window); ++it) {
+        auto valid_ex = it->ex.get_intersection(window);
+        auto dst = std::span{buf}.subspan(valid_ex.begin - window.begin,
+                                          valid_ex.size());
+        auto lsn = it->ptr + (valid_ex.begin - it->ex.begin);
+        if (it->client_id == global_rank_) {
+          ring().pread(dst, lsn);
+        } else {
+          rring(it->client_id).pread_noflush(dst, lsn);
+        }
+        if (!runs.empty() && runs.back().followed_by(valid_ex)) {
+          runs.back().end = valid_ex.end;
+        } else {
+          runs.push_back(valid_ex);
+        }
+      }
+      rring(0).flush();
+
+      for (const auto& run : runs) {
+        auto src = std::span<const std::byte>{buf}.subspan(
+            run.begin - window.begin, run.size());
+        while (!src.empty()) {
+          auto written = file_.pwrite(src, run.end - src.size());
+          if (written <= 0) {
+            throw std::system_error{errno, std::system_category(),
+                                    "Failed to write file"};
+          }
+          src = src.subspan(written);
+        }
+      }
+    }
+  }
+
+  // parts of ex that neither the local nor the global tree covers
+  auto holes(extent ex, std::pmr::memory_resource* mr) -> extent_list {
+    page_in_global(ex);
+    auto covered = extent_list{mr};
+    for (auto* tree : {&bb_->local_tree, &bb_->global_tree}) {
+      for (auto it = tree->find(ex); it != tree->end() && it->ex.overlaps(ex);
+           ++it) {
+        covered.add(it->ex.get_intersection(ex));
+      }
+    }
+    trim_global();
+    return covered.inverse(ex);
+  }
+
+  template <typename Fn>
+  auto submit(Fn&& fn) -> std::future<std::invoke_result_t<Fn>> {
+    if (progress_ == nullptr) {
+      auto task = std::packaged_task<std::invoke_result_t<Fn>()>{
+          std::forward<Fn>(fn)};
+      auto future = task.get_future();
+      task();
+      return future;
+    }
+    return progress_->submit(std::forward<Fn>(fn));
+  }
+
+  // The ranks of comm_ on this node. Created by the first collective call
+  // that needs it.
+  auto node_comm() -> const mpi::comm& {
+    if (node_comm_.native() == MPI_COMM_NULL) {
+      node_comm_ = mpi::comm{*comm_, mpi::split_type::shared};
+    }
+    return node_comm_;
+  }
+
+  // Call fn on the delta of every open handler of the bb, this one included.
+  template <typename Fn>
+  auto for_each_delta(Fn&& fn) const -> void {
+    std::erase_if(bb_->deltas,
+                  [](const auto& delta) { return delta.expired(); });
+    for (const auto& delta : bb_->deltas) {
+      fn(*delta.lock());
+    }
+  }
+
+  // The extents of this rank in the ranges written since the last sync. The
+  // pointers are looked up in the trees, as bb_store::compact() may have
+  // moved the data since it was written.
+  auto resolve_delta() const -> extent_tree {
+    auto resolved = extent_tree{};
+    for (const auto* tree : {&bb_->global_tree, &bb_->local_tree}) {
+      tree->query_sorted(
+          *delta_, [&](const extent& d, const extent_tree::node& node) {
+            if (node.client_id == global_rank_) {
+              auto ex = node.ex.get_intersection(d);
+              resolved.add(ex.begin, ex.end,
+                           node.ptr + (ex.begin - node.ex.begin),
+                           node.client_id);
+            }
+          });
+    }
+    return resolved;
+  }
+
+  // Page in the spilled global extents that overlap ex, or the nodes of a
+  // tree.
+  auto page_in_global(extent ex) -> void {
+    bb_->global_cold.page_in(bb_->global_tree, ex);
+  }
+  auto page_in_global(const extent_tree& tree) -> void {
+    if (bb_->global_cold.empty()) {
+      return;
+    }
+    for (const auto& node : tree) {
+      page_in_global(node.ex);
+    }
+  }
+  // spill global extents again if there are too many in DRAM
+  auto trim_global() -> void { bb_->global_cold.trim(bb_->global_tree); }
+
+  // refresh the published snapshot, if there is one
+  auto republish() -> void {
+    if (auto current = bb_->published.load()) {
+      detail::publish(*bb_, global_rank_, deferred_file_size_, space_);
+    }
+  }
+
   auto ring() const -> local_ring_buffer& { return local_ring_.get(); }
   auto rring(int rank) const -> const remote_ring_buffer& {
     return remote_rings_.get()[rank];
@@ -322,10 +1290,21 @@ class bb_handler {
   std::reference_wrapper<local_ring_buffer> local_ring_;
   std::reference_wrapper<const std::vector<remote_ring_buffer>> remote_rings_;
   std::shared_ptr<bb> bb_;
-  mpi::comm comm_;
+  std::shared_ptr<const mpi::comm> comm_;  // shared by handlers of open_many
   deferred_file file_;
   int global_rank_;
   size_t deferred_file_size_ = 0;
+  uint64_t log_epoch_ = 0;
+  persistent_extent_index* index_ = nullptr;
+  ring_space* space_ = nullptr;
+  extent_merger* merger_ = nullptr;  // merges synced deltas, if given
+  progress_thread* progress_ = nullptr;  // runs the *_async() calls, if given
+  // ranges written since the last sync_extent(), shared with bb_->deltas
+  std::shared_ptr<extent_tree> delta_{};
+  uint64_t sync_epoch_ = 0;
+  size_t last_delta_size_ = 0;
+  std::vector<int> comm_ranks_{};  // see comm_rank_of()
+  mpi::comm node_comm_{};           // see node_comm()
 };
 
 class bb_store {
@@ -333,6 +1312,17 @@ class bb_store {
     ring_tracker tracker;
     local_ring_buffer::lsn_t snapshot_lsn;
     size_t snapshot_size;
+#ifdef PEANUTS_USE_LOG_RECORDS
+    uint64_t log_epoch = 0;
+    // tail of the ring as of the last reclaim and the epoch of the store
+    // that moved it there
+    uint64_t reclaimed_epoch = 0;
+    local_ring_buffer::lsn_t reclaimed_lsn = 0;
+#endif
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+    uint64_t index_half = 0;
+    uint64_t index_count = 0;
+#endif
   };
   static_assert(std::is_trivially_copyable_v<block_metadata>);
 
@@ -341,45 +1331,118 @@ class bb_store {
     ssize_t size;
   };
 
+  // data of this rank in its local ring
+  struct live_extent {
+    ino_t ino;
+    uint64_t offset;  // in the file
+    local_ring_buffer::lsn_t ptr;
+    size_t size;
+    bool shadowed;  // see detail::split_shadowed()
+  };
+
  public:
+  // compact() considers the prefixes of the ring ending at multiples of
+  // ring_size / compaction_segments from the tail
+  static constexpr size_t compaction_segments = 64;
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+  // 1/index_region_share of each block holds the persistent index, half of it
+  // for each half of the index. With entries of 40 bytes, the default of 16
+  // gives a half one entry per 1280 bytes of ring, so that writes of a few
+  // KiB rarely make it compact or spill, for 6% of the pmem. A store must be
+  // loaded with the share it was saved with.
+  static constexpr size_t index_region_share = PEANUTS_PERSISTENT_INDEX_SHARE;
+#endif
+
   explicit bb_store(rpm& rpm)
       : rpm_ref_(std::ref(rpm)),
         local_block_{rpm_ref_.get(), rpm.topo().intra_rank()},
         local_ring_{create_local_ring()},
         rpm_blocks_{rpm_ref_.get()},
         remote_rings_{create_remote_rings()},
-        ino_and_size_dtype_{create_ino_and_size_dtype()} {}
+        ino_and_size_dtype_{create_ino_and_size_dtype()},
+        log_epoch_{create_log_epoch()} {
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+    index_.set_compactor([this] { return live_index_entries(); });
+#endif
+    space_.set_live_ranges([this](ino_t ino) { return live_ranges(ino); });
+    space_.set_on_pinned(
+        [this](local_ring_buffer::lsn_t tail) { republish_pinned(tail); });
+#ifdef PEANUTS_USE_LOG_RECORDS
+    space_.set_on_reclaim([this](local_ring_buffer::lsn_t tail) {
+      save_reclaimed_lsn_to_local_block(tail);
+    });
+#endif
+  }
 
+  // Space referred to by the saved state is not reclaimed until the next
+  // save().
   auto save() -> void {
+    auto oldest = space_.oldest();
     // save bb indices
     auto snapshot_lsn = local_ring_.head();
-    auto [ser_bb, out] = zpp::bits::data_out();
-    for (const auto& bb_ptr : bb_store_) {
-      ser_bb.resize(sizeof(size_t));
-      out.position() += sizeof(size_t);
-      out(*bb_ptr).or_throw();
-      *reinterpret_cast<size_t*>(ser_bb.data()) =
-          ser_bb.size() - sizeof(size_t);
-      auto lsn = local_ring_.reserve_nb(ser_bb.size());
-      if (!lsn) {
-        throw std::runtime_error("bb_store::save(): local ring is full");
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+    // the extents are already in the index, unless it has spilled
+    if (index_.spilled()) {
+      save_trees();
+      auto saved = std::unordered_set<uint64_t>{};
+      for (const auto& bb_ptr : bb_store_) {
+        saved.insert(bb_ptr->ino);
       }
-      local_ring_.pwrite(ser_bb, *lsn);
-      ser_bb.clear();
-      out.reset();
+      index_.retain_unsaved(
+          [&](uint64_t ino) { return saved.contains(ino); });
     }
-    save_block_metadata_to_local_block(
-        block_metadata{local_ring_.tracker(), snapshot_lsn,
-                       local_ring_.head() - snapshot_lsn});
+#else
+    save_trees();
+#endif
+    auto meta = block_metadata{
+        .tracker = local_ring_.tracker(),
+        .snapshot_lsn = snapshot_lsn,
+        .snapshot_size = local_ring_.head() - snapshot_lsn,
+    };
+#ifdef PEANUTS_USE_LOG_RECORDS
+    meta.log_epoch = log_epoch_;
+    meta.reclaimed_epoch = log_epoch_;
+    meta.reclaimed_lsn = local_ring_.tail();
+#endif
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+    // only remember how far the index goes
+    std::tie(meta.index_half, meta.index_count) = index_.seal();
+#endif
+    save_block_metadata_to_local_block(meta);
+    space_.protect(oldest);
   }
 
   auto load() -> void {
     local_ring_.set_tracker(local_block_metadata().tracker);
     auto snapshot_lsn = local_block_metadata().snapshot_lsn;
+#ifdef PEANUTS_USE_LOG_RECORDS
+    log_epoch_ = local_block_metadata().log_epoch;
+#endif
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+    // local trees are rebuilt from the index when their files are opened
+    index_loaded_ = index_.attach(local_block_metadata().index_half,
+                                  local_block_metadata().index_count,
+                                  local_ring_.head());
+    if (local_block_metadata().snapshot_size != 0) {
+      // saved after the index spilled: the saved trees are not in the index
+      index_.spill();
+    }
+#endif
 
     // load bb indices
     auto cur_lsn = snapshot_lsn;
     while (cur_lsn < local_ring_.head()) {
+#ifdef PEANUTS_USE_LOG_RECORDS
+      auto temp_buffer = std::vector<std::byte>{};
+      auto header = read_log_record(local_ring_, cur_lsn, local_ring_.head(),
+                                    log_epoch_, temp_buffer);
+      if (!header) {
+        throw std::runtime_error("bb_store::load(): corrupted index record");
+      }
+      temp_buffer.resize(header->length);
+      local_ring_.pread(temp_buffer, header->payload_lsn());
+      cur_lsn = header->next_lsn();
+#else
       size_t serialized_size;
       // Read the size
       local_ring_.pread(std::as_writable_bytes(std::span{&serialized_size, 1}),
@@ -389,13 +1452,71 @@ class bb_store {
       auto temp_buffer = std::vector<std::byte>(serialized_size);
       local_ring_.pread(temp_buffer, cur_lsn);
       cur_lsn += serialized_size;
+#endif
 
       auto in = zpp::bits::in{temp_buffer};
       auto bb_ptr = std::make_shared<bb>();
       in(*bb_ptr).or_throw();
       bb_store_.insert(bb_ptr);
     }
+
+    account_loaded_space();
+    space_.protect(space_.oldest());
+  }
+
+#ifdef PEANUTS_USE_LOG_RECORDS
+  // Rebuild the local trees from the log records in the local ring, without
+  // a previous save(). Every rank scans its own ring, from the tail of the
+  // last saved tracker, where the tail was moved to since, or the start of
+  // the ring if a new store has been writing since, up to the first missing,
+  // stale or corrupted record. Of these, the record of the newest store wins.
+  // Files must be opened again afterwards to rebuild the global trees.
+  auto recover() -> void {
+    const auto& meta = local_block_metadata();
+    auto tail = local_ring_buffer::lsn_t{0};
+    if (meta.tracker.ring_size() == ring_size()) {
+      tail = meta.tracker.tail();
+    }
+
+    auto epoch = std::optional<uint64_t>{};
+    auto temp_buffer = std::vector<std::byte>{};
+    using lsn_t = local_ring_buffer::lsn_t;
+    auto newest = std::optional<std::pair<uint64_t, lsn_t>>{};
+    auto try_start = [&](lsn_t lsn, std::optional<uint64_t> start_epoch) {
+      auto header = read_log_record(local_ring_, lsn, lsn + ring_size(),
+                                    start_epoch, temp_buffer);
+      if (header && (!newest || std::pair{header->epoch, lsn} > *newest)) {
+        newest = std::pair{header->epoch, lsn};
+      }
+    };
+    try_start(0, std::nullopt);
+    try_start(tail, std::nullopt);
+    try_start(meta.reclaimed_lsn, meta.reclaimed_epoch);
+    if (newest) {
+      tail = newest->second;
+    }
+    auto cur_lsn = tail;
+    while (auto header = read_log_record(local_ring_, cur_lsn,
+                                         tail + ring_size(), epoch,
+                                         temp_buffer)) {
+      epoch = header->epoch;
+      if (header->type == log_record_header::record_type::data) {
+        auto [it, inserted] =
+            bb_store_.insert(std::make_shared<bb>(header->ino));
+        (*it)->local_tree.add(header->offset, header->offset + header->length,
+                              header->payload_lsn(),
+                              rpm_ref_.get().topo().rank());
+        space_.add(header->ino, header->lsn, header->next_lsn() - header->lsn);
+      }
+      cur_lsn = header->next_lsn();
+    }
+
+    local_ring_.set_tracker(ring_tracker{ring_size(), cur_lsn, tail});
+    if (epoch) {
+      log_epoch_ = *epoch;
+    }
   }
+#endif
 
   auto open(mpi::comm comm,
             const std::string& pathname,
@@ -456,15 +1577,18 @@ class bb_store {
 #ifdef PEANUTS_ENABLE_PROFILER
 #endif
 
-    auto bb_obj = std::make_shared<bb>(bb{meta.ino});
-    auto [it, inserted] = bb_store_.insert(bb_obj);
-    auto handler = std::make_unique<bb_handler>(
-        rpm_ref_.get(), local_ring_, remote_rings_, *it, std::move(comm),
-        std::move(file), meta.size);
+    auto restored = std::vector<persistent_extent_index::restored_node>{};
+    auto handler =
+        create_handler(std::make_shared<const mpi::comm>(std::move(comm)),
+                       std::move(file), meta, restored);
 #ifdef PEANUTS_ENABLE_PROFILER
     auto elapsed_open = sw.get_and_reset();
 #endif
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+    handler->restore_extent(std::move(restored));
+#else
     handler->sync_extent();
+#endif
 #ifdef PEANUTS_ENABLE_PROFILER
     auto elapsed_sync = sw.get_and_reset();
     if (myrank == 0) {
@@ -475,11 +1599,269 @@ class bb_store {
     return handler;
   }
 
+  // collective
+  // Open many files over the same communicator in one round: the opens are
+  // spread over the ranks, their metadata is exchanged in one message and
+  // the extents of all files are synced in one exchange. The handlers share
+  // the ownership of comm.
+  auto open_many(mpi::comm comm,
+                 std::span<const std::string> pathnames,
+                 int flags,
+                 mode_t mode) -> std::vector<std::unique_ptr<bb_handler>> {
+    auto shared_comm = std::make_shared<const mpi::comm>(std::move(comm));
+    auto nfiles = pathnames.size();
+    auto nranks = shared_comm->size();
+    auto myrank = shared_comm->rank();
+
+    // rank r opens files [first_file(r), first_file(r + 1))
+    auto first_file = [&](int rank) {
+      return static_cast<int>(nfiles * rank / nranks);
+    };
+
+    auto files = std::vector<peanuts::deferred_file>{};
+    files.reserve(nfiles);
+    auto my_metas = std::vector<ino_and_size>{};
+    for (size_t i = 0; i < nfiles; ++i) {
+      auto owner = first_file(myrank) <= static_cast<int>(i) &&
+                   static_cast<int>(i) < first_file(myrank + 1);
+#ifdef PEANUTS_USE_DEFERRED_OPEN
+      auto file_flags = owner ? flags : flags & ~(O_CREAT | O_EXCL | O_TRUNC);
+      files.emplace_back(pathnames[i], file_flags, mode);
+#else
+      files.emplace_back(pathnames[i], flags, mode);
+      try {
+        files.back().open();
+      } catch (...) {
+      }
+#endif
+      if (owner) {
+        my_metas.push_back(open_and_stat(files.back()));
+      }
+    }
+
+    auto counts = std::vector<int>(nranks);
+    auto displs = std::vector<int>(nranks);
+    for (int rank = 0; rank < nranks; ++rank) {
+      displs[rank] = first_file(rank);
+      counts[rank] = first_file(rank + 1) - first_file(rank);
+    }
+    auto metas = std::vector<ino_and_size>(nfiles);
+    shared_comm->all_gather_v(std::span<const ino_and_size>{my_metas},
+                              ino_and_size_dtype_, std::span{metas},
+                              ino_and_size_dtype_, counts, displs);
+    for (size_t i = 0; i < nfiles; ++i) {
+      if (metas[i].size < 0) {
+        throw std::system_error{
+            errno, std::system_category(),
+            "bb_store::open_many(): Failed to open " + pathnames[i]};
+      }
+    }
+
+    auto handlers = std::vector<std::unique_ptr<bb_handler>>{};
+    handlers.reserve(nfiles);
+    auto restored =
+        std::vector<std::vector<persistent_extent_index::restored_node>>(
+            nfiles);
+    for (size_t i = 0; i < nfiles; ++i) {
+      handlers.push_back(create_handler(shared_comm, std::move(files[i]),
+                                        metas[i], restored[i]));
+    }
+
+    if (nranks == 1) {
+      for (size_t i = 0; i < nfiles; ++i) {
+        handlers[i]->merge_restored(std::move(restored[i]));
+        handlers[i]->sync_extent();
+      }
+      return handlers;
+    }
+
+    // one exchange for the extents of all files
+    auto [ser_extents, out] = zpp::bits::data_out();
+    for (size_t i = 0; i < nfiles; ++i) {
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+      out(restored[i]).or_throw();
+#endif
+      handlers[i]->serialize_delta(out);
+    }
+    auto ser_all_extents =
+        detail::all_gather_serialized(*shared_comm, ser_extents);
+
+    auto in = zpp::bits::in{ser_all_extents};
+    auto deltas = std::vector<std::vector<bb_handler::sync_delta>>(
+        nfiles, std::vector<bb_handler::sync_delta>(nranks));
+    auto all_restored =
+        std::vector<std::vector<persistent_extent_index::restored_node>>(
+            nfiles);
+    for (int rank = 0; rank < nranks; ++rank) {
+      for (size_t i = 0; i < nfiles; ++i) {
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+        in(restored[i]).or_throw();
+        all_restored[i].insert(all_restored[i].end(), restored[i].begin(),
+                               restored[i].end());
+#endif
+        in(deltas[i][rank]).or_throw();
+      }
+    }
+    for (size_t i = 0; i < nfiles; ++i) {
+      handlers[i]->merge_restored(std::move(all_restored[i]));
+      handlers[i]->merge_deltas(deltas[i]);
+    }
+    return handlers;
+  }
+
+  // The space of the file in the local ring is released right away, so its
+  // handlers must not be used any more. Other ranks may still read it until
+  // they unlink the file as well; the tail moves past it in reclaim().
   void unlink(const std::string& pathname) { unlink(utils::get_ino(pathname)); }
-  void unlink(ino_t ino) { bb_store_.erase(std::make_shared<bb>(bb{ino})); }
+  void unlink(ino_t ino) {
+    if (auto it = bb_store_.find(std::make_shared<bb>(ino));
+        it != bb_store_.end()) {
+      (*it)->published.reset();
+      (*it)->global_cold.clear();
+      bb_store_.erase(it);
+    }
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+    index_.append_unlink(ino);
+#endif
+    space_.release(ino);
+  }
   void unlink(int fd) { unlink(utils::get_ino(fd)); }
 
+  // Cap the bytes a file may hold in the local ring of this rank; writes
+  // beyond fail with EDQUOT. A quota of 0 means no limit.
+  void set_quota(const std::string& pathname, size_t bytes) {
+    set_quota(utils::get_ino(pathname), bytes);
+  }
+  void set_quota(ino_t ino, size_t bytes) { space_.set_quota(ino, bytes); }
+  // quota of the files without one of their own
+  void set_default_quota(size_t bytes) { space_.set_default_quota(bytes); }
+
+  // Keep at most max_nodes nodes of the global tree of each file in DRAM.
+  // The rest is spilled in compactly encoded runs to a scratch file in dir,
+  // best on a DAX file system, and paged back in by the operations that need
+  // it. Files with tens of millions of extents then fit in a fixed amount of
+  // memory per rank between operations, apart from published snapshots,
+  // which hold all of theirs. A limit of 0 means no limit.
+  void set_global_tree_limit(size_t max_nodes, const std::string& dir) {
+    spill_file_ =
+        max_nodes != 0 ? std::make_shared<spill_file>(dir) : nullptr;
+    max_global_nodes_ = max_nodes;
+    for (const auto& bb_ptr : bb_store_) {
+      bb_ptr->global_cold.set_limit(bb_ptr->global_tree, max_nodes,
+                                    spill_file_);
+    }
+  }
+  // bytes of the spilled global trees
+  auto spilled_bytes() const -> size_t {
+    return spill_file_ ? spill_file_->used() : 0;
+  }
+
+  // Merge the extents gathered by large syncs on nthreads threads, the
+  // calling one included, pinned to cpus in turn if any are given. Worth it
+  // with few ranks per node, where the cores would otherwise idle in the
+  // collective. 1 merges on the calling thread only.
+  void set_merge_threads(size_t nthreads, std::vector<int> cpus = {}) {
+    merger_.set_threads(nthreads, std::move(cpus));
+  }
+
+  // Run a progress thread pinned to cpu, see progress_thread, which carries
+  // the *_async() calls of the handlers and keeps the gets of
+  // pread_noflush() moving. Needs MPI_THREAD_MULTIPLE.
+  void start_progress_thread(int cpu = -1,
+                             std::chrono::microseconds poll_interval = {}) {
+    progress_.start(cpu, poll_interval);
+  }
+  // runs the calls submitted so far first
+  void stop_progress_thread() { progress_.stop(); }
+
+  // collective over all ranks
+  // Move the tail of the local ring of every rank past the data that no rank
+  // refers to any more: unlinked, overwritten or truncated away. This is the
+  // only place besides compact() where the ranks agree on how far each tail
+  // may move; with quotas set, writes that find the ring full reclaim up to
+  // there on their own. Data referred to by the last save() is kept until
+  // the next one. Returns the bytes reclaimed on this rank.
+  auto reclaim() -> size_t {
+    auto tail = local_ring_.tail();
+    agree_on_reclaim();
+    space_.collect();
+    return local_ring_.tail() - tail;
+  }
+
+  // collective over all ranks
+  // Move the live data near the tail of the local ring to its head, so that
+  // the overwritten data in between can be reclaimed even though the ring is
+  // freed in order. The prefix that frees the most space while at most
+  // max_live_ratio of it is live is evacuated, and every rank points its
+  // trees at the new locations. Data referred to by the last save() is kept
+  // until the next one. Returns the bytes reclaimed on this rank.
+  auto compact(double max_live_ratio = 0.5) -> size_t {
+    const auto& comm = rpm_ref_.get().topo().comm();
+    auto tail = local_ring_.tail();
+    space_.collect();
+
+    auto relocations = std::vector<detail::relocation>{};
+    // nothing to gain without dead data
+    if (space_.dead_bytes() != 0) {
+      auto limit = movable_limit();
+      auto extents = live_extents(limit);
+      auto end = evacuation_end(extents, limit, max_live_ratio);
+      std::erase_if(extents, [&](const auto& e) { return e.ptr >= end; });
+      relocations = evacuate(extents);
+    }
+
+    auto [ser_relocations, out] = zpp::bits::data_out();
+    out(relocations).or_throw();
+    auto ser_all_relocations =
+        detail::all_gather_serialized(comm, ser_relocations);
+    auto in = zpp::bits::in{ser_all_relocations};
+    for (int rank = 0; rank < comm.size(); ++rank) {
+      in(relocations).or_throw();
+      for (const auto& bb_ptr : bb_store_) {
+        // the local tree goes first, so that shadowed pieces of the global
+        // one are told apart by their new locations
+        auto relocate = [&](extent_tree& tree, bool global) {
+          auto moved = detail::relocate(tree, rank, relocations);
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+          if (rank != comm.rank()) {
+            return;
+          }
+          // a shadowed piece restored as unsynced would override the local
+          // write; left out, the old entry is synced and then overwritten
+          auto append = [&](const extent_tree::node& node, bool shadowed) {
+            if (!shadowed) {
+              index_.append_extent(bb_ptr->ino, node.ex.begin, node.ex.end,
+                                   node.ptr);
+            }
+          };
+          for (const auto& node : moved) {
+            if (global) {
+              detail::split_shadowed(*bb_ptr, node, append);
+            } else {
+              append(node, false);
+            }
+          }
+#else
+          (void)moved;
+          (void)global;
+#endif
+        };
+        relocate(bb_ptr->local_tree, false);
+        relocate(bb_ptr->global_tree, true);
+        bb_ptr->global_cold.transform(
+            [&](extent_tree& tree) { relocate(tree, true); });
+      }
+    }
+
+    agree_on_reclaim();
+    space_.collect();
+    return local_ring_.tail() - tail;
+  }
+
   auto local_ring() -> local_ring_buffer& { return local_ring_; }
+  auto space() -> ring_space& { return space_; }
+  // usage of the local ring of this rank
+  auto stats() const -> ring_space::stats { return space_.get_stats(); }
 
   std::ostream& inspect(std::ostream& os) const {
     os << "rpm_blocks: " << utils::make_inspector(rpm_blocks_) << "\n";
@@ -487,15 +1869,79 @@ class bb_store {
   }
 
  private:
+  // Append the serialized bbs to the local ring for load().
+  auto save_trees() -> void {
+    auto [ser_bb, out] = zpp::bits::data_out();
+    for (const auto& bb_ptr : bb_store_) {
+      // the saved global tree is whole; it is spilled again below
+      bb_ptr->global_cold.page_in_all(bb_ptr->global_tree);
+#ifdef PEANUTS_USE_LOG_RECORDS
+      out(*bb_ptr).or_throw();
+      space_.make_room(sizeof(log_record_header) + ser_bb.size());
+      if (!append_log_record(local_ring_, log_record_header::record_type::index,
+                             log_epoch_, bb_ptr->ino, 0, ser_bb)) {
+        throw std::runtime_error("bb_store::save(): local ring is full");
+      }
+#else
+      ser_bb.resize(sizeof(size_t));
+      out.position() += sizeof(size_t);
+      out(*bb_ptr).or_throw();
+      *reinterpret_cast<size_t*>(ser_bb.data()) =
+          ser_bb.size() - sizeof(size_t);
+      space_.make_room(ser_bb.size());
+      auto lsn = local_ring_.reserve_nb(ser_bb.size());
+      if (!lsn) {
+        throw std::runtime_error("bb_store::save(): local ring is full");
+      }
+      local_ring_.pwrite(ser_bb, *lsn);
+#endif
+      ser_bb.clear();
+      out.reset();
+      bb_ptr->global_cold.trim(bb_ptr->global_tree);
+    }
+  }
+
+  // size of the region at the end of each block that is not part of the ring:
+  // the persistent index, if any, followed by the block metadata
+  auto reserved_size() const -> size_t {
+#ifdef PEANUTS_USE_MIRRORED_RING
+    // the mirrored ring must end on a boundary the pmem can be mapped at
+    auto alignment =
+        std::max(rpm_ref_.get().alignment(), utils::get_page_size());
+    return utils::round_up_pow2(index_region_size() + sizeof(block_metadata),
+                                alignment);
+#else
+    return index_region_size() + sizeof(block_metadata);
+#endif
+  }
+
+  auto index_region_size() const -> size_t {
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+    return std::max(utils::round_down_pow2(
+                        rpm_ref_.get().block_size() / index_region_share,
+                        size_t{64}),
+                    persistent_extent_index::min_size());
+#else
+    return 0;
+#endif
+  }
+
+  auto metadata_offset() const -> off_t {
+    return static_cast<off_t>(ring_size() + index_region_size());
+  }
+
   auto ring_size() const -> size_t {
-    return rpm_ref_.get().block_size() - sizeof(block_metadata);
+    return rpm_ref_.get().block_size() - reserved_size();
   }
 
   auto create_local_ring() -> local_ring_buffer {
     auto& rpm = rpm_ref_.get();
-    if (rpm.block_size() < sizeof(block_metadata)) {
+    if (rpm.block_size() <= reserved_size()) {
       throw std::runtime_error("pmem size is too small");
     }
+#ifdef PEANUTS_USE_MIRRORED_RING
+    local_block_.enable_mirror(ring_size());
+#endif
     return local_ring_buffer{local_block_, ring_size()};
   }
 
@@ -511,6 +1957,53 @@ class bb_store {
     return remote_rings;
   }
 
+  // returns a size of -1 on failure
+  static auto open_and_stat(peanuts::deferred_file& file) -> ino_and_size {
+    auto meta = ino_and_size{0, -1};
+    try {
+      if (!file.is_open()) {
+        file.open();
+      }
+      struct stat stat_buf;
+      if (fstat(file.fd(), &stat_buf) == 0) {
+        meta.ino = stat_buf.st_ino;
+        meta.size = static_cast<ssize_t>(stat_buf.st_size);
+      }
+    } catch (...) {
+    }
+    return meta;
+  }
+
+  // Create a handler for the bb of meta.ino. When the bb is opened for the
+  // first time since load(), its local tree is rebuilt from the persistent
+  // index and the extents that had already been synced go to restored.
+  auto create_handler(
+      std::shared_ptr<const mpi::comm> comm,
+      peanuts::deferred_file&& file,
+      const ino_and_size& meta,
+      std::vector<persistent_extent_index::restored_node>& restored)
+      -> std::unique_ptr<bb_handler> {
+    auto [it, inserted] = bb_store_.insert(std::make_shared<bb>(meta.ino));
+    (*it)->global_cold.set_limit((*it)->global_tree, max_global_nodes_,
+                                 spill_file_);
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+    if (inserted && index_loaded_) {
+      index_.restore(meta.ino, rpm_ref_.get().topo().rank(), (*it)->local_tree,
+                     restored);
+    }
+    return std::make_unique<bb_handler>(
+        rpm_ref_.get(), local_ring_, remote_rings_, *it, std::move(comm),
+        std::move(file), meta.size, log_epoch_, &index_, &space_,
+        &merger_, &progress_);
+#else
+    (void)restored;
+    return std::make_unique<bb_handler>(
+        rpm_ref_.get(), local_ring_, remote_rings_, *it, std::move(comm),
+        std::move(file), meta.size, log_epoch_, nullptr, &space_,
+        &merger_, &progress_);
+#endif
+  }
+
   auto create_ino_and_size_dtype() -> mpi::dtype {
     auto dtypes = std::vector<MPI_Datatype>{mpi::to_dtype<ino_t>().native(),
                                             mpi::to_dtype<ssize_t>().native()};
@@ -522,16 +2015,335 @@ class bb_store {
     return dtype;
   }
 
+  // a new store starts a new epoch, so that log records left in the ring by
+  // an earlier store are not mistaken for its own
+  auto create_log_epoch() const -> uint64_t {
+    return static_cast<uint64_t>(
+        std::chrono::system_clock::now().time_since_epoch().count());
+  }
+
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+  // Entries describing what this rank still holds: its extents that survive
+  // in the global trees, as of the last sync, followed by its local trees.
+  // Files that have not been opened since load() keep their entries as is.
+  auto live_index_entries() -> std::vector<persistent_extent_index::entry> {
+    using entry = persistent_extent_index::entry;
+    auto rank = rpm_ref_.get().topo().rank();
+    auto live = std::vector<entry>{};
+
+    if (index_loaded_) {
+      auto opened = std::unordered_set<uint64_t>{};
+      for (const auto& bb_ptr : bb_store_) {
+        opened.insert(bb_ptr->ino);
+      }
+      for (const auto& e : index_.entries()) {
+        if (!opened.contains(e.ino)) {
+          live.push_back(e);
+        }
+      }
+    }
+
+    for (const auto& bb_ptr : bb_store_) {
+      auto ino = static_cast<uint64_t>(bb_ptr->ino);
+      if (auto syncs = index_.sync_count(bb_ptr->ino); syncs != 0) {
+        auto add_synced = [&](const extent_tree::node& node) {
+          if (node.client_id == rank) {
+            live.push_back({entry::entry_kind::extent, ino, node.ex.begin,
+                            node.ex.end, node.ptr});
+          }
+        };
+        std::for_each(bb_ptr->global_tree.begin(), bb_ptr->global_tree.end(),
+                      add_synced);
+        bb_ptr->global_cold.for_each(add_synced);
+        live.push_back({entry::entry_kind::sync, ino, syncs - 1, 0, 0});
+      }
+      for (const auto& node : bb_ptr->local_tree) {
+        live.push_back({entry::entry_kind::extent, ino, node.ex.begin,
+                        node.ex.end, node.ptr});
+      }
+    }
+    return live;
+  }
+#endif
+
+  // lsn ranges of the local ring that the data of ino still occupies: its
+  // extents in the trees of this rank or, for files that have not been opened
+  // since load(), in the persistent index
+  auto live_ranges(ino_t ino) -> std::vector<extent> {
+    auto rank = rpm_ref_.get().topo().rank();
+    auto ranges = std::vector<extent>{};
+    auto it = bb_store_.find(std::make_shared<bb>(ino));
+    if (it != bb_store_.end()) {
+      detail::for_each_node(**it, [&](const auto& node) {
+        if (node.client_id == rank) {
+          ranges.emplace_back(node.ptr, node.ptr + node.ex.size());
+        }
+      });
+    }
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+    else if (index_loaded_) {
+      using entry = persistent_extent_index::entry;
+      index_.for_each_entry(ino, [&](const entry& e) {
+        if (e.kind == entry::entry_kind::extent) {
+          ranges.emplace_back(e.ptr, e.ptr + (e.end - e.begin));
+        } else if (e.kind == entry::entry_kind::unlink) {
+          ranges.clear();
+        }
+      });
+    }
+#endif
+    std::sort(ranges.begin(), ranges.end());
+    return ranges;
+  }
+
+  // collective over all ranks
+  // Let the tail of the local ring move up to the oldest data of this rank
+  // that any rank still refers to in its trees or current snapshots, or up
+  // to the head if none does. Data before that cannot be referred to again,
+  // so the limit holds until the next agreement.
+  auto agree_on_reclaim() -> void {
+    const auto& comm = rpm_ref_.get().topo().comm();
+    auto oldest = std::vector<local_ring_buffer::lsn_t>(
+        comm.size(), std::numeric_limits<local_ring_buffer::lsn_t>::max());
+    oldest[comm.rank()] = local_ring_.head();
+    auto add = [&](const extent_tree::node& node) {
+      auto& lsn = oldest[node.client_id];
+      lsn = std::min(lsn, node.ptr);
+    };
+    for (const auto& bb_ptr : bb_store_) {
+      detail::for_each_node(*bb_ptr, add);
+      if (auto snapshot = bb_ptr->published.load()) {
+        std::for_each(snapshot->global_tree.begin(),
+                      snapshot->global_tree.end(), add);
+        std::for_each(snapshot->local_tree.begin(),
+                      snapshot->local_tree.end(), add);
+      }
+    }
+    comm.all_reduce(std::span{oldest}, MPI_MIN);
+    space_.agree(oldest[comm.rank()]);
+  }
+
+  // Data of files that have not been opened since load() is not in the trees
+  // and cannot be moved, so compact() stops there.
+  auto movable_limit() -> local_ring_buffer::lsn_t {
+    auto limit = local_ring_.head();
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+    if (index_loaded_) {
+      auto unopened = std::unordered_set<ino_t>{};
+      for (const auto& e : index_.entries()) {
+        unopened.insert(static_cast<ino_t>(e.ino));
+      }
+      for (const auto& bb_ptr : bb_store_) {
+        unopened.erase(bb_ptr->ino);
+      }
+      for (auto ino : unopened) {
+        for (const auto& range : live_ranges(ino)) {
+          if (range.begin >= local_ring_.tail()) {
+            limit = std::min(limit, range.begin);
+            break;
+          }
+        }
+      }
+    }
+#endif
+    return limit;
+  }
+
+  // The data of this rank in the trees before limit, sorted by ptr, with
+  // overlapping extents merged.
+  auto live_extents(local_ring_buffer::lsn_t limit)
+      -> std::vector<live_extent> {
+    auto rank = rpm_ref_.get().topo().rank();
+    auto extents = std::vector<live_extent>{};
+    for (const auto& bb_ptr : bb_store_) {
+      auto add = [&](const extent_tree::node& node, bool shadowed) {
+        if (node.client_id == rank && node.ptr >= local_ring_.tail() &&
+            node.ptr < limit) {
+          extents.push_back({bb_ptr->ino, node.ex.begin, node.ptr,
+                             node.ex.size(), shadowed});
+        }
+      };
+      auto add_global = [&](const extent_tree::node& node) {
+        if (node.client_id == rank) {
+          detail::split_shadowed(*bb_ptr, node, add);
+        }
+      };
+      for (const auto& node : bb_ptr->local_tree) {
+        add(node, false);
+      }
+      for (const auto& node : bb_ptr->global_tree) {
+        add_global(node);
+      }
+      bb_ptr->global_cold.for_each(add_global);
+    }
+    std::sort(extents.begin(), extents.end(),
+              [](const auto& lhs, const auto& rhs) {
+                return lhs.ptr < rhs.ptr;
+              });
+
+    // the same data may be in both trees of a file, split differently.
+    // Whether data is shadowed depends only on where it is, so overlapping
+    // extents agree on it.
+    auto merged = std::vector<live_extent>{};
+    for (const auto& e : extents) {
+      if (!merged.empty() && e.ptr < merged.back().ptr + merged.back().size) {
+        auto& last = merged.back();
+        last.size = std::max(last.size, e.ptr + e.size - last.ptr);
+      } else {
+        merged.push_back(e);
+      }
+    }
+    return merged;
+  }
+
+  // End of the prefix of the ring that compact() evacuates, or the tail.
+  // Extents are moved as a whole, so they count towards the prefix they
+  // start in.
+  auto evacuation_end(std::span<const live_extent> extents,
+                      local_ring_buffer::lsn_t limit,
+                      double max_live_ratio) const
+      -> local_ring_buffer::lsn_t {
+#ifdef PEANUTS_USE_LOG_RECORDS
+    const auto overhead = sizeof(log_record_header);
+#else
+    const auto overhead = size_t{0};
+#endif
+    auto tail = local_ring_.tail();
+    auto segment = std::max<size_t>(ring_size() / compaction_segments, 1);
+
+    auto best = tail;
+    auto best_gain = size_t{0};
+    auto live = size_t{0};
+    auto it = extents.begin();
+    for (auto end = tail; end < limit;) {
+      end = std::min(end + segment, limit);
+      for (; it != extents.end() && it->ptr < end; ++it) {
+        live += it->size + overhead;
+      }
+      if (live > local_ring_.free_capacity()) {
+        break;
+      }
+      auto prefix = end - tail;
+      if (live <= max_live_ratio * prefix && prefix - live > best_gain) {
+        best = end;
+        best_gain = prefix - live;
+      }
+    }
+    return best;
+  }
+
+  // Copy extents to the head of the local ring.
+  auto evacuate(std::span<const live_extent> extents)
+      -> std::vector<detail::relocation> {
+    auto relocations = std::vector<detail::relocation>{};
+    auto buf = std::vector<std::byte>{};
+    for (const auto& e : extents) {
+      buf.resize(e.size);
+      local_ring_.pread(buf, e.ptr);
+#ifdef PEANUTS_USE_LOG_RECORDS
+      // replaying shadowed data on recovery would undo the newer write
+      auto type = e.shadowed ? log_record_header::record_type::shadowed
+                             : log_record_header::record_type::data;
+      auto lsn = append_log_record(local_ring_, type, log_epoch_, e.ino,
+                                   e.offset, buf);
+      auto reserved = sizeof(log_record_header) + e.size;
+#else
+      auto lsn = local_ring_.reserve_nb(e.size);
+      if (lsn) {
+        local_ring_.pwrite(buf, *lsn);
+      }
+      auto reserved = e.size;
+#endif
+      if (!lsn) {
+        // evacuation_end() leaves enough room
+        throw std::runtime_error("bb_store::compact(): local ring is full");
+      }
+      space_.add(e.ino, *lsn + e.size - reserved, reserved);
+      space_.add_compacted(reserved);
+      relocations.push_back({e.ptr, e.ptr + e.size, *lsn});
+    }
+    return relocations;
+  }
+
+  // Account the data left in the local ring by an earlier store to the files
+  // it belongs to.
+  auto account_loaded_space() -> void {
+#ifdef PEANUTS_USE_LOG_RECORDS
+    // one range per record, so that the tail stays at the start of a record
+    auto header = log_record_header{};
+    for (auto lsn = local_ring_.tail(); lsn < local_ring_.head();
+         lsn = header.next_lsn()) {
+      local_ring_.pread(std::as_writable_bytes(std::span{&header, 1}), lsn);
+      if (header.magic != log_record_header::magic_value ||
+          header.lsn != lsn) {
+        break;
+      }
+      if (header.type == log_record_header::record_type::data ||
+          header.type == log_record_header::record_type::shadowed) {
+        space_.add(header.ino, lsn, header.next_lsn() - lsn);
+      }
+    }
+#else
+    auto inos = std::unordered_set<ino_t>{};
+    for (const auto& bb_ptr : bb_store_) {
+      inos.insert(bb_ptr->ino);
+    }
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+    if (index_loaded_) {
+      for (const auto& e : index_.entries()) {
+        inos.insert(static_cast<ino_t>(e.ino));
+      }
+    }
+#endif
+    for (auto ino : inos) {
+      auto end = local_ring_buffer::lsn_t{0};
+      for (const auto& range : live_ranges(ino)) {
+        // ranges of split extents may overlap
+        if (range.end > end) {
+          auto begin = std::max(range.begin, end);
+          space_.add(ino, begin, range.end - begin);
+          end = range.end;
+        }
+      }
+    }
+#endif
+  }
+
+  // Replace the published snapshots that pin data below tail by snapshots of
+  // the current trees, which may refer to newer data only. The old ones are
+  // released once no reader holds them any more.
+  auto republish_pinned(local_ring_buffer::lsn_t tail) -> void {
+    for (const auto& bb_ptr : bb_store_) {
+      auto current = bb_ptr->published.load();
+      if (current && current->pinned && *current->pinned < tail) {
+        detail::publish(*bb_ptr, rpm_ref_.get().topo().rank(),
+                        current->file_size, &space_);
+      }
+    }
+  }
+
   auto save_block_metadata_to_local_block(const block_metadata& meta) -> void {
     local_block_.pwrite_nt(
         std::span<const std::byte>{reinterpret_cast<const std::byte*>(&meta),
                                    sizeof(block_metadata)},
-        static_cast<off_t>(ring_size()));
+        metadata_offset());
   }
 
+#ifdef PEANUTS_USE_LOG_RECORDS
+  auto save_reclaimed_lsn_to_local_block(local_ring_buffer::lsn_t lsn)
+      -> void {
+    static_assert(offsetof(block_metadata, reclaimed_lsn) ==
+                  offsetof(block_metadata, reclaimed_epoch) + sizeof(uint64_t));
+    auto fields = std::array<uint64_t, 2>{log_epoch_, lsn};
+    local_block_.pwrite_nt(std::as_bytes(std::span{fields}),
+                           metadata_offset() +
+                               offsetof(block_metadata, reclaimed_epoch));
+  }
+#endif
+
   auto local_block_metadata() const -> const block_metadata& {
     return *reinterpret_cast<const block_metadata*>(
-        static_cast<std::byte*>(local_block_.data()) + ring_size());
+        static_cast<std::byte*>(local_block_.data()) + metadata_offset());
   }
 
   std::unordered_set<std::shared_ptr<bb>, detail::bb_hash, detail::bb_equal>
@@ -542,6 +2354,21 @@ class bb_store {
   rpm_blocks rpm_blocks_;
   std::vector<remote_ring_buffer> remote_rings_;
   mpi::dtype ino_and_size_dtype_;
+  uint64_t log_epoch_;
+  ring_space space_{local_ring_};
+  // see set_global_tree_limit()
+  size_t max_global_nodes_ = 0;
+  std::shared_ptr<spill_file> spill_file_{};
+  // see set_merge_threads()
+  extent_merger merger_{};
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+  persistent_extent_index index_{local_block_,
+                                 static_cast<off_t>(ring_size()),
+                                 index_region_size()};
+  bool index_loaded_ = false;
+#endif
+  // last, so that the calls still queued run before the rest goes away
+  progress_thread progress_{};
 };
 
 }  // namespace peanuts
@@ -1,17 +1,39 @@
 #pragma once
 
+#include <cstddef>
 #include <forward_list>
 #include <initializer_list>
+#include <memory_resource>
 
 #include "peanuts/extent_tree.hpp"
 
 namespace peanuts {
 
+// Lists built while serving a single request can take their nodes from an
+// arena on the stack, see extent_list::arena. Lists derived from one, by
+// inverse() and intersection(), use the same memory resource.
 class extent_list {
  public:
-  using list_t = std::forward_list<extent>;
+  using list_t = std::pmr::forward_list<extent>;
+
+  // A buffer on the stack to allocate the lists of one request from, falling
+  // back to the heap once it is used up. Everything is freed at once when
+  // the arena goes out of scope, so it must outlive the lists.
+  class arena {
+   public:
+    arena() = default;
+    arena(const arena&) = delete;
+    auto operator=(const arena&) -> arena& = delete;
+
+    auto resource() -> std::pmr::memory_resource* { return &mr_; }
+
+   private:
+    alignas(std::max_align_t) std::byte buf_[1024];
+    std::pmr::monotonic_buffer_resource mr_{buf_, sizeof(buf_)};
+  };
 
   extent_list() = default;
+  explicit extent_list(std::pmr::memory_resource* mr) : list_{mr} {}
   extent_list(std::initializer_list<extent> extents) : list_{extents} {}
 
   auto begin() { return list_.begin(); }
@@ -45,7 +67,7 @@ class extent_list {
   }
 
   auto inverse(extent ex) -> extent_list {
-    extent_list result;
+    extent_list result{resource()};
     auto& result_list = result.list_;
 
     auto it = result_list.before_begin();
@@ -82,6 +104,10 @@ class extent_list {
   }
 
  private:
+  auto resource() const -> std::pmr::memory_resource* {
+    return list_.get_allocator().resource();
+  }
+
   uint64_t max() const {
     if (list_.empty()) {
       return 0;
@@ -103,7 +129,7 @@ class extent_list {
 
 inline auto intersection(const extent_list& lhs, const extent_list& rhs)
     -> extent_list {
-  extent_list result;
+  extent_list result{lhs.resource()};
   auto& result_list = result.list_;
 
   auto res_it = result_list.before_begin();
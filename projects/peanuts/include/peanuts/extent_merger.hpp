@@ -0,0 +1,113 @@
+#pragma once
+
+#include "peanuts/extent_tree.hpp"
+#include "peanuts/utils/thread_pool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace peanuts {
+
+// Merges the trees gathered by a sync into a global tree on a few threads.
+// The offset range the trees cover is cut into a part per thread, at
+// quantiles of the begins of their nodes, the parts are merged concurrently
+// with extent_tree::merged_range() and put back in order. Merging does not
+// depend on the order of the trees (see extent_tree::newer()), so the result
+// is the one of merging them one by one. Small merges stay on the calling
+// thread, as putting the parts back costs a pass over the global nodes in
+// the range.
+class extent_merger {
+ public:
+  // parts smaller than this are not worth a thread
+  static constexpr size_t min_part_nodes = 1024;
+
+  // merges on the calling thread only
+  extent_merger() = default;
+  explicit extent_merger(size_t nthreads, std::vector<int> cpus = {}) {
+    set_threads(nthreads, std::move(cpus));
+  }
+
+  // Merge on nthreads threads, the calling one included. The others are
+  // workers of a thread_pool, pinned to the cpus in turn if any are given.
+  auto set_threads(size_t nthreads, std::vector<int> cpus = {}) -> void {
+    pool_.reset();
+    if (nthreads > 1) {
+      pool_ = std::make_unique<utils::thread_pool>(nthreads - 1,
+                                                   std::move(cpus));
+    }
+  }
+  auto threads() const -> size_t { return pool_ ? pool_->size() + 1 : 1; }
+
+  auto merge(extent_tree& tree, std::span<const extent_tree* const> others)
+      -> void {
+    size_t total = 0;
+    for (const auto* other : others) {
+      total += other->size();
+    }
+    auto bounds = std::vector<uint64_t>{};
+    if (threads() > 1 && total >= 2 * min_part_nodes) {
+      bounds = part_bounds(others, total,
+                           std::min(threads(), total / min_part_nodes));
+    }
+    if (bounds.size() <= 2) {
+      for (const auto* other : others) {
+        tree.merge(*other);
+      }
+      return;
+    }
+
+    // Each part takes its nodes from a pool of its own, so that the workers
+    // do not contend for a lock; replace() copies them into the tree.
+    auto pools =
+        std::vector<std::pmr::unsynchronized_pool_resource>(bounds.size() - 1);
+    auto parts = std::vector<extent_tree>{};
+    parts.reserve(pools.size());
+    for (auto& pool : pools) {
+      parts.emplace_back(&pool);
+    }
+    pool_->parallel_for(0, parts.size(), 1, [&](size_t part) {
+      parts[part] = tree.merged_range(others, bounds[part], bounds[part + 1],
+                                      &pools[part]);
+    });
+    tree.replace(bounds.front(), bounds.back(), parts);
+  }
+
+ private:
+  // Bounds of up to nparts parts that cover the nodes of trees: the least
+  // begin, the begins at the quantiles in between and the greatest end.
+  static auto part_bounds(std::span<const extent_tree* const> trees,
+                          size_t total,
+                          size_t nparts) -> std::vector<uint64_t> {
+    auto begins = std::vector<uint64_t>{};
+    begins.reserve(total);
+    uint64_t end = 0;
+    for (const auto* tree : trees) {
+      for (const auto& n : *tree) {
+        begins.push_back(n.ex.begin);
+      }
+      if (tree->size() != 0) {
+        end = std::max(end, tree->back().ex.end);
+      }
+    }
+    auto bounds = std::vector<uint64_t>{};
+    bounds.push_back(*std::min_element(begins.begin(), begins.end()));
+    for (size_t i = 1; i < nparts; ++i) {
+      auto nth = begins.begin() + static_cast<ptrdiff_t>(total * i / nparts);
+      std::nth_element(begins.begin(), nth, begins.end());
+      if (*nth > bounds.back()) {
+        bounds.push_back(*nth);
+      }
+    }
+    bounds.push_back(end);
+    return bounds;
+  }
+
+  std::unique_ptr<utils::thread_pool> pool_{};
+};
+
+}  // namespace peanuts
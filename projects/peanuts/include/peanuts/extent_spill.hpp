@@ -0,0 +1,344 @@
+#pragma once
+
+#include "peanuts/extent_tree.hpp"
+#include "peanuts/raii/fd.hpp"
+#include "peanuts/utils/varint_encoding.hpp"
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace peanuts {
+
+// Scratch file that holds the parts of extent trees spilled out of DRAM.
+// Runs are appended and their space is punched out again when they are read
+// back; once no run is left the file starts over. Placed on a DAX file
+// system, the runs take no DRAM at all.
+class spill_file {
+ public:
+  struct ref {
+    uint64_t ofs;
+    uint64_t size;
+  };
+
+  // The file is created unnamed in dir, so that it goes away with the
+  // process.
+  explicit spill_file(const std::string& dir)
+      : fd_{::open(dir.c_str(), O_TMPFILE | O_RDWR, 0600)} {
+    if (!fd_) {
+      throw std::system_error{errno, std::system_category(),
+                              "Failed to create spill file in " + dir};
+    }
+  }
+
+  auto write(const std::string& data) -> ref {
+    auto r = ref{end_, data.size()};
+    for (size_t done = 0; done < data.size();) {
+      auto ret = ::pwrite(fd(), data.data() + done, data.size() - done,
+                          static_cast<off_t>(r.ofs + done));
+      if (ret < 0) {
+        throw std::system_error{errno, std::system_category(),
+                                "Failed to write spill file"};
+      }
+      done += ret;
+    }
+    end_ += data.size();
+    used_ += data.size();
+    return r;
+  }
+
+  auto read(ref r, std::string& data) -> void {
+    data.resize(r.size);
+    for (size_t done = 0; done < r.size;) {
+      auto ret = ::pread(fd(), data.data() + done, r.size - done,
+                         static_cast<off_t>(r.ofs + done));
+      if (ret <= 0) {
+        throw std::system_error{ret < 0 ? errno : EIO, std::system_category(),
+                                "Failed to read spill file"};
+      }
+      done += ret;
+    }
+  }
+
+  auto release(ref r) -> void {
+    used_ -= r.size;
+    if (used_ == 0) {
+      end_ = 0;
+      (void)::ftruncate(fd(), 0);
+      return;
+    }
+    // best effort; the space is reused at the latest when the file empties
+    (void)::fallocate(fd(), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      static_cast<off_t>(r.ofs), static_cast<off_t>(r.size));
+  }
+
+  // bytes held by runs
+  auto used() const -> size_t { return used_; }
+
+ private:
+  auto fd() const -> int { return static_cast<int>(fd_.get()); }
+
+  raii::file_descriptor fd_;
+  uint64_t end_ = 0;
+  size_t used_ = 0;
+};
+
+// The spilled part of an extent tree: disjoint runs of consecutive nodes,
+// each covering a range of the file that the tree in DRAM, the hot tree,
+// has no node in. Runs are encoded compactly, as varints of the gaps,
+// lengths, pointer and epoch deltas of their nodes, and kept in a
+// spill_file.
+// Operations on a range of the hot tree first page in the runs that overlap
+// it; trim() spills runs again once the hot tree grows beyond its limit.
+// Without a spill file, nothing is ever spilled.
+class cold_extents {
+  using node = extent_tree::node;
+
+  struct run {
+    extent range;
+    size_t count;
+    spill_file::ref ref;
+  };
+
+ public:
+  cold_extents() = default;
+  cold_extents(const cold_extents&) = delete;
+  auto operator=(const cold_extents&) -> cold_extents& = delete;
+  ~cold_extents() { clear(); }
+
+  // Keep at most max_nodes nodes in hot, spilling to file. A limit of 0 or
+  // no file means no limit. Runs spilled to another file are paged in first.
+  auto set_limit(extent_tree& hot,
+                 size_t max_nodes,
+                 std::shared_ptr<spill_file> file) -> void {
+    if (file != file_) {
+      page_in_all(hot);
+    }
+    max_nodes_ = max_nodes;
+    file_ = std::move(file);
+    trim(hot);
+  }
+  auto limit() const -> size_t { return file_ ? max_nodes_ : 0; }
+
+  auto empty() const -> bool { return runs_.empty(); }
+  // nodes spilled
+  auto size() const -> size_t { return count_; }
+  auto end_offset() const -> uint64_t {
+    return runs_.empty() ? 0 : std::prev(runs_.end())->second.range.end;
+  }
+
+  // Move the runs that overlap [range.begin, range.end) back into hot.
+  auto page_in(extent_tree& hot, extent range) -> void {
+    last_access_ = range.begin;
+    if (runs_.empty()) {
+      return;
+    }
+    auto it = runs_.upper_bound(range.begin);
+    if (it != runs_.begin() && std::prev(it)->second.range.end > range.begin) {
+      --it;
+    }
+    // an empty range still pages in the run it falls in, as find() does
+    auto end = std::max(range.end, range.begin + 1);
+    while (it != runs_.end() && it->first < end) {
+      it = page_in(hot, it);
+    }
+  }
+
+  auto page_in_all(extent_tree& hot) -> void {
+    for (auto it = runs_.begin(); it != runs_.end();) {
+      it = page_in(hot, it);
+    }
+  }
+
+  // Drop what lies at or beyond size; the run that straddles it is paged in.
+  auto truncate(extent_tree& hot, uint64_t size) -> void {
+    page_in(hot, {size, size + 1});
+    for (auto it = runs_.lower_bound(size); it != runs_.end();) {
+      it = erase(it);
+    }
+  }
+
+  // Spill runs from hot until it is back to three quarters of the limit.
+  // They are taken from the end of the tree farther away from the range
+  // paged in last, which readers and writers are most likely to come back
+  // to.
+  auto trim(extent_tree& hot) -> void {
+    if (limit() == 0 || hot.size() <= max_nodes_) {
+      return;
+    }
+    auto target = max_nodes_ / 4 * 3;
+    auto run_nodes = std::max<size_t>(64, max_nodes_ / 8);
+    while (hot.size() > target) {
+      auto from_back =
+          hot.back().ex.end - std::min(hot.back().ex.end, last_access_) >
+          std::max(hot.begin()->ex.begin, last_access_) -
+              hot.begin()->ex.begin;
+      spill(hot, from_back, std::min(run_nodes, hot.size() - target));
+    }
+  }
+
+  // Call fn on every spilled node, run by run in order.
+  template <typename Fn>
+  auto for_each(Fn&& fn) const -> void {
+    auto nodes = std::vector<node>{};
+    for (const auto& [begin, r] : runs_) {
+      load(r, nodes);
+      for (const auto& n : nodes) {
+        fn(n);
+      }
+    }
+  }
+
+  // Let fn(tree) modify the nodes of each run in place, run by run. fn must
+  // keep the nodes within the range of the run.
+  template <typename Fn>
+  auto transform(Fn&& fn) -> void {
+    auto nodes = std::vector<node>{};
+    for (auto it = runs_.begin(); it != runs_.end();) {
+      auto& r = it->second;
+      load(r, nodes);
+      auto tree = extent_tree{};
+      for (const auto& n : nodes) {
+        tree.nodes_.emplace_hint(tree.end(), n);
+      }
+      fn(tree);
+      if (tree.size() == 0) {
+        it = erase(it);
+        continue;
+      }
+      nodes.assign(tree.begin(), tree.end());
+      file_->release(r.ref);
+      count_ = count_ - r.count + nodes.size();
+      r.count = nodes.size();
+      r.ref = store(nodes);
+      ++it;
+    }
+  }
+
+  auto clear() -> void {
+    for (auto it = runs_.begin(); it != runs_.end();) {
+      it = erase(it);
+    }
+  }
+
+ private:
+  using run_map = std::map<uint64_t, run>;
+
+  auto page_in(extent_tree& hot, run_map::iterator it) -> run_map::iterator {
+    auto nodes = std::vector<node>{};
+    load(it->second, nodes);
+    auto hint = hot.nodes_.lower_bound(nodes.front());
+    for (const auto& n : nodes) {
+      hint = std::next(hot.nodes_.emplace_hint(hint, n));
+    }
+    return erase(it);
+  }
+
+  // Move count nodes from the front or the back of hot into a new run. A run
+  // stops short of the next one, so that runs stay disjoint.
+  auto spill(extent_tree& hot, bool from_back, size_t count) -> void {
+    auto first = hot.begin();
+    auto last = hot.end();
+    if (from_back) {
+      first = std::prev(last);
+      auto next_run = runs_.lower_bound(first->ex.end);
+      auto floor = next_run == runs_.begin()
+                       ? uint64_t{0}
+                       : std::prev(next_run)->second.range.end;
+      for (size_t n = 1; n < count && first != hot.begin() &&
+                         std::prev(first)->ex.begin >= floor;
+           ++n) {
+        --first;
+      }
+    } else {
+      last = std::next(first);
+      auto next_run = runs_.lower_bound(first->ex.end);
+      auto ceiling = next_run == runs_.end() ? UINT64_MAX : next_run->first;
+      for (size_t n = 1;
+           n < count && last != hot.end() && last->ex.end <= ceiling; ++n) {
+        ++last;
+      }
+    }
+
+    auto nodes = std::vector<node>(first, last);
+    hot.nodes_.erase(first, last);
+    auto range = extent{nodes.front().ex.begin, nodes.back().ex.end};
+    runs_.emplace(range.begin, run{range, nodes.size(), store(nodes)});
+    count_ += nodes.size();
+  }
+
+  auto erase(run_map::iterator it) -> run_map::iterator {
+    file_->release(it->second.ref);
+    count_ -= it->second.count;
+    return runs_.erase(it);
+  }
+
+  static auto zigzag(uint64_t delta) -> uint64_t {
+    return (delta << 1) ^ (static_cast<uint64_t>(
+                              static_cast<int64_t>(delta) >> 63));
+  }
+  static auto unzigzag(uint64_t value) -> uint64_t {
+    return (value >> 1) ^ (~(value & 1) + 1);
+  }
+
+  // Sequentially written data encodes to a few bytes per node: the gap to
+  // the previous node, the length, the distance of the pointer from where
+  // the previous node's data ended and the change of the epoch.
+  auto store(const std::vector<node>& nodes) -> spill_file::ref {
+    buf_.clear();
+    uint64_t prev_end = 0;
+    uint64_t prev_ptr_end = 0;
+    uint64_t prev_epoch = 0;
+    for (const auto& n : nodes) {
+      encode_varint(n.ex.begin - prev_end, buf_);
+      encode_varint(n.ex.size(), buf_);
+      encode_varint(zigzag(n.ptr - prev_ptr_end), buf_);
+      encode_varint(static_cast<uint32_t>(n.client_id), buf_);
+      encode_varint(zigzag(n.epoch - prev_epoch), buf_);
+      prev_end = n.ex.end;
+      prev_epoch = n.epoch;
+      prev_ptr_end = n.ptr + n.ex.size();
+    }
+    return file_->write(buf_);
+  }
+
+  auto load(const run& r, std::vector<node>& nodes) const -> void {
+    file_->read(r.ref, buf_);
+    nodes.clear();
+    nodes.reserve(r.count);
+    size_t index = 0;
+    uint64_t prev_end = 0;
+    uint64_t prev_ptr_end = 0;
+    uint64_t prev_epoch = 0;
+    for (size_t i = 0; i < r.count; ++i) {
+      auto begin = prev_end + decode_varint<uint64_t>(buf_, index);
+      auto size = decode_varint<uint64_t>(buf_, index);
+      auto ptr = prev_ptr_end + unzigzag(decode_varint<uint64_t>(buf_, index));
+      auto client_id = static_cast<int>(decode_varint<uint32_t>(buf_, index));
+      auto epoch = static_cast<uint32_t>(
+          prev_epoch + unzigzag(decode_varint<uint64_t>(buf_, index)));
+      nodes.emplace_back(begin, begin + size, ptr, client_id, epoch);
+      prev_end = begin + size;
+      prev_epoch = epoch;
+      prev_ptr_end = ptr + size;
+    }
+  }
+
+  std::shared_ptr<spill_file> file_{};
+  size_t max_nodes_ = 0;
+  run_map runs_{};  // by the begin of their range
+  size_t count_ = 0;
+  uint64_t last_access_ = 0;
+  mutable std::string buf_{};
+};
+
+}  // namespace peanuts
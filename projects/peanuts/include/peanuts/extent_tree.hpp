@@ -1,10 +1,16 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <limits>
+#include <memory_resource>
 #include <optional>
 #include <ostream>
 #include <set>
+#include <span>
+#include <tuple>
+#include <vector>
 
 #include "inspector.hpp"
 #include "zpp_bits.h"
@@ -69,21 +75,38 @@ struct extent {
 
 class extent_tree {
  public:
+  // Epoch of the nodes that have not been synced yet, which are newer than
+  // any synced one.
+  static constexpr uint32_t unsynced_epoch =
+      std::numeric_limits<uint32_t>::max();
+
   struct node {
     extent ex;
     uint64_t ptr;
     int client_id;
+    // sync that made the node global, see newer(); fits in the padding
+    uint32_t epoch = unsynced_epoch;
 
-    using serialize = zpp::bits::members<3>;
+    using serialize = zpp::bits::members<4>;
 
     node() = default;
-    node(uint64_t begin, uint64_t end, uint64_t ptr, int client_id)
-        : ex(begin, end), ptr(ptr), client_id(client_id) {}
+    node(uint64_t begin,
+         uint64_t end,
+         uint64_t ptr,
+         int client_id,
+         uint32_t epoch = unsynced_epoch)
+        : ex(begin, end), ptr(ptr), client_id(client_id), epoch(epoch) {}
 
     bool overlaps(const node& other) const { return ex.overlaps(other.ex); }
 
     bool operator==(const node& other) const {
-      return ex == other.ex && ptr == other.ptr && client_id == other.client_id;
+      return ex == other.ex && ptr == other.ptr &&
+             client_id == other.client_id && epoch == other.epoch;
+    }
+
+    // the part of this node in [begin, end)
+    auto slice(uint64_t begin, uint64_t end) const -> node {
+      return node(begin, end, ptr + (begin - ex.begin), client_id, epoch);
     }
 
     std::optional<node> get_non_overlapping(const node& other) const {
@@ -91,8 +114,7 @@ class extent_tree {
 
       auto non_overlapping = ex.get_non_overlapping(other.ex);
       if (non_overlapping.has_value()) {
-        return node(non_overlapping->begin, non_overlapping->end,
-                    ptr + (non_overlapping->begin - ex.begin), client_id);
+        return slice(non_overlapping->begin, non_overlapping->end);
       }
       return std::nullopt;
     }
@@ -104,9 +126,17 @@ class extent_tree {
 
     bool followed_by(const node& other) const {
       return ex.followed_by(other.ex) && client_id == other.client_id &&
-             ptr + ex.size() == other.ptr;
+             epoch == other.epoch && ptr + ex.size() == other.ptr;
     }
   };
+  static_assert(sizeof(node) == 32);
+
+  // Whether a wins over b where they overlap in merge(): nodes of later
+  // epochs win and, within an epoch, those of higher client ids. The result
+  // of merging trees thus does not depend on the order they are merged in.
+  static bool newer(const node& a, const node& b) {
+    return std::tie(a.epoch, a.client_id) > std::tie(b.epoch, b.client_id);
+  }
 
   struct comparator {
     bool operator()(const node& lhs, const node& rhs) const {
@@ -114,16 +144,35 @@ class extent_tree {
     }
   };
 
+  // Trees allocate a node per insertion; taking them from size-classed pools
+  // instead of malloc keeps neighbours close together, too. Trees used by a
+  // single thread are best given their own unsynchronized pool; this one is
+  // shared by the others, which may cross threads. It is never destroyed,
+  // as trees may outlive static destruction.
+  static auto node_pool() -> std::pmr::memory_resource* {
+    static auto* pool = new std::pmr::synchronized_pool_resource{};
+    return pool;
+  }
+
+  extent_tree() : extent_tree(node_pool()) {}
+  explicit extent_tree(std::pmr::memory_resource* mr) : nodes_{mr} {}
+  // copies allocate from the resource of the original
+  extent_tree(const extent_tree& other)
+      : nodes_{other.nodes_, other.nodes_.get_allocator()} {}
+  extent_tree(extent_tree&&) noexcept = default;
+  auto operator=(const extent_tree&) -> extent_tree& = default;
+  auto operator=(extent_tree&&) -> extent_tree& = default;
+
   auto operator==(const extent_tree& other) const -> bool {
     return nodes_ == other.nodes_;
   }
 
-  std::set<node, comparator> nodes_;
+  std::pmr::set<node, comparator> nodes_;
 
   using serialize = zpp::bits::members<1>;
 
-  using iterator = std::set<node>::iterator;
-  using const_iterator = std::set<node>::const_iterator;
+  using iterator = decltype(nodes_)::iterator;
+  using const_iterator = decltype(nodes_)::const_iterator;
 
   iterator begin() { return nodes_.begin(); }
   const_iterator begin() const { return nodes_.cbegin(); }
@@ -151,25 +200,123 @@ class extent_tree {
     return it;
   }
   iterator find(extent ex) { return find(ex.begin, ex.end); }
+  const_iterator find(uint64_t begin, uint64_t end) const {
+    return const_cast<extent_tree*>(this)->find(begin, end);
+  }
+  const_iterator find(extent ex) const { return find(ex.begin, ex.end); }
+
+  // Call fn(query, node) for each node that overlaps one of queries, which
+  // are extents or nodes sorted by begin. A single cursor walks the tree
+  // along the queries, so a batch costs time linear in its output rather
+  // than a descent per query; the cursor only searches again to skip a long
+  // run of nodes between two queries. Queries may overlap each other.
+  template <typename Queries, typename Fn>
+  void query_sorted(const Queries& queries, Fn&& fn) const {
+    auto it = nodes_.begin();
+    [[maybe_unused]] uint64_t last_begin = 0;
+    for (const auto& query : queries) {
+      auto ex = query_extent(query);
+      assert(last_begin <= ex.begin);
+      last_begin = ex.begin;
+
+      it = seek(it, ex.begin);
+      for (auto n = it; n != nodes_.end() && n->ex.begin < ex.end; ++n) {
+        if (n->ex.overlaps(ex)) {
+          fn(ex, *n);
+        }
+      }
+    }
+  }
 
-  void merge(const extent_tree& other) {
-    static comparator comp;
+  // Set the epoch of all nodes, such as the one of the sync that merges
+  // them. The order of the nodes does not depend on it.
+  void stamp(uint32_t epoch) {
+    for (const auto& n : nodes_) {
+      const_cast<node&>(n).epoch = epoch;
+    }
+  }
 
+  // Merge the nodes of other, which win over the nodes of this tree where
+  // they overlap unless those are newer().
+  void merge(const extent_tree& other) {
     auto in_it = other.nodes_.begin();
     if (in_it == other.nodes_.end()) {
       return;
     }
     auto out_it = nodes_.lower_bound(*in_it);
     for (; in_it != other.nodes_.end(); ++in_it) {
-      out_it = do_insert(out_it, *in_it);
-      while (out_it != nodes_.end() && !comp(*in_it, *out_it)) {
+      // a newer node that has been kept may reach past the previous one
+      while (out_it != nodes_.end() && out_it->ex.end <= in_it->ex.begin) {
         ++out_it;
       }
+      out_it = merge_one(out_it, *in_it);
+    }
+  }
+
+  // The nodes this tree would have in [begin, end) after merging others,
+  // cut at the bounds, allocated from mr. Neither tree changes, so ranges
+  // can be merged concurrently, each into its own resource, and put back
+  // with replace().
+  auto merged_range(std::span<const extent_tree* const> others,
+                    uint64_t begin,
+                    uint64_t end,
+                    std::pmr::memory_resource* mr = node_pool()) const
+      -> extent_tree {
+    auto clip = [&](const node& n) {
+      return n.slice(std::max(n.ex.begin, begin), std::min(n.ex.end, end));
+    };
+    auto range = node(begin, end, 0, 0);
+    auto result = extent_tree{mr};
+    for (auto it = nodes_.lower_bound(range);
+         it != nodes_.end() && it->ex.begin < end; ++it) {
+      result.nodes_.emplace_hint(result.nodes_.end(), clip(*it));
+    }
+    for (const auto* other : others) {
+      for (auto it = other->nodes_.lower_bound(range);
+           it != other->nodes_.end() && it->ex.begin < end; ++it) {
+        auto piece = clip(*it);
+        result.merge_one(result.nodes_.lower_bound(piece), piece);
+      }
+    }
+    return result;
+  }
+
+  // Replace the nodes in [begin, end) with the nodes of parts, which lie in
+  // that range in order.
+  void replace(uint64_t begin,
+               uint64_t end,
+               std::span<const extent_tree> parts) {
+    remove(begin, end);
+    auto hint = nodes_.lower_bound(node(begin, begin, 0, 0));
+    for (const auto& part : parts) {
+      for (auto it = part.begin(); it != part.end(); ++it) {
+        // nodes cut at the bounds of the parts coalesce again
+        if (it == part.begin() || std::next(it) == part.end()) {
+          hint = std::next(do_insert(hint, *it));
+        } else {
+          hint = std::next(nodes_.emplace_hint(hint, *it));
+        }
+      }
     }
   }
 
-  void add(uint64_t begin, uint64_t end, uint64_t ptr, int client_id) {
-    auto new_node = node{begin, end, ptr, client_id};
+  void add(uint64_t begin,
+           uint64_t end,
+           uint64_t ptr,
+           int client_id,
+           uint32_t epoch = unsynced_epoch) {
+    auto new_node = node{begin, end, ptr, client_id, epoch};
+    // Appends, the common case of sequential writes, need no search: the
+    // last node is the tail cursor and is extended in place if the new one
+    // continues it, which keeps the order of the set.
+    if (nodes_.empty() || begin >= back().ex.end) {
+      if (!nodes_.empty() && back().followed_by(new_node)) {
+        const_cast<node&>(back()).ex.end = end;
+      } else {
+        nodes_.emplace_hint(nodes_.end(), new_node);
+      }
+      return;
+    }
     do_insert(nodes_.lower_bound(new_node), new_node);
   }
 
@@ -183,10 +330,7 @@ class extent_tree {
       if (non_overlapping.has_value()) {
         if (non_overlapping->ex.end < it->ex.end) {
           // If rear part of existing node overlaps
-          auto remaining =
-              node(non_overlapping->ex.end, it->ex.end,
-                   it->ptr + (non_overlapping->ex.end - it->ex.begin),
-                   it->client_id);
+          auto remaining = it->slice(non_overlapping->ex.end, it->ex.end);
 
           assert(remaining.overlaps(remove_node));
 
@@ -219,6 +363,47 @@ class extent_tree {
   }
 
  private:
+  // Merge value into the tree at it, the first node that ends after its
+  // begin. Only the parts not covered by newer nodes are inserted.
+  iterator merge_one(iterator it, const node& value) {
+    auto pieces = std::vector<node>{};
+    auto pos = value.ex.begin;
+    for (auto e = it; e != nodes_.end() && e->ex.begin < value.ex.end; ++e) {
+      if (newer(*e, value)) {
+        if (pos < e->ex.begin) {
+          pieces.push_back(value.slice(pos, e->ex.begin));
+        }
+        pos = std::max(pos, e->ex.end);
+      }
+    }
+    if (pos == value.ex.begin) {
+      return do_insert(it, value);
+    }
+    if (pos < value.ex.end) {
+      pieces.push_back(value.slice(pos, value.ex.end));
+    }
+    for (const auto& piece : pieces) {
+      do_insert(nodes_.lower_bound(piece), piece);
+    }
+    return nodes_.lower_bound(value);
+  }
+
+  // steps the cursor of query_sorted() takes before searching instead
+  static constexpr int max_seek_steps = 8;
+
+  static auto query_extent(const extent& ex) -> extent { return ex; }
+  static auto query_extent(const node& n) -> extent { return n.ex; }
+
+  // the first node from it on that ends after pos
+  const_iterator seek(const_iterator it, uint64_t pos) const {
+    for (int i = 0; i < max_seek_steps; ++i, ++it) {
+      if (it == nodes_.end() || it->ex.end > pos) {
+        return it;
+      }
+    }
+    return nodes_.lower_bound(node(pos, pos, 0, 0));
+  }
+
   iterator do_insert(iterator it, const node& value) {
     while (it != nodes_.end() && value.overlaps(*it)) {
       auto non_overlapping = it->get_non_overlapping(value);
@@ -226,10 +411,7 @@ class extent_tree {
         if (non_overlapping->ex.end < it->ex.end) {
           // Overlap rear part of existing node
           // check if there is a non-overlapping rear part
-          auto remaining =
-              node(non_overlapping->ex.end, it->ex.end,
-                   it->ptr + (non_overlapping->ex.end - it->ex.begin),
-                   it->client_id);
+          auto remaining = it->slice(non_overlapping->ex.end, it->ex.end);
 
           assert(remaining.overlaps(value));
 
@@ -259,7 +441,7 @@ class extent_tree {
       --prev;
 
       if (prev->followed_by(*it)) {
-        node coalesced(prev->ex.begin, it->ex.end, prev->ptr, prev->client_id);
+        auto coalesced = prev->slice(prev->ex.begin, it->ex.end);
         nodes_.erase(prev);
         it = nodes_.erase(it);
         it = nodes_.insert(it, coalesced);
@@ -269,7 +451,7 @@ class extent_tree {
     // coalesce with next node
     if (auto next = it; ++next != nodes_.end()) {
       if (it->followed_by(*next)) {
-        node coalesced(it->ex.begin, next->ex.end, it->ptr, it->client_id);
+        auto coalesced = it->slice(it->ex.begin, next->ex.end);
         nodes_.erase(it);
         it = nodes_.erase(next);
         it = nodes_.insert(it, coalesced);
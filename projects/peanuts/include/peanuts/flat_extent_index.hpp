@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "peanuts/extent_tree.hpp"
+#include "peanuts/inspector.hpp"
+#include "peanuts/utils/leaf_search.hpp"
+
+namespace peanuts {
+
+// A read-only copy of an extent_tree in sorted arrays, for trees that no
+// longer change, such as the ones of a published snapshot. It answers
+// find() like the tree does: a binary search narrows the ends of the nodes
+// down to a leaf of leaf_size keys, which is then scanned with a few SIMD
+// compares instead of as many unpredictable branches.
+class flat_extent_index {
+ public:
+  using node = extent_tree::node;
+  using const_iterator = std::vector<node>::const_iterator;
+  using iterator = const_iterator;
+
+  // keys per leaf: two AVX-512 or four AVX2 compares
+  static constexpr size_t leaf_size = 16;
+
+  flat_extent_index() = default;
+  explicit flat_extent_index(const extent_tree& tree) {
+    ends_.reserve(tree.size());
+    nodes_.reserve(tree.size());
+    for (const auto& n : tree) {
+      ends_.push_back(n.ex.end);
+      nodes_.push_back(n);
+    }
+  }
+
+  // nodes must be sorted and disjoint
+  explicit flat_extent_index(std::vector<node> nodes)
+      : nodes_{std::move(nodes)} {
+    ends_.reserve(nodes_.size());
+    for (const auto& n : nodes_) {
+      ends_.push_back(n.ex.end);
+    }
+  }
+
+  auto begin() const -> const_iterator { return nodes_.begin(); }
+  auto end() const -> const_iterator { return nodes_.end(); }
+  auto back() const -> const node& { return nodes_.back(); }
+  auto size() const -> size_t { return nodes_.size(); }
+
+  // the ends of the nodes, in order
+  auto ends() const -> std::span<const uint64_t> { return ends_; }
+
+  // Find the first node that falls in a [begin, end) range.
+  auto find(uint64_t begin, uint64_t end) const -> const_iterator {
+    auto it = nodes_.begin() + static_cast<ptrdiff_t>(upper_bound(begin));
+    if (it != nodes_.end() && !it->ex.overlaps(extent{begin, end})) {
+      return nodes_.end();
+    }
+    return it;
+  }
+  auto find(extent ex) const -> const_iterator {
+    return find(ex.begin, ex.end);
+  }
+
+  // The index of the first node that ends after pos. leaf_search(keys, pos)
+  // counts the keys of the leaf up to pos; it can be swapped out to compare
+  // search strategies.
+  template <typename LeafSearch = decltype(&utils::count_less_equal)>
+  auto upper_bound(uint64_t pos,
+                   LeafSearch leaf_search = &utils::count_less_equal) const
+      -> size_t {
+    size_t lo = 0;
+    size_t len = ends_.size();
+    while (len > leaf_size) {
+      auto half = len / 2;
+      if (ends_[lo + half - 1] <= pos) {
+        lo += half;
+        len -= half;
+      } else {
+        len = half;
+      }
+    }
+    return lo + leaf_search(std::span{ends_}.subspan(lo, len), pos);
+  }
+
+  std::ostream& inspect(std::ostream& os) const {
+    for (const auto& n : nodes_) {
+      os << utils::make_inspector(n);
+    }
+    return os;
+  }
+
+ private:
+  // kept apart from the nodes so that a leaf of keys spans two cache lines
+  std::vector<uint64_t> ends_;
+  std::vector<node> nodes_;
+};
+
+}  // namespace peanuts
@@ -3,7 +3,7 @@
 #include "peanuts/mpi/info.hpp"
 
 namespace peanuts::mpi {
-std::ostream& inspect(std::ostream& os, const info& info) {
+inline std::ostream& inspect(std::ostream& os, const info& info) {
   os << "{";
   for (const auto& [key, value] : info) {
     os << key << ": " << value << ", ";
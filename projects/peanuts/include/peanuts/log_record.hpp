@@ -0,0 +1,107 @@
+#pragma once
+
+#include "peanuts/ring_buffer.hpp"
+#include "peanuts/utils/crc32c.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+namespace peanuts {
+
+// Header written in front of every payload appended to a local ring when
+// PEANUTS_USE_LOG_RECORDS is enabled. Records make the ring self-describing,
+// so the extent trees can be rebuilt by scanning the ring after a failure.
+struct log_record_header {
+  using lsn_t = local_ring_buffer::lsn_t;
+
+  static constexpr uint32_t magic_value = 0x73746e70;  // "pnts"
+
+  enum class record_type : uint32_t {
+    data = 1,   // file data written by bb_handler::pwrite
+    index = 2,  // serialized bb written by bb_store::save
+    // data moved by bb_store::compact that the writing rank has overwritten
+    // since, kept for the other ranks only and not replayed by recovery
+    shadowed = 3,
+  };
+
+  uint32_t magic;
+  uint32_t checksum;  // crc32c of the header (checksum = 0) and the payload
+  record_type type;
+  uint32_t reserved;
+  lsn_t lsn;       // lsn of this header; rejects records left by earlier laps
+  uint64_t epoch;  // generation of the bb_store that wrote this record
+  uint64_t ino;
+  uint64_t offset;
+  uint64_t length;  // payload size
+
+  auto payload_lsn() const -> lsn_t { return lsn + sizeof(log_record_header); }
+  auto next_lsn() const -> lsn_t { return payload_lsn() + length; }
+
+  auto compute_checksum(std::span<const std::byte> payload) const
+      -> uint32_t {
+    auto header = *this;
+    header.checksum = 0;
+    return utils::crc32c(payload,
+                         utils::crc32c(std::as_bytes(std::span{&header, 1})));
+  }
+};
+static_assert(std::is_trivially_copyable_v<log_record_header>);
+
+// Append a record to the ring. Returns the lsn of the payload, or nullopt if
+// the ring is full. The payload is persisted before its header.
+inline auto append_log_record(local_ring_buffer& ring,
+                              log_record_header::record_type type,
+                              uint64_t epoch,
+                              uint64_t ino,
+                              uint64_t offset,
+                              std::span<const std::byte> payload)
+    -> std::optional<log_record_header::lsn_t> {
+  auto lsn = ring.reserve_nb(sizeof(log_record_header) + payload.size());
+  if (!lsn) {
+    return std::nullopt;
+  }
+  auto header =
+      log_record_header{log_record_header::magic_value, 0, type, 0, *lsn,
+                        epoch, ino, offset, payload.size()};
+  header.checksum = header.compute_checksum(payload);
+  ring.pwrite(payload, header.payload_lsn());
+  ring.pwrite(std::as_bytes(std::span{&header, 1}), header.lsn);
+  return header.payload_lsn();
+}
+
+// Read the record at lsn. Returns nullopt unless a complete record of the
+// given epoch (any epoch if not given) that ends before end_lsn is found.
+// tmp is used as scratch space when the payload is not contiguous.
+inline auto read_log_record(const local_ring_buffer& ring,
+                            log_record_header::lsn_t lsn,
+                            log_record_header::lsn_t end_lsn,
+                            std::optional<uint64_t> epoch,
+                            std::vector<std::byte>& tmp)
+    -> std::optional<log_record_header> {
+  if (end_lsn < lsn || end_lsn - lsn < sizeof(log_record_header)) {
+    return std::nullopt;
+  }
+  auto header = log_record_header{};
+  ring.pread(std::as_writable_bytes(std::span{&header, 1}), lsn);
+  if (header.magic != log_record_header::magic_value || header.lsn != lsn ||
+      (epoch && header.epoch != *epoch) ||
+      header.length > end_lsn - header.payload_lsn()) {
+    return std::nullopt;
+  }
+
+  auto payload = ring.view(header.payload_lsn(), header.length);
+  if (!payload) {
+    tmp.resize(header.length);
+    ring.pread(tmp, header.payload_lsn());
+    payload = std::span<const std::byte>{tmp};
+  }
+  if (header.compute_checksum(*payload) != header.checksum) {
+    return std::nullopt;
+  }
+  return header;
+}
+
+}  // namespace peanuts
@@ -12,11 +12,37 @@
 #include "peanuts/mpi/type.hpp"
 #include "peanuts/mpi/type_traits.hpp"
 
+#include <cerrno>
+#include <cstddef>
+#include <limits>
 #include <numeric>
 #include <span>
+#include <system_error>
+#include <vector>
 
 namespace peanuts::mpi {
 
+// The int count MPI takes for n elements. Throws EOVERFLOW rather than
+// letting counts of 2^31 and more wrap.
+inline auto to_count(size_t n) -> int {
+  if (n > static_cast<size_t>(std::numeric_limits<int>::max())) {
+    throw std::system_error{EOVERFLOW, std::generic_category(),
+                            "peanuts::mpi::to_count()"};
+  }
+  return static_cast<int>(n);
+}
+
+// Displacements of blocks packed contiguously with the given counts.
+inline auto to_displs(std::span<const int> counts) -> std::vector<int> {
+  auto displs = std::vector<int>(counts.size());
+  size_t total = 0;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    displs[i] = to_count(total);
+    total += static_cast<size_t>(counts[i]);
+  }
+  return displs;
+}
+
 class comm {
   raii::unique_comm comm_{MPI_COMM_NULL};
 
@@ -81,8 +107,8 @@ class comm {
                   std::span<U> recv_data,
                   const dtype& recv_dtype) const {
     MPI_CHECK_ERROR_CODE(MPI_Allgather(
-        send_data.data(), static_cast<int>(send_data.size()), send_dtype,
-        recv_data.data(), static_cast<int>(recv_data.size()) / size(),
+        send_data.data(), to_count(send_data.size()), send_dtype,
+        recv_data.data(), to_count(recv_data.size() / size()),
         recv_dtype, native()));
   }
 
@@ -117,7 +143,7 @@ class comm {
                     std::span<const int> recv_counts,
                     std::span<const int> recv_displs) const {
     MPI_CHECK_ERROR_CODE(
-        MPI_Allgatherv(send_data.data(), static_cast<int>(send_data.size()),
+        MPI_Allgatherv(send_data.data(), to_count(send_data.size()),
                        send_dtype, recv_data.data(), recv_counts.data(),
                        recv_displs.data(), recv_dtype, native()));
   }
@@ -137,18 +163,116 @@ class comm {
   void all_gather_v(const T& send_data,
                     std::span<U> recv_data,
                     std::span<const int> recv_counts) const {
-    std::vector<int> recv_displs(recv_counts.size());
-    std::exclusive_scan(recv_counts.begin(), recv_counts.end(),
-                        recv_displs.begin(), 0);
+    auto recv_displs = to_displs(recv_counts);
     all_gather_v(send_data, recv_data, recv_counts, recv_displs);
   }
 
+  // recv_data is only used on root
+  template <typename T, typename U>
+  void gather(std::span<const T> send_data,
+              const dtype& send_dtype,
+              std::span<U> recv_data,
+              const dtype& recv_dtype,
+              int root = 0) const {
+    MPI_CHECK_ERROR_CODE(MPI_Gather(
+        send_data.data(), to_count(send_data.size()), send_dtype,
+        recv_data.data(), to_count(recv_data.size() / size()),
+        recv_dtype, root, native()));
+  }
+
+  template <typename T, typename U>
+  void gather(std::span<const T> send_data,
+              std::span<U> recv_data,
+              int root = 0) const {
+    gather(send_data, to_dtype<std::remove_cv_t<T>>(), recv_data,
+           to_dtype<std::remove_cv_t<U>>(), root);
+  }
+
+  template <typename T, typename U>
+  void gather(const T& send_data, std::span<U> recv_data, int root = 0) const {
+    using send_adapter = detail::container_adapter<const T>;
+    gather(send_adapter::to_cspan(send_data), send_adapter::to_dtype(),
+           recv_data, mpi::to_dtype<std::remove_cv_t<U>>(), root);
+  }
+
+  // recv_data, recv_counts and recv_displs are only used on root
+  template <typename T, typename U>
+  void gather_v(std::span<const T> send_data,
+                const dtype& send_dtype,
+                std::span<U> recv_data,
+                const dtype& recv_dtype,
+                std::span<const int> recv_counts,
+                std::span<const int> recv_displs,
+                int root = 0) const {
+    MPI_CHECK_ERROR_CODE(
+        MPI_Gatherv(send_data.data(), to_count(send_data.size()),
+                    send_dtype, recv_data.data(), recv_counts.data(),
+                    recv_displs.data(), recv_dtype, root, native()));
+  }
+
+  template <typename T, typename U>
+  void gather_v(std::span<const T> send_data,
+                std::span<U> recv_data,
+                std::span<const int> recv_counts,
+                int root = 0) const {
+    auto recv_displs = to_displs(recv_counts);
+    gather_v(send_data, to_dtype<std::remove_cv_t<T>>(), recv_data,
+             to_dtype<std::remove_cv_t<U>>(), recv_counts,
+             std::span<const int>{recv_displs}, root);
+  }
+
+  template <typename T, typename U>
+  void all_to_all(std::span<const T> send_data,
+                  const dtype& send_dtype,
+                  std::span<U> recv_data,
+                  const dtype& recv_dtype) const {
+    MPI_CHECK_ERROR_CODE(MPI_Alltoall(
+        send_data.data(), to_count(send_data.size() / size()),
+        send_dtype, recv_data.data(),
+        to_count(recv_data.size() / size()), recv_dtype, native()));
+  }
+
+  template <typename T, typename U>
+  void all_to_all(std::span<const T> send_data, std::span<U> recv_data) const {
+    all_to_all(send_data, to_dtype<std::remove_cv_t<T>>(), recv_data,
+               to_dtype<std::remove_cv_t<U>>());
+  }
+
+  template <typename T, typename U>
+  void all_to_all_v(std::span<const T> send_data,
+                    const dtype& send_dtype,
+                    std::span<const int> send_counts,
+                    std::span<const int> send_displs,
+                    std::span<U> recv_data,
+                    const dtype& recv_dtype,
+                    std::span<const int> recv_counts,
+                    std::span<const int> recv_displs) const {
+    MPI_CHECK_ERROR_CODE(MPI_Alltoallv(
+        send_data.data(), send_counts.data(), send_displs.data(), send_dtype,
+        recv_data.data(), recv_counts.data(), recv_displs.data(), recv_dtype,
+        native()));
+  }
+
+  // data for each rank is packed contiguously in rank order
+  template <typename T, typename U>
+  void all_to_all_v(std::span<const T> send_data,
+                    std::span<const int> send_counts,
+                    std::span<U> recv_data,
+                    std::span<const int> recv_counts) const {
+    auto send_displs = to_displs(send_counts);
+    auto recv_displs = to_displs(recv_counts);
+    all_to_all_v(send_data, to_dtype<std::remove_cv_t<T>>(), send_counts,
+                 std::span<const int>{send_displs}, recv_data,
+                 to_dtype<std::remove_cv_t<U>>(), recv_counts,
+                 std::span<const int>{recv_displs});
+  }
+
   template <typename T>
   void broadcast(std::span<T> send_recv_data,
                  const dtype& dtype,
                  int root = 0) const {
     MPI_CHECK_ERROR_CODE(MPI_Bcast(send_recv_data.data(),
-                                   static_cast<int>(send_recv_data.size()),
+                                   to_count(send_recv_data.size()),
                                    dtype, root, native()));
   }
 
@@ -169,6 +293,14 @@ class comm {
     broadcast(adapter::to_span(send_recv_data), adapter::to_dtype(), root);
   }
 
+  // in place
+  template <typename T>
+  void all_reduce(std::span<T> send_recv_data, MPI_Op op) const {
+    MPI_CHECK_ERROR_CODE(MPI_Allreduce(
+        MPI_IN_PLACE, send_recv_data.data(), to_count(send_recv_data.size()),
+        to_dtype<std::remove_cv_t<T>>(), op, native()));
+  }
+
   // sendrecv
   template <typename T, typename U>
   auto send_receive(std::span<const T> send_data,
@@ -181,9 +313,9 @@ class comm {
                     const int recv_tag = MPI_ANY_TAG) const -> status {
     mpi::status status;
     MPI_CHECK_ERROR_CODE(
-        MPI_Sendrecv(send_data.data(), static_cast<int>(send_data.size()),
+        MPI_Sendrecv(send_data.data(), to_count(send_data.size()),
                      send_dtype, send_rank, send_tag, recv_data.data(),
-                     static_cast<int>(recv_data.size()), recv_dtype, recv_rank,
+                     to_count(recv_data.size()), recv_dtype, recv_rank,
                      recv_tag, native(), &status.native()));
     return status;
   }
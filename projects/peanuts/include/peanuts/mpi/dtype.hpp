@@ -1,11 +1,13 @@
 #pragma once
 
+#include "peanuts/mpi/aint.hpp"
 #include "peanuts/mpi/error.hpp"
 #include "peanuts/mpi/raii.hpp"
 #include "peanuts/mpi/type.hpp"
 #include "peanuts/utils/singleton.hpp"
 
 #include <mpi.h>
+#include <array>
 #include <tuple>
 #include <type_traits>
 
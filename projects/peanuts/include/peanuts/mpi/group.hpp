@@ -4,6 +4,8 @@
 
 #include <mpi.h>
 
+#include <span>
+
 namespace peanuts::mpi {
 class group {
   raii::unique_group group_{MPI_GROUP_NULL};
@@ -5,6 +5,7 @@
 
 #include <mpi.h>
 
+#include <cassert>
 #include <optional>
 #include <string>
 #include <unordered_map>
@@ -4,8 +4,6 @@
 
 #include <memory>
 
-MPI_Request request;
-
 namespace peanuts::mpi {
   class request {
     std::unique_ptr<MPI_Request> request_;
@@ -0,0 +1,369 @@
+#pragma once
+
+#include "peanuts/extent_tree.hpp"
+#include "peanuts/rpm.hpp"
+
+#include <zpp_bits.h>
+
+#include <sys/types.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace peanuts {
+
+// Pointer-free log of the extents a rank writes into its local ring, kept in
+// a reserved region of its own rpm block. Entries are appended (or the last
+// one extended) on every pwrite, so saving the index only takes a metadata
+// update. The region is split into two halves: compaction writes the live
+// entries into the inactive half and then flips the active one. When the
+// live entries no longer fit, the index spills: it stops recording, and
+// save() writes the trees into the ring instead, as without the index, and
+// only keeps the entries of the files that have not been opened since.
+class persistent_extent_index {
+ public:
+  struct entry {
+    enum class entry_kind : uint64_t {
+      extent = 0,    // [begin, end) of ino is stored at ptr in the local ring
+      sync = 1,      // earlier extents of ino were merged by sync #begin
+      truncate = 2,  // ino was truncated to begin
+      unlink = 3,    // ino was unlinked
+    };
+
+    entry_kind kind;
+    uint64_t ino;
+    uint64_t begin;
+    uint64_t end;
+    uint64_t ptr;
+  };
+  static_assert(std::is_trivially_copyable_v<entry>);
+
+  // An extent that had been synced before the index was restored, with the
+  // number of the sync that merged it.
+  struct restored_node {
+    uint64_t seq;
+    extent_tree::node node;
+
+    using serialize = zpp::bits::members<2>;
+  };
+
+  // Returns the entries that describe the current state, used when the
+  // active half is full.
+  using compactor = std::function<std::vector<entry>()>;
+
+ private:
+  struct header {
+    uint64_t magic;
+    uint64_t capacity;  // entries per half
+    uint64_t active;    // active half
+    uint64_t count[2];  // entries in each half
+  };
+  static_assert(std::is_trivially_copyable_v<header>);
+
+  static constexpr uint64_t magic_value = 0x78646e6973746e70;  // "pntsindx"
+
+ public:
+  persistent_extent_index(rpm_local_block block, off_t ofs, size_t size)
+      : block_{std::move(block)},
+        ofs_{ofs},
+        capacity_{size < min_size()
+                      ? 0
+                      : (size - sizeof(header)) / sizeof(entry) / 2} {}
+
+  static constexpr auto min_size() -> size_t {
+    return sizeof(header) + 2 * sizeof(entry);
+  }
+
+  auto set_compactor(compactor fn) -> void { compactor_ = std::move(fn); }
+
+  // Use the index left in pmem by an earlier store, rolled back to the state
+  // returned by seal(). If the index has been compacted since, extents whose
+  // data lies at or beyond head are dropped instead. Returns false if there
+  // is no valid index.
+  auto attach(uint64_t half, uint64_t count, uint64_t head) -> bool {
+    const auto& hdr = pheader();
+    if (hdr.magic != magic_value || hdr.capacity != capacity_ ||
+        hdr.active > 1 || hdr.count[hdr.active] > capacity_) {
+      return false;
+    }
+    attached_ = true;
+    sealed_ = 0;
+    sync_counts_.clear();
+    if (hdr.active == half && count <= hdr.count[half]) {
+      if (hdr.count[half] != count) {
+        write_header_field(offsetof(header, count) + half * sizeof(uint64_t),
+                           count);
+      }
+      index_positions();
+    } else {
+      auto live = std::vector<entry>{};
+      for (auto e : entries()) {
+        if (e.kind == entry::entry_kind::extent) {
+          if (e.ptr >= head) {
+            continue;
+          }
+          e.end = std::min(e.end, e.begin + (head - e.ptr));
+        }
+        live.push_back(e);
+      }
+      compact(live);
+    }
+    sealed_ = size();
+    return true;
+  }
+
+  // Entries written so far are not modified any more, so that attach() can
+  // roll back to them. Returns the active half and the number of entries.
+  auto seal() -> std::pair<uint64_t, uint64_t> {
+    ensure_initialized();
+    sealed_ = size();
+    return {pheader().active, sealed_};
+  }
+
+  auto append_extent(ino_t ino, uint64_t begin, uint64_t end, uint64_t ptr)
+      -> void {
+    if (begin == end || spilled_) {
+      return;
+    }
+    ensure_initialized();
+    if (auto n = size(); n > sealed_) {
+      // extend the last entry in place for sequential writes
+      const auto& last = entries()[n - 1];
+      if (last.kind == entry::entry_kind::extent && last.ino == ino &&
+          last.end == begin && last.ptr + (last.end - last.begin) == ptr) {
+        write_entry_field(n - 1, offsetof(entry, end), end);
+        return;
+      }
+    }
+    push_back({entry::entry_kind::extent, static_cast<uint64_t>(ino), begin,
+               end, ptr});
+  }
+
+  auto append_sync(ino_t ino) -> void {
+    if (spilled_) {
+      return;
+    }
+    auto seq = sync_count(ino);
+    push_back({entry::entry_kind::sync, static_cast<uint64_t>(ino), seq, 0, 0});
+    sync_counts_[ino] = seq + 1;
+  }
+
+  auto append_truncate(ino_t ino, uint64_t size) -> void {
+    push_back(
+        {entry::entry_kind::truncate, static_cast<uint64_t>(ino), size, 0, 0});
+  }
+
+  auto append_unlink(ino_t ino) -> void {
+    if (spilled_) {
+      unlinked_.insert(static_cast<uint64_t>(ino));
+      return;
+    }
+    push_back({entry::entry_kind::unlink, static_cast<uint64_t>(ino), 0, 0, 0});
+    sync_counts_[ino] = 0;
+  }
+
+  auto size() const -> size_t {
+    return attached_ ? pheader().count[pheader().active] : 0;
+  }
+  auto capacity() const -> size_t { return capacity_; }
+  // The index no longer records the extents, see above.
+  auto spilled() const -> bool { return spilled_; }
+  auto spill() -> void { spilled_ = true; }
+
+  // Once spilled, drop the entries of the files unlinked since and of those
+  // for which saved(ino) holds.
+  auto retain_unsaved(const std::function<bool(uint64_t)>& saved) -> void {
+    if (!spilled_ || !attached_) {
+      return;
+    }
+    auto live = std::vector<entry>{};
+    for (const auto& e : entries()) {
+      if (!unlinked_.contains(e.ino) && !saved(e.ino)) {
+        live.push_back(e);
+      }
+    }
+    if (live.size() != size()) {
+      compact(live);
+    }
+    unlinked_.clear();
+    sync_counts_.clear();
+  }
+
+  auto entries() const -> std::span<const entry> {
+    if (!attached_) {
+      return {};
+    }
+    return {reinterpret_cast<const entry*>(
+                address(entry_ofs(pheader().active, 0))),
+            size()};
+  }
+
+  // Call fn on the entries of ino, in order, without scanning the others.
+  template <typename Fn>
+  auto for_each_entry(ino_t ino, Fn&& fn) const -> void {
+    auto it = positions_.find(static_cast<uint64_t>(ino));
+    if (it == positions_.end()) {
+      return;
+    }
+    auto all = entries();
+    for (auto i : it->second) {
+      fn(all[i]);
+    }
+  }
+
+  // Number of syncs of ino recorded in the index.
+  auto sync_count(ino_t ino) -> uint64_t {
+    if (auto it = sync_counts_.find(ino); it != sync_counts_.end()) {
+      return it->second;
+    }
+    uint64_t count = 0;
+    for_each_entry(ino, [&](const entry& e) {
+      if (e.kind == entry::entry_kind::sync) {
+        count = e.begin + 1;
+      } else if (e.kind == entry::entry_kind::unlink) {
+        count = 0;
+      }
+    });
+    sync_counts_[ino] = count;
+    return count;
+  }
+
+  // Replay the entries of ino. Extents written after its last sync are added
+  // to unsynced, earlier ones are appended to synced.
+  auto restore(ino_t ino,
+               int client_id,
+               extent_tree& unsynced,
+               std::vector<restored_node>& synced) const -> void {
+    for_each_entry(ino, [&](const entry& e) {
+      switch (e.kind) {
+        case entry::entry_kind::extent:
+          unsynced.add(e.begin, e.end, e.ptr, client_id);
+          break;
+        case entry::entry_kind::sync:
+          for (const auto& node : unsynced) {
+            synced.push_back({e.begin, node});
+          }
+          unsynced.clear();
+          break;
+        case entry::entry_kind::truncate:
+          unsynced.remove(e.begin, UINT64_MAX);
+          std::erase_if(synced, [&](const auto& r) {
+            return r.node.ex.begin >= e.begin;
+          });
+          for (auto& r : synced) {
+            r.node.ex.end = std::min(r.node.ex.end, e.begin);
+          }
+          break;
+        case entry::entry_kind::unlink:
+          unsynced.clear();
+          synced.clear();
+          break;
+      }
+    });
+  }
+
+ private:
+  auto ensure_initialized() -> void {
+    if (attached_) {
+      return;
+    }
+    auto hdr = header{magic_value, capacity_, 0, {0, 0}};
+    block_.pwrite(std::as_bytes(std::span{&hdr, 1}), ofs_);
+    attached_ = true;
+    sealed_ = 0;
+    positions_.clear();
+  }
+
+  auto push_back(const entry& e) -> void {
+    if (spilled_) {
+      return;
+    }
+    ensure_initialized();
+    if (size() == capacity_) {
+      // Compact only if that frees a quarter of the half, so that an index
+      // that stays nearly full is not compacted on every write. Otherwise
+      // leave the entries as sealed for attach() and spill.
+      auto live = compactor_ ? compactor_() : std::vector<entry>{};
+      if (!compactor_ || live.size() > capacity_ - capacity_ / 4) {
+        spilled_ = true;
+        return;
+      }
+      compact(live);
+    }
+    auto n = size();
+    auto active = pheader().active;
+    block_.pwrite(std::as_bytes(std::span{&e, 1}), entry_ofs(active, n));
+    write_header_field(offsetof(header, count) + active * sizeof(uint64_t),
+                       n + 1);
+    positions_[e.ino].push_back(n);
+  }
+
+  auto compact(std::span<const entry> live) -> void {
+    if (live.size() > capacity_) {
+      return;
+    }
+    auto next = 1 - pheader().active;
+    block_.pwrite(std::as_bytes(live), entry_ofs(next, 0));
+    write_header_field(offsetof(header, count) + next * sizeof(uint64_t),
+                       live.size());
+    write_header_field(offsetof(header, active), next);
+    sealed_ = 0;
+    index_positions();
+  }
+
+  // Look up the positions of the entries of each ino once, so that opening
+  // many files does not scan the whole index for each of them.
+  auto index_positions() -> void {
+    positions_.clear();
+    auto all = entries();
+    for (size_t i = 0; i < all.size(); ++i) {
+      positions_[all[i].ino].push_back(i);
+    }
+  }
+
+  auto write_header_field(size_t field_ofs, uint64_t value) -> void {
+    block_.pwrite(std::as_bytes(std::span{&value, 1}),
+                  ofs_ + static_cast<off_t>(field_ofs));
+  }
+
+  auto write_entry_field(size_t index, size_t field_ofs, uint64_t value)
+      -> void {
+    block_.pwrite(std::as_bytes(std::span{&value, 1}),
+                  entry_ofs(pheader().active, index) +
+                      static_cast<off_t>(field_ofs));
+  }
+
+  auto entry_ofs(uint64_t half, size_t index) const -> off_t {
+    return ofs_ + static_cast<off_t>(sizeof(header) +
+                                     (half * capacity_ + index) * sizeof(entry));
+  }
+
+  auto address(off_t ofs) const -> const std::byte* {
+    return static_cast<const std::byte*>(block_.data()) + ofs;
+  }
+
+  auto pheader() const -> const header& {
+    return *reinterpret_cast<const header*>(address(ofs_));
+  }
+
+  rpm_local_block block_;
+  off_t ofs_;
+  size_t capacity_;
+  bool attached_ = false;
+  bool spilled_ = false;
+  size_t sealed_ = 0;
+  compactor compactor_{};
+  std::unordered_map<ino_t, uint64_t> sync_counts_{};
+  // positions of the entries of each ino in the active half
+  std::unordered_map<uint64_t, std::vector<size_t>> positions_{};
+  std::unordered_set<uint64_t> unlinked_{};  // since the index spilled
+};
+
+}  // namespace peanuts
@@ -43,12 +43,12 @@ class pmem2_error_category : public std::error_category {
   }
 };
 
-auto pmem2_category() -> const std::error_category& {
+inline auto pmem2_category() -> const std::error_category& {
   static pmem2_error_category instance;
   return instance;
 }
 
-auto make_error_code(int ev) -> std::error_code {
+inline auto make_error_code(int ev) -> std::error_code {
   return {ev, pmem2_category()};
 }
 
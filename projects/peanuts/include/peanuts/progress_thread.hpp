@@ -0,0 +1,141 @@
+#pragma once
+
+#include "peanuts/mpi.hpp"
+#include "peanuts/utils/cpu_affinity_manager.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace peanuts {
+
+// A thread that keeps MPI making progress while the application computes,
+// for MPI libraries without asynchronous progress, where the gets issued by
+// pread_noflush() only move once the application calls into MPI again,
+// typically at the flush. Between tasks it polls MPI, and it runs the tasks
+// submitted to it from any thread, such as the asynchronous syncs, reads
+// and stage-outs of bb_handler. Pinned to a core of its own, it takes
+// nothing from the application. MPI must provide MPI_THREAD_MULTIPLE.
+class progress_thread {
+ public:
+  // not started: tasks run on the submitting thread
+  progress_thread() = default;
+  progress_thread(const progress_thread&) = delete;
+  auto operator=(const progress_thread&) -> progress_thread& = delete;
+  ~progress_thread() { stop(); }
+
+  // Start the thread, pinned to cpu unless it is negative. Without a poll
+  // interval it polls MPI continuously; otherwise it sleeps that long
+  // between polls unless a task comes in.
+  auto start(int cpu = -1, std::chrono::microseconds poll_interval = {})
+      -> void {
+    stop();
+    if (mpi::runtime::query_thread_support() < MPI_THREAD_MULTIPLE) {
+      throw std::system_error{
+          ENOTSUP, std::system_category(),
+          "progress_thread::start(): MPI_THREAD_MULTIPLE is not provided"};
+    }
+    MPI_Comm poll_comm;
+    MPI_CHECK_ERROR_CODE(MPI_Comm_dup(MPI_COMM_SELF, &poll_comm));
+    poll_comm_ = mpi::comm{poll_comm, true};
+    poll_interval_ = poll_interval;
+    stop_ = false;
+    thread_ = std::thread{[this, cpu] { run(cpu); }};
+  }
+
+  // Tasks already submitted run first.
+  auto stop() -> void {
+    if (!thread_.joinable()) {
+      return;
+    }
+    {
+      auto lock = std::lock_guard{mutex_};
+      stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+    poll_comm_ = mpi::comm{};
+  }
+
+  auto running() const -> bool { return thread_.joinable(); }
+
+  // Run fn on the thread, in the order of submission.
+  template <typename Fn>
+  auto submit(Fn&& fn) -> std::future<std::invoke_result_t<Fn>> {
+    using result = std::invoke_result_t<Fn>;
+    auto task =
+        std::make_shared<std::packaged_task<result()>>(std::forward<Fn>(fn));
+    auto future = task->get_future();
+    if (!running()) {
+      (*task)();
+      return future;
+    }
+    {
+      auto lock = std::lock_guard{mutex_};
+      tasks_.emplace_back([task] { (*task)(); });
+    }
+    cv_.notify_one();
+    return future;
+  }
+
+ private:
+  auto run(int cpu) -> void {
+    auto affinity = std::unique_ptr<utils::cpu_affinity_manager>{};
+    if (cpu >= 0) {
+      try {
+        affinity = std::make_unique<utils::cpu_affinity_manager>(cpu);
+      } catch (const std::system_error&) {
+        // not allowed to run there; stay where the scheduler puts us
+      }
+    }
+    for (;;) {
+      auto task = std::function<void()>{};
+      {
+        auto lock = std::unique_lock{mutex_};
+        if (tasks_.empty() && poll_interval_.count() != 0) {
+          cv_.wait_for(lock, poll_interval_,
+                       [&] { return stop_ || !tasks_.empty(); });
+        }
+        if (!tasks_.empty()) {
+          task = std::move(tasks_.front());
+          tasks_.pop_front();
+        } else if (stop_) {
+          return;
+        }
+      }
+      if (task) {
+        task();
+        continue;
+      }
+      poll();
+    }
+  }
+
+  // Any call into MPI drives its progress engine; a probe that never
+  // matches is about the cheapest.
+  auto poll() const -> void {
+    int flag = 0;
+    MPI_CHECK_ERROR_CODE(MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG,
+                                    poll_comm_.native(), &flag,
+                                    MPI_STATUS_IGNORE));
+  }
+
+  std::thread thread_{};
+  std::mutex mutex_{};
+  std::condition_variable cv_{};
+  std::deque<std::function<void()>> tasks_{};
+  bool stop_ = false;
+  std::chrono::microseconds poll_interval_{};
+  mpi::comm poll_comm_{};
+};
+
+}  // namespace peanuts
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <cstddef>
+#include <memory>
+
+namespace peanuts::raii {
+
+namespace detail {
+
+class mmap_deleter {
+  size_t size_ = 0;
+
+ public:
+  mmap_deleter() = default;
+  explicit mmap_deleter(size_t size) : size_(size) {}
+  void operator()(std::byte* addr) const { ::munmap(addr, size_); }
+  auto size() const -> size_t { return size_; }
+};
+
+}  // namespace detail
+
+using mapped_region = std::unique_ptr<std::byte, detail::mmap_deleter>;
+
+}  // namespace peanuts::raii
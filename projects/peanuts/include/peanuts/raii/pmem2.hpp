@@ -2,6 +2,8 @@
 
 #include <libpmem2.h>
 
+#include <memory>
+
 namespace peanuts::raii {
 namespace detail {
 
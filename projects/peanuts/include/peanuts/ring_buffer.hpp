@@ -3,7 +3,9 @@
 #include "peanuts/ring_tracker.hpp"
 #include "peanuts/rpm.hpp"
 
+#include <cstring>
 #include <optional>
+#include <span>
 
 namespace peanuts {
 
@@ -124,8 +126,22 @@ class ring_buffer<rpm_local_block>
     return tracker_.tail();
   }
 
+  auto pread(std::span<std::byte> buf, lsn_t lsn) const -> void {
+    if (block_.is_mirrored()) {
+      std::memcpy(buf.data(), block_.mirrored_data() + tracker_.to_ofs(lsn),
+                  buf.size());
+    } else {
+      Base::pread(buf, lsn);
+    }
+  }
+
   auto pwrite(std::span<const std::byte> buf, lsn_t lsn) const -> void {
     auto ofs = tracker_.to_ofs(lsn);
+    if (block_.is_mirrored()) {
+      block_.rpm().mem_ops().memcpy(block_.mirrored_data() + ofs, buf.data(),
+                                    buf.size());
+      return;
+    }
     auto size = tracker_.first_segment_size_ofs(ofs, buf.size());
     if (size == buf.size()) {
       block_.pwrite(buf, ofs);
@@ -134,6 +150,21 @@ class ring_buffer<rpm_local_block>
       block_.pwrite(buf.subspan(size), 0);
     }
   }
+
+  // Returns [lsn, lsn + size) as a single span without copying. A range
+  // crossing the end of the ring is only contiguous if the block is mirrored.
+  auto view(lsn_t lsn, size_t size) const
+      -> std::optional<std::span<const std::byte>> {
+    auto ofs = tracker_.to_ofs(lsn);
+    if (block_.is_mirrored()) {
+      return std::span<const std::byte>{block_.mirrored_data() + ofs, size};
+    }
+    if (tracker_.is_wrapping_ofs(ofs, size)) {
+      return std::nullopt;
+    }
+    return std::span<const std::byte>{
+        static_cast<const std::byte*>(block_.data()) + ofs, size};
+  }
 };
 
 using local_ring_buffer = ring_buffer<rpm_local_block>;
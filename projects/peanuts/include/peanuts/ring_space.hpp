@@ -0,0 +1,337 @@
+#pragma once
+
+#include "peanuts/extent_tree.hpp"
+#include "peanuts/ring_buffer.hpp"
+
+#include <sys/types.h>
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace peanuts {
+
+// Accounts the space of a local ring to the files whose data it holds, so
+// that a file can be capped by a quota and the tail of the ring can move past
+// data that no file refers to any more. Every reservation of a file is kept
+// as a range of lsns until the file is unlinked or none of the bytes in the
+// range is live any more (overwritten or truncated away). The tail moves in
+// ring order and stops at the oldest range still held, so files written and
+// unlinked in turn, such as a rotating set of checkpoints, reuse the space of
+// one another. Dropped reservations go to a map of dead ranges until the tail
+// has moved past them. Readers on other threads pin the data they may still
+// read, which holds the tail back until they let go of it.
+//
+// Other ranks may still read data that is dead here, so the tail never moves
+// beyond the limit that all ranks last agreed on, see bb_store::reclaim().
+// Unless quotas are set, nothing is reclaimed outside of it, and a full ring
+// fails with ENOSPC.
+class ring_space {
+ public:
+  using lsn_t = local_ring_buffer::lsn_t;
+
+  struct stats {
+    size_t ring_size;
+    size_t used;       // between the tail and the head
+    size_t held;       // by files
+    size_t dead;       // released, but not reclaimed yet
+    size_t released;   // in total: unlinked, truncated, overwritten or moved
+    size_t reclaimed;  // in total, by moving the tail
+    size_t compacted;  // in total, copied by bb_store::compact()
+    size_t files;      // holding space
+  };
+
+  // Returns the lsn ranges, sorted, that the data of ino still occupies.
+  using live_ranges_fn = std::function<std::vector<extent>(ino_t)>;
+  // Called with the new tail after space has been reclaimed.
+  using reclaim_fn = std::function<void(lsn_t)>;
+  // Called with the tail that could be reached if pins below it were
+  // released, so that stale pins can be replaced by newer ones.
+  using pinned_fn = std::function<void(lsn_t)>;
+  // The tail does not move beyond the lsn pointed to while this is held.
+  using pin = std::shared_ptr<const lsn_t>;
+
+  explicit ring_space(local_ring_buffer& ring) : ring_{std::ref(ring)} {}
+
+  auto set_live_ranges(live_ranges_fn fn) -> void {
+    live_ranges_ = std::move(fn);
+  }
+  auto set_on_reclaim(reclaim_fn fn) -> void { on_reclaim_ = std::move(fn); }
+  auto set_on_pinned(pinned_fn fn) -> void { on_pinned_ = std::move(fn); }
+
+  // bytes of the ring a file may hold; 0 means no limit
+  auto set_default_quota(size_t bytes) -> void {
+    default_quota_ = bytes;
+    quotas_ = quotas_ || bytes != 0;
+  }
+  auto set_quota(ino_t ino, size_t bytes) -> void {
+    files_[ino].quota = bytes;
+    quotas_ = quotas_ || bytes != 0;
+  }
+  auto quota(ino_t ino) const -> size_t {
+    auto it = files_.find(ino);
+    return it != files_.end() && it->second.quota ? *it->second.quota
+                                                  : default_quota_;
+  }
+
+  // bytes of the ring held by ino, including data that has died since its
+  // reservations were last checked
+  auto usage(ino_t ino) const -> size_t {
+    auto it = files_.find(ino);
+    return it != files_.end() ? it->second.usage : 0;
+  }
+
+  // Make room for size more bytes of ino. Throws EDQUOT if they would take
+  // ino over its quota.
+  auto prepare(ino_t ino, size_t size) -> void {
+    if (auto limit = quota(ino); limit != 0 && usage(ino) + size > limit) {
+      refresh(ino, files_[ino]);
+      if (usage(ino) + size > limit) {
+        throw std::system_error{EDQUOT, std::system_category(),
+                                "ring_space: quota exceeded"};
+      }
+    }
+    make_room(size);
+  }
+
+  // Reclaim what can be reclaimed if the ring has no room for size more
+  // bytes and quotas are set. Returns whether it has now. The reservations
+  // of the files are not checked again, see collect().
+  auto make_room(size_t size) -> bool {
+    if (ring().can_reserve(size)) {
+      return true;
+    }
+    if (quotas_) {
+      reclaim();
+    }
+    return ring().can_reserve(size);
+  }
+
+  // Drop the reservations that hold no live data any more and reclaim.
+  // Returns the bytes freed.
+  auto collect() -> size_t {
+    for (auto& [ino, file] : files_) {
+      refresh(ino, file);
+    }
+    return reclaim();
+  }
+
+  // Same as collect(), for the reservations of ino only, e.g. after it has
+  // been truncated, but only reclaims if quotas are set.
+  auto collect(ino_t ino) -> size_t {
+    if (auto it = files_.find(ino); it != files_.end()) {
+      refresh(ino, it->second);
+    }
+    return quotas_ ? reclaim() : 0;
+  }
+
+  // [begin, begin + size) has been reserved for ino. Reservations of a file
+  // are added in lsn order.
+  auto add(ino_t ino, lsn_t begin, size_t size) -> void {
+    auto& file = files_[ino];
+    assert(file.ranges.empty() || file.ranges.back().end <= begin);
+    file.ranges.emplace_back(begin, begin + size);
+    file.usage += size;
+  }
+
+  // ino no longer refers to anything in the ring
+  auto release(ino_t ino) -> void {
+    auto it = files_.find(ino);
+    if (it == files_.end()) {
+      return;
+    }
+    for (const auto& range : it->second.ranges) {
+      add_dead(range);
+    }
+    released_ += it->second.usage;
+    if (it->second.quota) {
+      it->second.ranges.clear();
+      it->second.usage = 0;
+    } else {
+      files_.erase(it);
+    }
+    if (quotas_) {
+      reclaim();
+    }
+  }
+
+  // The tail does not move beyond lsn, e.g. because a saved state refers to
+  // the data from there on.
+  auto protect(lsn_t lsn) -> void { protected_lsn_ = lsn; }
+
+  // No rank refers to the data before lsn any more, so the tail may move up
+  // to it.
+  auto agree(lsn_t lsn) -> void { agreed_lsn_ = lsn; }
+
+  // Pin lsn. The pin may be released on any thread, even after the ring_space
+  // is gone.
+  auto pin_lsn(lsn_t lsn) -> pin {
+    {
+      auto lock = std::lock_guard{pins_->mutex};
+      pins_->lsns.insert(lsn);
+    }
+    return {new lsn_t{lsn}, [pins = pins_](const lsn_t* p) {
+              {
+                auto lock = std::lock_guard{pins->mutex};
+                pins->lsns.erase(pins->lsns.find(*p));
+              }
+              delete p;
+            }};
+  }
+
+  // the lowest pinned lsn, or the maximum lsn if nothing is pinned
+  auto min_pin() const -> lsn_t {
+    auto lock = std::lock_guard{pins_->mutex};
+    return pins_->lsns.empty() ? std::numeric_limits<lsn_t>::max()
+                               : *pins_->lsns.begin();
+  }
+
+  // lsn of the oldest data still held by a file, or the head
+  auto oldest() const -> lsn_t {
+    auto lsn = ring().head();
+    for (const auto& [ino, file] : files_) {
+      if (!file.ranges.empty()) {
+        lsn = std::min(lsn, file.ranges.front().begin);
+      }
+    }
+    return lsn;
+  }
+
+  // Move the tail to the oldest data still held, up to the agreed limit.
+  // Returns the bytes freed.
+  auto reclaim() -> size_t {
+    if (ring().tail() >= agreed_lsn_) {
+      return 0;
+    }
+    auto tail = std::min({oldest(), protected_lsn_, agreed_lsn_});
+    if (on_pinned_ && min_pin() < tail) {
+      on_pinned_(tail);
+    }
+    tail = std::min(tail, min_pin());
+    if (tail <= ring().tail()) {
+      return 0;
+    }
+    auto freed = tail - ring().tail();
+    ring().consume_unsafe(freed);
+    reclaimed_ += freed;
+    // dead ranges behind the tail are gone
+    while (!dead_.empty() && dead_.begin()->first < tail) {
+      auto node = dead_.extract(dead_.begin());
+      dead_bytes_ -= node.mapped() - node.key();
+      if (node.mapped() > tail) {
+        dead_.emplace(tail, node.mapped());
+        dead_bytes_ += node.mapped() - tail;
+        break;
+      }
+    }
+    if (on_reclaim_) {
+      on_reclaim_(tail);
+    }
+    return freed;
+  }
+
+  // bytes released but not reclaimed yet
+  auto dead_bytes() const -> size_t { return dead_bytes_; }
+
+  // bytes copied by bb_store::compact()
+  auto add_compacted(size_t bytes) -> void { compacted_ += bytes; }
+
+  auto get_stats() const -> stats {
+    auto held = size_t{0};
+    auto files = size_t{0};
+    for (const auto& [ino, file] : files_) {
+      held += file.usage;
+      files += file.ranges.empty() ? 0 : 1;
+    }
+    return {ring().size(), ring().used_capacity(), held,     dead_bytes_,
+            released_,     reclaimed_,             compacted_, files};
+  }
+
+ private:
+  struct pin_set {
+    std::mutex mutex;
+    std::multiset<lsn_t> lsns;
+  };
+
+  struct file_space {
+    std::vector<extent> ranges{};  // reservations, in lsn order
+    size_t usage = 0;
+    std::optional<size_t> quota{};
+  };
+
+  // Drop the reservations of ino none of whose bytes is live.
+  auto refresh(ino_t ino, file_space& file) -> void {
+    if (!live_ranges_ || file.ranges.empty()) {
+      return;
+    }
+    auto live = live_ranges_(ino);
+    auto it = live.begin();
+    auto kept = std::vector<extent>{};
+    auto usage = size_t{0};
+    for (const auto& range : file.ranges) {
+      while (it != live.end() && it->end <= range.begin) {
+        ++it;
+      }
+      if (it != live.end() && it->begin < range.end) {
+        kept.push_back(range);
+        usage += range.size();
+      } else {
+        add_dead(range);
+      }
+    }
+    released_ += file.usage - usage;
+    file.ranges = std::move(kept);
+    file.usage = usage;
+  }
+
+  // Add range to the dead ranges, merging it with its neighbours.
+  auto add_dead(extent range) -> void {
+    if (range.end <= ring().tail()) {
+      return;
+    }
+    range.begin = std::max(range.begin, ring().tail());
+    dead_bytes_ += range.size();
+    auto next = dead_.lower_bound(range.begin);
+    if (next != dead_.begin()) {
+      if (auto prev = std::prev(next); prev->second == range.begin) {
+        range.begin = prev->first;
+        dead_.erase(prev);
+      }
+    }
+    if (next != dead_.end() && next->first == range.end) {
+      range.end = next->second;
+      dead_.erase(next);
+    }
+    dead_.emplace(range.begin, range.end);
+  }
+
+  auto ring() const -> local_ring_buffer& { return ring_.get(); }
+
+  std::reference_wrapper<local_ring_buffer> ring_;
+  std::unordered_map<ino_t, file_space> files_{};
+  std::map<lsn_t, lsn_t> dead_{};  // begin -> end
+  size_t dead_bytes_ = 0;
+  size_t released_ = 0;
+  size_t reclaimed_ = 0;
+  size_t compacted_ = 0;
+  size_t default_quota_ = 0;
+  bool quotas_ = false;  // a quota has been set
+  lsn_t protected_lsn_ = std::numeric_limits<lsn_t>::max();
+  lsn_t agreed_lsn_ = 0;  // see agree()
+  live_ranges_fn live_ranges_{};
+  reclaim_fn on_reclaim_{};
+  pinned_fn on_pinned_{};
+  std::shared_ptr<pin_set> pins_ = std::make_shared<pin_set>();
+};
+
+}  // namespace peanuts
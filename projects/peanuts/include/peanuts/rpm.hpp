@@ -2,13 +2,18 @@
 
 #include "peanuts/mpi/win.hpp"
 #include "peanuts/pmem2.hpp"
+#include "peanuts/raii/mmap.hpp"
 #include "peanuts/topology.hpp"
 #include "peanuts/utils/human_readable.hpp"
 #include "peanuts/utils/power.hpp"
+#include "peanuts/utils/system.hpp"
 
 #include <libpmem2.h>
+#include <sys/mman.h>
 
+#include <algorithm>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <ostream>
 
@@ -55,6 +60,8 @@ class rpm {
 
   auto data() const -> void* { return map_.address(); }
   auto size() const -> size_t { return aligned_size_; }
+  auto fd() const -> int { return device_.fd(); }
+  auto alignment() const -> size_t { return source_.alignment(); }
 
   auto block_data(int intra_rank) const -> void* {
     return static_cast<std::byte*>(data()) + block_disp(intra_rank);
@@ -116,6 +123,59 @@ class rpm {
   size_t aligned_size_ = 0;
 };
 
+// Maps a region of a local rpm block twice back-to-back, so that an access
+// running off the end of the region continues at its beginning in a single
+// contiguous range of virtual memory.
+class rpm_mirrored_view {
+ public:
+  rpm_mirrored_view(const rpm& rpm, off_t disp, size_t size) : size_{size} {
+    map(rpm, disp);
+  }
+
+  rpm_mirrored_view(const rpm_mirrored_view&) = delete;
+  auto operator=(const rpm_mirrored_view&) -> rpm_mirrored_view& = delete;
+  rpm_mirrored_view(rpm_mirrored_view&&) = default;
+  auto operator=(rpm_mirrored_view&&) -> rpm_mirrored_view& = default;
+  ~rpm_mirrored_view() = default;
+
+  auto data() const -> std::byte* { return data_; }
+  auto size() const -> size_t { return size_; }
+
+ private:
+  auto map(const rpm& rpm, off_t disp) -> void {
+    auto alignment = std::max(rpm.alignment(), utils::get_page_size());
+    if (size_ == 0 || size_ % alignment != 0) {
+      throw std::invalid_argument(
+          "rpm_mirrored_view: size must be a multiple of the pmem alignment");
+    }
+
+    // reserve address space for both copies, aligned to the pmem alignment
+    auto reserved_size = 2 * size_ + alignment;
+    auto* reserved = ::mmap(nullptr, reserved_size, PROT_NONE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED) {
+      throw std::system_error(errno, std::system_category(),
+                              "rpm_mirrored_view: failed to reserve memory");
+    }
+    region_ = raii::mapped_region{static_cast<std::byte*>(reserved),
+                                  raii::detail::mmap_deleter{reserved_size}};
+    data_ = utils::round_up_pow2(region_.get(), alignment);
+
+    for (auto* addr : {data_, data_ + size_}) {
+      auto* mapped = ::mmap(addr, size_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_FIXED, rpm.fd(), disp);
+      if (mapped == MAP_FAILED) {
+        throw std::system_error(errno, std::system_category(),
+                                "rpm_mirrored_view: failed to map block");
+      }
+    }
+  }
+
+  size_t size_ = 0;
+  raii::mapped_region region_{};
+  std::byte* data_ = nullptr;
+};
+
 class rpm_local_block {
  public:
   explicit rpm_local_block(const rpm& rpm)
@@ -130,6 +190,14 @@ class rpm_local_block {
   }
   auto size() const -> size_t { return rpm().block_size(); }
 
+  // Map the first `size` bytes of this block a second time right after the
+  // first mapping. Copies of this block share the mirrored view.
+  auto enable_mirror(size_t size) -> void {
+    mirror_ = std::make_shared<const rpm_mirrored_view>(rpm(), disp_, size);
+  }
+  auto is_mirrored() const -> bool { return mirror_ != nullptr; }
+  auto mirrored_data() const -> std::byte* { return mirror_->data(); }
+
   auto pwrite(std::span<const std::byte> buf,
               off_t offset,
               unsigned flags = 0) const -> void {
@@ -153,6 +221,7 @@ class rpm_local_block {
  private:
   std::reference_wrapper<const peanuts::rpm> rpm_ref_;
   off_t disp_ = 0;
+  std::shared_ptr<const rpm_mirrored_view> mirror_{};
 };
 
 class rpm_blocks {
@@ -164,9 +233,17 @@ class rpm_blocks {
 
   auto block_size() const -> size_t { return rpm_ref_.get().block_size(); }
 
+  // Unlike pread_noflush() and flush(), this may be called on several
+  // threads at once: it leaves rank_accessed_ alone.
   void pread(std::span<std::byte> buf, int rank, off_t offset) const {
-    pread_noflush(buf, rank, offset);
-    flush();
+    const auto& info = rank_info_[rank];
+    if (!info.is_local) {
+      rpm_ref_.get().get(buf, info.win_target_rank,
+                         mpi::aint(info.block_disp + offset));
+      rpm_ref_.get().flush(info.win_target_rank);
+    } else {
+      rpm_ref_.get().file_ops().pread(buf, info.block_disp + offset);
+    }
   }
 
   void pread_noflush(std::span<std::byte> buf, int rank, off_t offset) const {
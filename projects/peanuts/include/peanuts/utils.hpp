@@ -1,18 +1,23 @@
 #pragma once
 #include "peanuts/utils/cond_deleter.hpp"
 #include "peanuts/utils/cpu_affinity_manager.hpp"
+#include "peanuts/utils/crc32c.hpp"
 #include "peanuts/utils/delta_encoding.hpp"
 #include "peanuts/utils/enumerate.hpp"
 #include "peanuts/utils/env.hpp"
 #include "peanuts/utils/fs.hpp"
 #include "peanuts/utils/gen_random_string.hpp"
 #include "peanuts/utils/human_readable.hpp"
+#include "peanuts/utils/leaf_search.hpp"
 #include "peanuts/utils/power.hpp"
 #include "peanuts/utils/sense_barrier.hpp"
 #include "peanuts/utils/singleton.hpp"
+#include "peanuts/utils/small_vector.hpp"
 #include "peanuts/utils/stopwatch.hpp"
 #include "peanuts/utils/system.hpp"
+#include "peanuts/utils/thread_pool.hpp"
 #include "peanuts/utils/tls.hpp"
 #include "peanuts/utils/tsc.hpp"
 #include "peanuts/utils/varint_encoding.hpp"
+#include "peanuts/utils/versioned.hpp"
 #include "peanuts/utils/welford.hpp"
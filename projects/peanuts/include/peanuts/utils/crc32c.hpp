@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+namespace peanuts::utils {
+
+namespace detail {
+
+constexpr auto make_crc32c_table() -> std::array<uint32_t, 256> {
+  constexpr uint32_t poly = 0x82f63b78;  // Castagnoli, reflected
+  auto table = std::array<uint32_t, 256>{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; ++j) {
+      crc = (crc >> 1) ^ ((crc & 1) != 0 ? poly : 0);
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+inline constexpr auto crc32c_table = make_crc32c_table();
+
+}  // namespace detail
+
+// CRC-32C of data. Pass the result of a previous call as crc to checksum
+// data that is split into several pieces.
+inline auto crc32c(std::span<const std::byte> data, uint32_t crc = 0)
+    -> uint32_t {
+  crc = ~crc;
+  const auto* p = data.data();
+  auto n = data.size();
+#ifdef __SSE4_2__
+  uint64_t crc64 = crc;
+  for (; n >= sizeof(uint64_t); n -= sizeof(uint64_t), p += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = static_cast<uint32_t>(crc64);
+  for (; n > 0; --n, ++p) {
+    crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*p));
+  }
+#else
+  for (; n > 0; --n, ++p) {
+    crc = detail::crc32c_table[(crc ^ static_cast<uint8_t>(*p)) & 0xff] ^
+          (crc >> 8);
+  }
+#endif
+  return ~crc;
+}
+
+}  // namespace peanuts::utils
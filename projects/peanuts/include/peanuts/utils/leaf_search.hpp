@@ -0,0 +1,69 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace peanuts::utils {
+
+// Number of keys that are less than or equal to key. On sorted keys, this is
+// the index of the first key greater than key. Meant for the short runs of
+// keys at the leaves of a search, where comparing all of them with a few
+// wide compares beats branching on each one.
+inline auto count_less_equal_scalar(std::span<const uint64_t> keys,
+                                    uint64_t key) -> size_t {
+  size_t count = 0;
+  for (auto k : keys) {
+    count += static_cast<size_t>(k <= key);
+  }
+  return count;
+}
+
+// The vector width is chosen at compile time, from -march or -m flags.
+inline auto count_less_equal(std::span<const uint64_t> keys, uint64_t key)
+    -> size_t {
+#if defined(__AVX512F__)
+  // 8 keys per compare; the tail is loaded under a mask
+  const auto k = _mm512_set1_epi64(static_cast<long long>(key));
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 8 <= keys.size(); i += 8) {
+    auto v = _mm512_loadu_si512(keys.data() + i);
+    count += std::popcount(
+        static_cast<unsigned>(_mm512_cmple_epu64_mask(v, k)));
+  }
+  if (i < keys.size()) {
+    auto m = static_cast<__mmask8>((1U << (keys.size() - i)) - 1);
+    auto v = _mm512_maskz_loadu_epi64(m, keys.data() + i);
+    count += std::popcount(
+        static_cast<unsigned>(_mm512_mask_cmple_epu64_mask(m, v, k)));
+  }
+  return count;
+#elif defined(__AVX2__)
+  // 4 keys per compare. AVX2 only compares signed integers, so the sign bits
+  // are flipped to order unsigned ones.
+  const auto sign = _mm256_set1_epi64x(static_cast<long long>(1ULL << 63));
+  const auto k = _mm256_xor_si256(
+      _mm256_set1_epi64x(static_cast<long long>(key)), sign);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 4 <= keys.size(); i += 4) {
+    auto v = _mm256_xor_si256(
+        _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(keys.data() + i)),
+        sign);
+    auto greater = _mm256_movemask_pd(_mm256_castsi256_pd(
+        _mm256_cmpgt_epi64(v, k)));
+    count += 4 - std::popcount(static_cast<unsigned>(greater));
+  }
+  return count + count_less_equal_scalar(keys.subspan(i), key);
+#else
+  return count_less_equal_scalar(keys, key);
+#endif
+}
+
+}  // namespace peanuts::utils
@@ -0,0 +1,80 @@
+#pragma once
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+namespace peanuts::utils {
+
+// A vector of trivially copyable elements that keeps up to N of them inline
+// and spills to the heap only when it grows beyond that. Meant for short
+// lists built and dropped within a call, such as the holes of a read.
+template <typename T, size_t N>
+class small_vector {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+ public:
+  using value_type = T;
+  using iterator = T*;
+  using const_iterator = const T*;
+
+  small_vector() = default;
+  small_vector(const small_vector&) = delete;
+  auto operator=(const small_vector&) -> small_vector& = delete;
+
+  auto push_back(const T& value) -> void {
+    if (size_ == N && heap_.empty()) {
+      heap_.reserve(2 * N);
+      heap_.assign(inline_.begin(), inline_.end());
+    }
+    if (heap_.empty()) {
+      inline_[size_] = value;
+    } else {
+      heap_.push_back(value);
+    }
+    ++size_;
+  }
+
+  auto clear() -> void {
+    heap_.clear();
+    size_ = 0;
+  }
+
+  auto size() const -> size_t { return size_; }
+  auto empty() const -> bool { return size_ == 0; }
+  // whether the elements have spilled to the heap
+  auto spilled() const -> bool { return !heap_.empty(); }
+
+  auto data() -> T* { return heap_.empty() ? inline_.data() : heap_.data(); }
+  auto data() const -> const T* {
+    return heap_.empty() ? inline_.data() : heap_.data();
+  }
+
+  auto begin() -> iterator { return data(); }
+  auto end() -> iterator { return data() + size_; }
+  auto begin() const -> const_iterator { return data(); }
+  auto end() const -> const_iterator { return data() + size_; }
+
+  auto operator[](size_t i) -> T& { return data()[i]; }
+  auto operator[](size_t i) const -> const T& { return data()[i]; }
+
+  auto back() -> T& {
+    assert(size_ != 0);
+    return data()[size_ - 1];
+  }
+  auto back() const -> const T& {
+    assert(size_ != 0);
+    return data()[size_ - 1];
+  }
+
+  operator std::span<const T>() const { return {data(), size_}; }
+
+ private:
+  std::array<T, N> inline_;
+  std::vector<T> heap_{};
+  size_t size_ = 0;
+};
+
+}  // namespace peanuts::utils
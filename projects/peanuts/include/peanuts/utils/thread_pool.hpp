@@ -0,0 +1,241 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "cpu_affinity_manager.hpp"
+#include "tls.hpp"
+
+namespace peanuts::utils {
+
+// A fixed set of worker threads that run tasks. Every worker has a deque of
+// its own: the tasks it spawns go to the back, where it takes its next task
+// from, so that nested work stays hot in its cache, and workers out of work
+// steal the oldest tasks from the front of the others. Tasks submitted from
+// other threads are spread over the deques. Idle workers sleep until the
+// next submission, so a pool costs nothing while the application computes.
+class thread_pool {
+ public:
+  using task = std::function<void()>;
+
+  // The workers are pinned to cpus in turn, if any are given.
+  explicit thread_pool(size_t nworkers, std::vector<int> cpus = {}) {
+    queues_.reserve(nworkers);
+    for (size_t i = 0; i < nworkers; ++i) {
+      queues_.push_back(std::make_unique<queue>());
+    }
+    workers_.reserve(nworkers);
+    for (size_t i = 0; i < nworkers; ++i) {
+      auto cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+      workers_.emplace_back([this, i, cpu] { work(i, cpu); });
+    }
+  }
+  thread_pool(const thread_pool&) = delete;
+  auto operator=(const thread_pool&) -> thread_pool& = delete;
+
+  // Tasks still queued run before the workers stop.
+  ~thread_pool() {
+    stop_.store(true, std::memory_order_seq_cst);
+    signal_.fetch_add(1, std::memory_order_seq_cst);
+    signal_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  auto size() const -> size_t { return workers_.size(); }
+
+  // Queue t; a worker queues it on its own deque. Without workers, t runs
+  // right away.
+  auto submit(task t) -> void {
+    if (workers_.empty()) {
+      t();
+      return;
+    }
+    auto index = worker_index_.get();
+    if (index == no_worker) {
+      index = next_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+    }
+    {
+      auto lock = std::lock_guard{queues_[index]->mutex};
+      queues_[index]->tasks.push_back(std::move(t));
+    }
+    signal_.fetch_add(1, std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_seq_cst) != 0) {
+      signal_.notify_one();
+    }
+  }
+
+  // Run a queued task on the calling thread, if there is one. For threads
+  // that wait for tasks of the pool to finish.
+  auto try_run_one() -> bool {
+    auto t = take(worker_index_.get());
+    if (!t) {
+      return false;
+    }
+    (*t)();
+    return true;
+  }
+
+  // Call fn(i) for every i in [begin, end), in chunks of grain indices that
+  // the workers and the calling thread share. Returns once all are done and
+  // rethrows the first exception of fn, if any.
+  template <typename Fn>
+  auto parallel_for(size_t begin, size_t end, size_t grain, Fn&& fn)
+      -> void;
+
+ private:
+  static constexpr size_t no_worker = static_cast<size_t>(-1);
+
+  struct queue {
+    std::mutex mutex;
+    std::deque<task> tasks;
+  };
+
+  // The newest task of the deque of index, or else the oldest one of
+  // another deque.
+  auto take(size_t index) -> std::optional<task> {
+    if (index != no_worker) {
+      auto& q = *queues_[index];
+      auto lock = std::lock_guard{q.mutex};
+      if (!q.tasks.empty()) {
+        auto t = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        return t;
+      }
+    }
+    auto start = index == no_worker ? 0 : index + 1;
+    for (size_t i = 0; i < queues_.size(); ++i) {
+      auto& q = *queues_[(start + i) % queues_.size()];
+      auto lock = std::lock_guard{q.mutex};
+      if (!q.tasks.empty()) {
+        auto t = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        return t;
+      }
+    }
+    return std::nullopt;
+  }
+
+  auto work(size_t index, int cpu) -> void {
+    auto affinity = std::unique_ptr<cpu_affinity_manager>{};
+    if (cpu >= 0) {
+      try {
+        affinity = std::make_unique<cpu_affinity_manager>(cpu);
+      } catch (const std::system_error&) {
+        // not allowed to run there; stay where the scheduler puts us
+      }
+    }
+    worker_index_.set(index);
+    for (;;) {
+      // stop only once the tasks queued before the stop have been taken
+      auto stopping = stop_.load(std::memory_order_seq_cst);
+      if (auto t = take(index)) {
+        (*t)();
+        continue;
+      }
+      if (stopping) {
+        return;
+      }
+      // A submission after this load changes the signal, so that the wait
+      // returns even if the check below missed the task.
+      sleepers_.fetch_add(1, std::memory_order_seq_cst);
+      auto signal = signal_.load(std::memory_order_seq_cst);
+      auto t = take(index);
+      if (!t && !stop_.load(std::memory_order_seq_cst)) {
+        signal_.wait(signal, std::memory_order_seq_cst);
+      }
+      sleepers_.fetch_sub(1, std::memory_order_seq_cst);
+      if (t) {
+        (*t)();
+      }
+    }
+  }
+
+  std::vector<std::unique_ptr<queue>> queues_{};
+  std::vector<std::thread> workers_{};
+  thread_local_value<size_t> worker_index_{no_worker};
+  std::atomic<size_t> next_{0};  // deque of the next outside submission
+  std::atomic<uint64_t> signal_{0};
+  std::atomic<size_t> sleepers_{0};
+  std::atomic<bool> stop_{false};
+};
+
+// Tasks run on a thread_pool that are waited for together. wait() runs
+// queued tasks of the pool while it waits, so groups may nest in tasks.
+class task_group {
+ public:
+  explicit task_group(thread_pool& pool) : pool_{pool} {}
+  task_group(const task_group&) = delete;
+  auto operator=(const task_group&) -> task_group& = delete;
+  ~task_group() {
+    try {
+      wait();
+    } catch (...) {
+    }
+  }
+
+  template <typename Fn>
+  auto run(Fn&& fn) -> void {
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    pool_.submit([this, fn = std::forward<Fn>(fn)]() mutable {
+      try {
+        fn();
+      } catch (...) {
+        auto lock = std::lock_guard{error_mutex_};
+        if (!error_) {
+          error_ = std::current_exception();
+        }
+      }
+      pending_.fetch_sub(1, std::memory_order_release);
+    });
+  }
+
+  // Rethrows the first exception of the tasks, if any.
+  auto wait() -> void {
+    while (pending_.load(std::memory_order_acquire) != 0) {
+      if (!pool_.try_run_one()) {
+        std::this_thread::yield();
+      }
+    }
+    auto lock = std::lock_guard{error_mutex_};
+    if (error_) {
+      std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+  }
+
+ private:
+  thread_pool& pool_;
+  std::atomic<size_t> pending_{0};
+  std::mutex error_mutex_{};
+  std::exception_ptr error_{};
+};
+
+template <typename Fn>
+auto thread_pool::parallel_for(size_t begin, size_t end, size_t grain, Fn&& fn)
+    -> void {
+  grain = std::max<size_t>(grain, 1);
+  auto group = task_group{*this};
+  for (auto first = begin; first < end; first += grain) {
+    auto last = std::min(end, first + grain);
+    group.run([&fn, first, last] {
+      for (auto i = first; i < last; ++i) {
+        fn(i);
+      }
+    });
+  }
+  group.wait();
+}
+
+}  // namespace peanuts::utils
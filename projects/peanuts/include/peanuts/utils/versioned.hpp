@@ -0,0 +1,42 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace peanuts::utils {
+
+// Immutable versions of a value, published by one writer and read on any
+// thread without locking out the writer. A reader keeps the version it
+// loaded for as long as it holds on to it; an old version is freed once the
+// writer has replaced it and the last reader has let go of it.
+template <typename T>
+class versioned {
+ public:
+  versioned() = default;
+  versioned(const versioned&) = delete;
+  auto operator=(const versioned&) -> versioned& = delete;
+
+  // the latest version, or nullptr if none has been published
+  auto load() const -> std::shared_ptr<const T> {
+    return current_.load(std::memory_order_acquire);
+  }
+
+  // number of versions published so far
+  auto version() const -> uint64_t {
+    return version_.load(std::memory_order_acquire);
+  }
+
+  auto publish(std::shared_ptr<const T> value) -> void {
+    current_.store(std::move(value), std::memory_order_release);
+    version_.fetch_add(1, std::memory_order_acq_rel);
+  }
+
+  // stop publishing; readers keep the versions they hold
+  auto reset() -> void { current_.store(nullptr, std::memory_order_release); }
+
+ private:
+  std::atomic<std::shared_ptr<const T>> current_{};
+  std::atomic<uint64_t> version_{0};
+};
+
+}  // namespace peanuts::utils
@@ -8,6 +8,7 @@
 #include <iostream>
 #include <iterator>
 #include <nlohmann/json.hpp>
+#include <random>
 #include <thread>
 #include <vector>
 
@@ -165,6 +166,7 @@ auto main(int argc, char const* argv[]) -> int {
     ("i,iter", "Number of iterations per thread", cxxopts::value<size_t>()->default_value("100"))
     ("a,add", "do tree.add()")
     ("f,find", "do tree.find()")
+    ("l,lookup", "compare lookup strategies at random offsets")
     ("r,remove", "do tree.remove()")
     ("e,extent_size", "extent size", cxxopts::value<size_t>()->default_value("4096"))
     ("s,stride", "stride", cxxopts::value<size_t>()->default_value("4096"))
@@ -187,6 +189,7 @@ auto main(int argc, char const* argv[]) -> int {
   const auto iter = parsed["iter"].as<size_t>();
   const auto add = parsed.count("add") != 0U;
   const auto find = parsed.count("find") != 0U;
+  const auto lookup = parsed.count("lookup") != 0U;
   const auto remove = parsed.count("remove") != 0U;
   const auto extent_size = parsed["extent_size"].as<size_t>();
   const auto stride = parsed["stride"].as<size_t>();
@@ -207,12 +210,14 @@ auto main(int argc, char const* argv[]) -> int {
       {"window", window},
       {"add", {}},
       {"find", {}},
+      {"lookup", {}},
       {"remove", {}},
   };
 
   std::vector<std::thread> threads;
   std::vector<std::vector<bench_stats>> bench_stats_per_thread(nthreads);
   std::vector<size_t> tree_sizes(nthreads);
+  std::vector<std::vector<uint64_t>> lookup_cycles(nthreads);
   peanuts::utils::sense_barrier barrier(nthreads);
 
   for (size_t tid = 0; tid < nthreads; ++tid) {
@@ -318,6 +323,62 @@ auto main(int argc, char const* argv[]) -> int {
         }
       }
 
+      if (lookup) {
+        // The same random lookups against the tree and against a flat copy
+        // of it, searched with a plain binary search, with leaves scanned
+        // one key at a time and with leaves scanned by SIMD compares.
+        peanuts::flat_extent_index index{tree};
+        auto ends = index.ends();
+        std::mt19937_64 rng(tid);
+        std::uniform_int_distribution<uint64_t> dist(
+            0, tree.size() != 0 ? tree.back().ex.end : 0);
+        std::vector<uint64_t> positions(iter);
+        for (auto& pos : positions) {
+          pos = dist(rng);
+        }
+
+        uint64_t sink = 0;
+        auto measure = [&](auto&& find_one) {
+          barrier.wait();
+          auto t0 = tsc::get();
+          for (auto pos : positions) {
+            sink += find_one(pos);
+          }
+          lookup_cycles[tid].push_back(tsc::get() - t0);
+        };
+        measure([&](uint64_t pos) {
+          auto it = tree.find(pos, pos + 1);
+          return it != tree.end() ? it->ptr : 0;
+        });
+        measure([&](uint64_t pos) {
+          return static_cast<uint64_t>(
+              std::upper_bound(ends.begin(), ends.end(), pos) - ends.begin());
+        });
+        measure([&](uint64_t pos) {
+          return index.upper_bound(pos,
+                                   &peanuts::utils::count_less_equal_scalar);
+        });
+        measure([&](uint64_t pos) { return index.upper_bound(pos); });
+        barrier.wait();
+
+        if (tid == 0) {
+          const char* strategies[] = {"tree", "binary", "scalar_leaf",
+                                      "simd_leaf"};
+          for (size_t i = 0; i < std::size(strategies); ++i) {
+            uint64_t max_cycles = 0;
+            for (auto& cycles : lookup_cycles) {
+              max_cycles = std::max(max_cycles, cycles[i]);
+            }
+            bench_result["lookup"][strategies[i]] = {
+                {"elapsed_cycles", max_cycles},
+                {"cycles_per_op",
+                 static_cast<double>(max_cycles) / std::max<size_t>(1, iter)},
+            };
+          }
+          bench_result["lookup"]["checksum"] = sink;
+        }
+      }
+
       if (remove) {
         peanuts::extent ex(0, extent_size);
         peanuts::utils::welford wf;
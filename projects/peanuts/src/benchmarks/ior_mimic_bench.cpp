@@ -117,12 +117,19 @@ std::ostream& inspect(std::ostream& os, const bench_stats& obj) {
 
 class memory_usage {
  public:
-  static int get_current_rss_kb() {
+  static int get_current_rss_kb() { return get_status_kb("VmRSS:"); }
+
+  // the high water mark, which catches short-lived allocations such as
+  // extent lists and tree nodes freed again before the next sample
+  static int get_peak_rss_kb() { return get_status_kb("VmHWM:"); }
+
+ private:
+  static int get_status_kb(const std::string& field) {
     std::ifstream status_file("/proc/self/status");
     std::string line;
 
     while (std::getline(status_file, line)) {
-      if (line.find("VmRSS:") != std::string::npos) {
+      if (line.find(field) != std::string::npos) {
         std::istringstream iss(line);
         std::string key;
         int value;
@@ -330,6 +337,7 @@ auto main(int argc, char* argv[]) -> int try {
       bench_stats{sw.get(), params.io_count_per_proc() * topo.size(),
                   params.io_size_per_proc * topo.size()};
   memory_json["memory_read"] = memory_usage::get_current_rss_kb();
+  memory_json["memory_peak"] = memory_usage::get_peak_rss_kb();
 
   // output json
   mpi::run_on_rank0([&] {
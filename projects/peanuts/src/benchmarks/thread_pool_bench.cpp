@@ -0,0 +1,163 @@
+#include <fmt/chrono.h>
+#include <fmt/core.h>
+#include <peanuts/version.h>
+
+#include <atomic>
+#include <chrono>
+#include <cxxopts.hpp>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <thread>
+#include <vector>
+
+#include "peanuts.hpp"
+
+using ordered_json = nlohmann::ordered_json;
+
+namespace nlohmann {
+template <>
+struct adl_serializer<peanuts::utils::welford> {
+  static void to_json(ordered_json& j, const peanuts::utils::welford& welford) {
+    j["n"] = welford.n();
+    j["mean"] = welford.mean();
+    j["var"] = welford.var();
+    j["std"] = welford.std();
+  }
+};
+}  // namespace nlohmann
+
+namespace {
+// a task of work iterations that the compiler cannot drop
+auto spin(size_t work, uint64_t seed) -> uint64_t {
+  auto x = seed;
+  for (size_t i = 0; i < work; ++i) {
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+  }
+  return x;
+}
+
+auto fib(peanuts::utils::thread_pool& pool, int n) -> uint64_t {
+  if (n < 16) {
+    return n < 2 ? static_cast<uint64_t>(n) : fib(pool, n - 1) + fib(pool, n - 2);
+  }
+  uint64_t a = 0;
+  peanuts::utils::task_group group{pool};
+  group.run([&] { a = fib(pool, n - 1); });
+  auto b = fib(pool, n - 2);
+  group.wait();
+  return a + b;
+}
+
+// usec per batch over iter batches
+template <typename Batch>
+auto measure(size_t iter, Batch&& batch) -> peanuts::utils::welford {
+  peanuts::utils::welford wf;
+  for (size_t i = 0; i < iter; ++i) {
+    peanuts::utils::stopwatch<double, std::micro> sw;
+    batch();
+    wf.add(sw.get().count());
+  }
+  return wf;
+}
+}  // namespace
+
+auto main(int argc, char const* argv[]) -> int {
+  cxxopts::Options options("thread_pool_bench", "thread_pool benchmark");
+  // clang-format off
+  options.add_options()
+    ("h,help", "Print usage")
+    ("V,version", "Print version")
+    ("prettify", "Prettify output")
+    ("n,nthreads", "number of threads, the calling one included", cxxopts::value<size_t>()->default_value("4"))
+    ("i,iter", "Number of batches", cxxopts::value<size_t>()->default_value("100"))
+    ("t,tasks", "tasks per batch", cxxopts::value<size_t>()->default_value("1024"))
+    ("w,work", "iterations per task", cxxopts::value<size_t>()->default_value("10000"))
+    ("g,grain", "tasks per chunk of parallel_for", cxxopts::value<size_t>()->default_value("16"))
+    ("f,fib", "fib(n) with nested task groups", cxxopts::value<int>()->default_value("30"))
+    ("p,pin", "pin the workers to cpus 1, 2, ...")
+  ;
+  // clang-format on
+
+  auto parsed = options.parse(argc, argv);
+  if (parsed.count("help") != 0U) {
+    fmt::print("{}\n", options.help());
+    return 0;
+  }
+
+  if (parsed.count("version") != 0U) {
+    fmt::print("{}\n", PEANUTS_VERSION);
+    return 0;
+  }
+
+  const auto nthreads = std::max<size_t>(parsed["nthreads"].as<size_t>(), 1);
+  const auto iter = parsed["iter"].as<size_t>();
+  const auto tasks = parsed["tasks"].as<size_t>();
+  const auto work = parsed["work"].as<size_t>();
+  const auto grain = parsed["grain"].as<size_t>();
+  const auto fib_n = parsed["fib"].as<int>();
+
+  auto cpus = std::vector<int>{};
+  if (parsed.count("pin") != 0U) {
+    for (size_t i = 1; i < nthreads; ++i) {
+      cpus.push_back(static_cast<int>(i));
+    }
+  }
+
+  ordered_json bench_result = {
+      {"version", PEANUTS_VERSION},
+      {"timestamp", fmt::format("{:%FT%TZ}", std::chrono::system_clock::now())},
+      {"nthreads", nthreads},
+      {"iter", iter},
+      {"tasks", tasks},
+      {"work", work},
+      {"grain", grain},
+      {"fib", fib_n},
+      {"pin", !cpus.empty()},
+  };
+
+  std::atomic<uint64_t> sink{0};
+
+  // one thread for all tasks
+  bench_result["serial_usec"] = measure(iter, [&] {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < tasks; ++i) {
+      sum += spin(work, i);
+    }
+    sink += sum;
+  });
+
+  // threads started for every batch, with the tasks split evenly
+  bench_result["spawn_usec"] = measure(iter, [&] {
+    std::vector<std::thread> threads;
+    for (size_t tid = 0; tid < nthreads; ++tid) {
+      threads.emplace_back([&, tid] {
+        uint64_t sum = 0;
+        for (size_t i = tid; i < tasks; i += nthreads) {
+          sum += spin(work, i);
+        }
+        sink += sum;
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+  });
+
+  peanuts::utils::thread_pool pool{nthreads - 1, cpus};
+
+  bench_result["parallel_for_usec"] = measure(iter, [&] {
+    pool.parallel_for(0, tasks, grain, [&](size_t i) { sink += spin(work, i); });
+  });
+
+  // recursive tasks that only balance by stealing
+  bench_result["fib_usec"] = measure(iter, [&] { sink += fib(pool, fib_n); });
+
+  bench_result["checksum"] = sink.load();
+
+  if (parsed.count("prettify") != 0U) {
+    std::cout << std::setw(4);
+  }
+  std::cout << bench_result << std::endl;
+
+  return 0;
+}
@@ -14,7 +14,10 @@ using namespace peanuts;
 
 #include <mpi.h>
 
+#include <chrono>
+#include <future>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <fcntl.h>
@@ -194,7 +197,9 @@ TEST_CASE("Testing bb_handler::pwrite and sync methods") {
   REQUIRE(handler != nullptr);
 
   SUBCASE("Write using handler->pwrite") {
-    handler->pwrite(buf, topo.rank() * 1024);
+    // pwrite() is const, as callers such as peanuts_c rely on
+    const auto& const_handler = *handler;
+    const_handler.pwrite(buf, topo.rank() * 1024);
     CHECK(handler->size() == data.size() + topo.rank() * 1024);
     handler->sync();
     CHECK(handler->size() == data.size() + (topo.size() - 1) * 1024);
@@ -209,3 +214,1224 @@ TEST_CASE("Testing bb_handler::pwrite and sync methods") {
 
   ::close(fd);
 }
+
+TEST_CASE("bb_handler delta sync over a sub-communicator") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  auto comm = mpi::comm{mpi::comm::world(), topo.rank() / 2};
+  auto filename =
+      fmt::format("/tmp/bb_delta_sync_test_file{}", topo.rank() / 2);
+  auto comm_rank = comm.rank();
+  auto comm_size = comm.size();
+  auto handler = store.open(std::move(comm), filename, O_RDWR | O_CREAT, 0644);
+
+  std::string buf(3, '\0');
+  if (comm_rank == 0) {
+    handler->pwrite(std::as_bytes(std::span{"old", 3}), 0);
+  }
+  handler->sync_extent();
+  if (comm_rank == comm_size - 1) {
+    handler->pwrite(std::as_bytes(std::span{"new", 3}), 0);
+  }
+  handler->pwrite(std::as_bytes(std::span{"abc", 3}), 16 + 4 * comm_rank);
+  handler->sync_extent();
+  CHECK(handler->sync_epoch() == 3);
+
+  // only the extents written since the first sync were exchanged
+  CHECK(handler->last_delta_size() == (comm_rank == comm_size - 1 ? 2 : 1));
+  handler->pread(std::as_writable_bytes(std::span{buf}), 0);
+  CHECK(std::string_view{"new"} == buf);
+  auto target = (comm_rank + 1) % comm_size;
+  handler->pread(std::as_writable_bytes(std::span{buf}), 16 + 4 * target);
+  CHECK(std::string_view{"abc"} == buf);
+}
+
+TEST_CASE("bb_handler delta sync of writes through another handler") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  const auto filename = "/tmp/bb_delta_sync_handlers_test_file";
+  auto world = store.open(mpi::comm{MPI_COMM_WORLD}, filename,
+                          O_RDWR | O_CREAT | O_TRUNC, 0644);
+  auto sub = store.open(mpi::comm{mpi::comm::world(), topo.rank() / 2},
+                        filename, O_RDWR, 0644);
+
+  // written through the handler on the sub-communicator only
+  auto dat = fmt::format("rank{:04}", topo.rank());
+  sub->pwrite(std::as_bytes(std::span{dat}), dat.size() * topo.rank());
+  world->sync_extent();
+  CHECK(world->last_delta_size() == 1);
+
+  auto target = (topo.rank() + 1) % topo.size();
+  std::string buf(8, '\0');
+  world->pread(std::as_writable_bytes(std::span{buf}), 8 * target);
+  CHECK(buf == fmt::format("rank{:04}", target));
+
+  // synced to every rank already
+  sub->sync_extent();
+  CHECK(sub->last_delta_size() == 0);
+
+  sub.reset();
+  world.reset();
+  store.unlink(filename);
+}
+
+TEST_CASE("bb_store open_many") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  auto files = std::vector<std::string>{};
+  for (int i = 0; i < 5; ++i) {
+    files.push_back(fmt::format("/tmp/bb_open_many_test_file{}", i));
+  }
+  auto dat = fmt::format("rank{:04}", topo.rank());
+
+  auto handlers = store.open_many(mpi::comm{MPI_COMM_WORLD}, files,
+                                  O_RDWR | O_CREAT | O_TRUNC, 0644);
+  REQUIRE(handlers.size() == files.size());
+  for (size_t i = 0; i < files.size(); ++i) {
+    handlers[i]->pwrite(std::as_bytes(std::span{dat}),
+                        dat.size() * (topo.rank() + i));
+  }
+  handlers.clear();
+
+  // the unsynced extents of all files are exchanged when they are reopened,
+  // over a communicator owned by the handlers
+  MPI_Comm dup;
+  MPI_Comm_dup(MPI_COMM_WORLD, &dup);
+  handlers = store.open_many(mpi::comm{dup, true}, files, O_RDWR, 0644);
+  auto target = (topo.rank() + 1) % topo.size();
+  auto expected = fmt::format("rank{:04}", target);
+  for (size_t i = 0; i < files.size(); ++i) {
+    std::string buf(expected.size(), '\0');
+    handlers[i]->pread(std::as_writable_bytes(std::span{buf}),
+                       expected.size() * (target + i));
+    CHECK(expected == buf);
+    CHECK(handlers[i]->size() == dat.size() * (topo.size() + i));
+  }
+
+  // the communicator stays valid until the last handler is closed
+  for (size_t i = 0; i + 1 < files.size(); ++i) {
+    handlers[i].reset();
+  }
+  handlers.back()->sync_extent();
+  CHECK(handlers.back()->sync_epoch() > 0);
+}
+
+TEST_CASE("bb_handler flush_to_file") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  const auto filename = "/tmp/bb_flush_to_file_test_file";
+  auto dat = fmt::format("rank{:04}", topo.rank());
+
+  if (topo.rank() == 0) {
+    auto fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    REQUIRE(fd >= 0);
+    // not written through peanuts, must be kept
+    CHECK(::pwrite(fd, "keep", 4, 1000) == 4);
+    ::close(fd);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, filename, O_RDWR, 0644);
+  handler->pwrite(std::as_bytes(std::span{dat}), dat.size() * topo.rank());
+  handler->pwrite(std::as_bytes(std::span{dat}),
+                  2000 + dat.size() * topo.rank());
+  // with stripes smaller than the written range
+  handler->flush_to_file(16);
+  CHECK(handler->size() == 2000 + dat.size() * topo.size());
+
+  if (topo.rank() == 0) {
+    auto fd = ::open(filename, O_RDONLY);
+    REQUIRE(fd >= 0);
+    std::string buf(dat.size(), '\0');
+    for (int rank = 0; rank < topo.size(); ++rank) {
+      auto expected = fmt::format("rank{:04}", rank);
+      CHECK(::pread(fd, buf.data(), buf.size(), buf.size() * rank) ==
+            static_cast<ssize_t>(buf.size()));
+      CHECK(expected == buf);
+      CHECK(::pread(fd, buf.data(), buf.size(), 2000 + buf.size() * rank) ==
+            static_cast<ssize_t>(buf.size()));
+      CHECK(expected == buf);
+    }
+    CHECK(::pread(fd, buf.data(), 4, 1000) == 4);
+    CHECK(std::string_view{"keep"} == std::string_view{buf}.substr(0, 4));
+    ::close(fd);
+  }
+}
+
+TEST_CASE("bb_handler asynchronous calls") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  store.start_progress_thread(0);
+  const auto filename = "/tmp/bb_async_test_file";
+  auto dat = fmt::format("rank{:04}", topo.rank());
+
+  auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, filename,
+                            O_RDWR | O_CREAT | O_TRUNC, 0644);
+  handler->pwrite(std::as_bytes(std::span{dat}), dat.size() * topo.rank());
+  handler->sync_async().get();
+  handler->publish();
+
+  // reads of the data of all ranks, in flight at once
+  auto bufs = std::vector<std::string>(topo.size(), std::string(8, '\0'));
+  auto reads = std::vector<std::future<ssize_t>>{};
+  for (int rank = 0; rank < topo.size(); ++rank) {
+    reads.push_back(handler->pread_async(
+        std::as_writable_bytes(std::span{bufs[rank]}), dat.size() * rank));
+  }
+  for (int rank = 0; rank < topo.size(); ++rank) {
+    CHECK(reads[rank].get() == static_cast<ssize_t>(dat.size()));
+    CHECK(bufs[rank] == fmt::format("rank{:04}", rank));
+  }
+
+  handler->flush_to_file_async().get();
+  if (topo.rank() == 0) {
+    auto fd = ::open(filename, O_RDONLY);
+    REQUIRE(fd >= 0);
+    std::string buf(dat.size() * topo.size(), '\0');
+    CHECK(::pread(fd, buf.data(), buf.size(), 0) ==
+          static_cast<ssize_t>(buf.size()));
+    for (int rank = 0; rank < topo.size(); ++rank) {
+      CHECK(buf.substr(dat.size() * rank, dat.size()) ==
+            fmt::format("rank{:04}", rank));
+    }
+    ::close(fd);
+  }
+
+  // without the thread, the calls complete right away
+  store.stop_progress_thread();
+  auto f = handler->sync_async();
+  CHECK(f.wait_for(std::chrono::seconds{0}) == std::future_status::ready);
+  f.get();
+  handler.reset();
+  store.unlink(filename);
+}
+
+TEST_CASE("bb_handler stage_in") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  const auto filename = "/tmp/bb_stage_in_test_file";
+  const auto file_size = 1000;
+
+  if (topo.rank() == 0) {
+    auto fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    REQUIRE(fd >= 0);
+    auto content = std::string(file_size, 'f');
+    CHECK(::pwrite(fd, content.data(), content.size(), 0) == file_size);
+    ::close(fd);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, filename, O_RDWR, 0644);
+  // written through peanuts, must not be replaced by the file contents
+  if (topo.rank() == 0) {
+    handler->pwrite(std::as_bytes(std::span{"bb", 2}), 100);
+  }
+  handler->stage_in(0, UINT64_MAX, 64);
+
+  // the file is changed behind peanuts; reads must come from the rings now
+  if (topo.rank() == 0) {
+    auto fd = ::open(filename, O_RDWR | O_TRUNC);
+    REQUIRE(fd >= 0);
+    ::close(fd);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  std::string buf(file_size, '\0');
+  CHECK(handler->pread(std::as_writable_bytes(std::span{buf}), 0) ==
+        file_size);
+  auto expected = std::string(file_size, 'f');
+  expected.replace(100, 2, "bb");
+  CHECK(expected == buf);
+}
+
+TEST_CASE("bb_handler pread_all") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, "/tmp/bb_pread_all_test",
+                            O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  auto dat = fmt::format("rank{:04}", topo.rank());
+  handler->pwrite(std::as_bytes(std::span{dat}), dat.size() * topo.rank());
+  // leave a hole in front of the last extent
+  handler->pwrite(std::as_bytes(std::span{"tail", 4}),
+                  dat.size() * (topo.size() + 1));
+  handler->sync_extent();
+
+  // read the data of the next rank and, on the last one, the hole and tail
+  auto next = (topo.rank() + 1) % topo.size();
+  std::string buf(dat.size() * (topo.size() + 2), 'x');
+  auto ofs = dat.size() * next;
+  auto size = handler->pread_all(
+      std::as_writable_bytes(std::span{buf}.subspan(0, buf.size() - ofs)),
+      ofs);
+  CHECK(size ==
+        static_cast<ssize_t>(dat.size() * (topo.size() + 1) + 4 - ofs));
+  CHECK(buf.substr(0, dat.size()) == fmt::format("rank{:04}", next));
+  auto hole_ofs = dat.size() * topo.size() - ofs;
+  CHECK(buf.substr(hole_ofs, dat.size()) == std::string(dat.size(), '\0'));
+  CHECK(buf.substr(hole_ofs + dat.size(), 4) == "tail");
+}
+
+TEST_CASE("bb_handler pread at and past the end of the file") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  const auto filename = "/tmp/bb_pread_eof_test";
+  const auto file_dat = std::string{"0123456789abcdef"};
+  if (topo.rank() == 0) {
+    auto fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    REQUIRE(fd >= 0);
+    CHECK(::pwrite(fd, file_dat.data(), file_dat.size(), 0) ==
+          static_cast<ssize_t>(file_dat.size()));
+    ::close(fd);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+  auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, filename, O_RDWR, 0644);
+
+  // the file holds data beyond the end of the (empty) trees
+  std::string buf(8, 'x');
+  auto bytes = std::as_writable_bytes(std::span{buf});
+  CHECK(handler->pread(bytes, 8) == 8);
+  CHECK(buf == "89abcdef");
+  CHECK(handler->pread(bytes, 12) == 4);
+  CHECK(buf.substr(0, 4) == "cdef");
+  CHECK(handler->pread(bytes, 16) == 0);
+  CHECK(handler->pread(bytes, 1000) == 0);
+  CHECK(handler->pread_all(bytes, 1000) == 0);
+
+  // past the file, up to the end of the trees
+  auto dat = fmt::format("rank{:04}", topo.rank());
+  handler->pwrite(std::as_bytes(std::span{dat}), 32 + 8 * topo.rank());
+  handler->sync_extent();
+  auto eof = 32 + 8 * topo.size();
+  buf.assign(32, 'x');
+  bytes = std::as_writable_bytes(std::span{buf});
+  CHECK(handler->pread(bytes, 12) == std::min(32, eof - 12));
+  CHECK(buf.substr(0, 4) == "cdef");
+  CHECK(buf.substr(4, 16) == std::string(16, '\0'));
+  CHECK(buf.substr(20, 8) == "rank0000");
+  CHECK(handler->pread(bytes, eof - 4) == 4);
+  CHECK(handler->pread(bytes, eof) == 0);
+  CHECK(handler->pread_all(bytes, eof) == 0);
+
+  handler.reset();
+  store.unlink(filename);
+}
+
+TEST_CASE("bb_handler pread across local, remote and file data") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  const auto filename = "/tmp/bb_pread_mixed_test";
+  const auto file_size = 8 * (topo.size() + 2);
+  if (topo.rank() == 0) {
+    auto fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    REQUIRE(fd >= 0);
+    auto file_dat = std::string(file_size, 'f');
+    CHECK(::pwrite(fd, file_dat.data(), file_dat.size(), 0) ==
+          static_cast<ssize_t>(file_dat.size()));
+    ::close(fd);
+  }
+  topo.comm().barrier();
+  auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, filename, O_RDWR, 0644);
+
+  // the first and the last 8 bytes stay in the file
+  auto dat = std::string(8, static_cast<char>('a' + topo.rank()));
+  handler->pwrite(std::as_bytes(std::span{dat}), 8 * (topo.rank() + 1));
+  handler->sync_extent();
+  // not synced, so only this rank sees it
+  auto next = (topo.rank() + 1) % topo.size();
+  handler->pwrite(std::as_bytes(std::span{"LL", 2}), 8 * (next + 1) + 3);
+
+  auto expected = std::string(8, 'f');
+  for (int r = 0; r < topo.size(); ++r) {
+    expected += std::string(8, static_cast<char>('a' + r));
+  }
+  expected += std::string(8, 'f');
+  expected.replace(8 * (next + 1) + 3, 2, "LL");
+
+  std::string buf(file_size, 'x');
+  CHECK(handler->pread(std::as_writable_bytes(std::span{buf}), 0) ==
+        static_cast<ssize_t>(file_size));
+  CHECK(buf == expected);
+  // a read within a single remote extent
+  buf.assign(4, 'x');
+  handler->pread(std::as_writable_bytes(std::span{buf}), 8 * (next + 1) + 4);
+  CHECK(buf == expected.substr(8 * (next + 1) + 4, 4));
+}
+
+TEST_CASE("bb_handler pwrite_all") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, "/tmp/bb_pwrite_all_test",
+                            O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  // interleaved records; the last one overlaps the next rank's first record
+  const auto nrecords = 4;
+  auto dat = fmt::format("r{:03}", topo.rank());
+  for (int i = 0; i < nrecords; ++i) {
+    auto ofs = dat.size() * (i * topo.size() + topo.rank());
+    auto rec = i == nrecords - 1 ? dat + dat : dat;
+    CHECK(handler->pwrite_all(std::as_bytes(std::span{rec}), ofs) ==
+          static_cast<ssize_t>(rec.size()));
+  }
+  handler->sync_extent();
+
+  // one extent per record round on every node
+  auto& bb = handler->bb_ref();
+  CHECK(bb.global_tree.size() + bb.local_tree.size() <=
+        nrecords * topo.nnodes());
+
+  std::string buf(dat.size() * nrecords * topo.size(), '\0');
+  CHECK(handler->pread(std::as_writable_bytes(std::span{buf}), 0) ==
+        static_cast<ssize_t>(buf.size()));
+  for (int i = 0; i < nrecords; ++i) {
+    for (int rank = 0; rank < topo.size(); ++rank) {
+      auto ofs = dat.size() * (i * topo.size() + rank);
+      CHECK(buf.substr(ofs, dat.size()) == fmt::format("r{:03}", rank));
+    }
+  }
+}
+
+TEST_CASE("bb_handler pwrite_all over earlier writes") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  const auto filename = "/tmp/bb_pwrite_all_over_test";
+  auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, filename,
+                            O_RDWR | O_CREAT | O_TRUNC, 0644);
+  auto ofs = static_cast<off_t>(8 * topo.rank());
+  auto next_ofs = static_cast<off_t>(8 * ((topo.rank() + 1) % topo.size()));
+  std::string buf(8, '\0');
+
+  SUBCASE("unsynced") {
+    handler->pwrite(std::as_bytes(std::span{"old00000", 8}), ofs);
+  }
+  SUBCASE("synced") {
+    handler->pwrite(std::as_bytes(std::span{"old00000", 8}), ofs);
+    handler->sync_extent();
+  }
+
+  handler->pwrite_all(std::as_bytes(std::span{"new00000", 8}), ofs);
+  handler->pread(std::as_writable_bytes(std::span{buf}), ofs);
+  CHECK(std::string_view{"new00000"} == buf);
+
+  handler->sync_extent();
+  handler->pread(std::as_writable_bytes(std::span{buf}), ofs);
+  CHECK(std::string_view{"new00000"} == buf);
+  handler->pread(std::as_writable_bytes(std::span{buf}), next_ofs);
+  CHECK(std::string_view{"new00000"} == buf);
+
+  handler.reset();
+  store.unlink(filename);
+}
+
+TEST_CASE("bb_store ring space") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  auto ring_size = store.local_ring().size();
+
+  SUBCASE("unlinked files release their space") {
+    // a rotating set of two checkpoints, each a quarter of the ring; six of
+    // them do not fit without reusing the space of the unlinked ones
+    auto chunk = std::string(ring_size / 4, '\0');
+    auto path = [](int i) {
+      return fmt::format("/tmp/bb_ring_space_ckpt{}", i);
+    };
+    for (int i = 0; i < 6; ++i) {
+      std::fill(chunk.begin(), chunk.end(), static_cast<char>('a' + i));
+      auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, path(i),
+                                O_RDWR | O_CREAT | O_TRUNC, 0644);
+      handler->pwrite(std::as_bytes(std::span{chunk}),
+                      chunk.size() * topo.rank());
+      handler->sync();
+
+      auto target = (topo.rank() + 1) % topo.size();
+      auto buf = std::string(chunk.size(), '\0');
+      handler->pread(std::as_writable_bytes(std::span{buf}),
+                     chunk.size() * target);
+      CHECK(buf == chunk);
+
+      if (i >= 2) {
+        store.unlink(path(i - 2));
+        store.reclaim();
+        if (topo.rank() == 0) {
+          ::unlink(path(i - 2).c_str());
+        }
+      }
+    }
+    CHECK(store.local_ring().used_capacity() < ring_size);
+    auto stats = store.stats();
+    CHECK(stats.files == 2);
+    CHECK(stats.held <= stats.used);
+    CHECK(stats.released >= 4 * chunk.size());
+    CHECK(stats.reclaimed >= 3 * chunk.size());
+  }
+
+  SUBCASE("truncation releases space right away") {
+    auto third = std::string(ring_size / 3, 's');
+    auto handler =
+        store.open(mpi::comm{MPI_COMM_SELF},
+                   fmt::format("/tmp/bb_ring_space_scratch{}", topo.rank()),
+                   O_RDWR | O_CREAT | O_TRUNC, 0644);
+    handler->pwrite(std::as_bytes(std::span{third}), 0);
+    handler->pwrite(std::as_bytes(std::span{third}), third.size());
+    CHECK(store.stats().held >= 2 * third.size());
+
+    handler->truncate(third.size());
+    auto stats = store.stats();
+    CHECK(stats.held < 2 * third.size());
+    CHECK(stats.released >= third.size());
+    CHECK(stats.dead >= third.size());
+
+    handler->truncate(0);
+    store.reclaim();
+    stats = store.stats();
+    CHECK(stats.used == 0);
+    CHECK(stats.held == 0);
+    CHECK(stats.dead == 0);
+    CHECK(stats.reclaimed >= 2 * third.size());
+  }
+
+  SUBCASE("overwritten and truncated data releases its space") {
+    auto third = std::string(ring_size / 3, 'x');
+    auto handler =
+        store.open(mpi::comm{MPI_COMM_SELF},
+                   fmt::format("/tmp/bb_ring_space_overwrite{}", topo.rank()),
+                   O_RDWR | O_CREAT | O_TRUNC, 0644);
+    for (int i = 0; i < 3; ++i) {
+      store.reclaim();
+      handler->pwrite(std::as_bytes(std::span{third}), 0);
+    }
+    handler->truncate(0);
+    for (int i = 0; i < 3; ++i) {
+      store.reclaim();
+      handler->pwrite(std::as_bytes(std::span{third}), third.size());
+    }
+    CHECK(handler->size() == 2 * third.size());
+  }
+
+  SUBCASE("nothing is reclaimed without reclaim() and quotas") {
+    auto piece = std::string(ring_size * 2 / 5, 'n');
+    auto handler =
+        store.open(mpi::comm{MPI_COMM_SELF},
+                   fmt::format("/tmp/bb_ring_space_noquota{}", topo.rank()),
+                   O_RDWR | O_CREAT | O_TRUNC, 0644);
+    auto error = 0;
+    try {
+      for (int i = 0; i < 3; ++i) {
+        handler->pwrite(std::as_bytes(std::span{piece}), 0);
+      }
+    } catch (const std::system_error& e) {
+      error = e.code().value();
+    }
+    CHECK(error == ENOSPC);
+    CHECK(store.stats().reclaimed == 0);
+  }
+
+  // The sizes below leave room for three pieces in the ring, and for a
+  // fourth one only once the first has been reclaimed. Quotas are set, so
+  // that writes reclaim on their own as far as they may.
+  auto piece = [&](char c) { return std::string(ring_size * 3 / 10, c); };
+  auto piece_size = piece('\0').size();
+  auto write = [](auto& handler, const std::string& dat, size_t ofs) {
+    try {
+      handler->pwrite(std::as_bytes(std::span{dat}), ofs);
+    } catch (const std::system_error& e) {
+      return e.code().value();
+    }
+    return 0;
+  };
+  auto read = [&](auto& handler, size_t ofs) {
+    auto buf = std::string(piece_size, '\0');
+    handler->pread(std::as_writable_bytes(std::span{buf}), ofs);
+    return buf;
+  };
+
+  SUBCASE("other ranks read data overwritten here until it is synced") {
+    store.set_default_quota(2 * ring_size);
+    auto path = std::string{"/tmp/bb_ring_space_overwritten"};
+    auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, path,
+                              O_RDWR | O_CREAT | O_TRUNC, 0644);
+    auto own = piece_size * topo.rank();
+    auto next = (topo.rank() + 1) % topo.size();
+    CHECK(write(handler, piece('a' + topo.rank()), own) == 0);
+    handler->sync();
+
+    // the first piece is dead here, but the next rank still reads it, unless
+    // there is none
+    CHECK(write(handler, piece('A' + topo.rank()), own) == 0);
+    store.reclaim();
+    auto scratch_ofs = piece_size * (topo.size() + 1);
+    CHECK(write(handler, piece('x'), scratch_ofs) == 0);
+    if (topo.size() > 1) {
+      CHECK(write(handler, piece('x'), scratch_ofs) == ENOSPC);
+      CHECK(read(handler, piece_size * next) == piece('a' + next));
+    }
+
+    handler->sync();
+    CHECK(read(handler, piece_size * next) == piece('A' + next));
+    if (topo.size() > 1) {
+      CHECK(store.reclaim() >= piece_size);
+      CHECK(write(handler, piece('x'), scratch_ofs) == 0);
+    }
+
+    handler.reset();
+    store.unlink(path);
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (topo.rank() == 0) {
+      ::unlink(path.c_str());
+    }
+  }
+
+  SUBCASE("other ranks read data unlinked here until they unlink it") {
+    store.set_default_quota(2 * ring_size);
+    auto path = std::string{"/tmp/bb_ring_space_unlinked"};
+    auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, path,
+                              O_RDWR | O_CREAT | O_TRUNC, 0644);
+    CHECK(write(handler, piece('a' + topo.rank()), piece_size * topo.rank()) ==
+          0);
+    handler->sync();
+
+    auto scratch =
+        store.open(mpi::comm{MPI_COMM_SELF},
+                   fmt::format("/tmp/bb_ring_space_unlinked{}", topo.rank()),
+                   O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (topo.rank() == 0) {
+      handler.reset();
+      store.unlink(path);
+    }
+    store.reclaim();
+    if (topo.rank() == 0) {
+      CHECK(write(scratch, piece('x'), 0) == 0);
+      CHECK(write(scratch, piece('x'), piece_size) == 0);
+      // reclaimed only if no other rank has the file open
+      CHECK(write(scratch, piece('x'), 2 * piece_size) ==
+            (topo.size() > 1 ? ENOSPC : 0));
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (topo.rank() != 0) {
+      CHECK(read(handler, 0) == piece('a'));
+      handler.reset();
+      store.unlink(path);
+    }
+
+    store.reclaim();
+    if (topo.rank() == 0) {
+      if (topo.size() > 1) {
+        CHECK(write(scratch, piece('x'), 2 * piece_size) == 0);
+      }
+      ::unlink(path.c_str());
+    }
+    scratch.reset();
+    store.unlink(fmt::format("/tmp/bb_ring_space_unlinked{}", topo.rank()));
+    ::unlink(fmt::format("/tmp/bb_ring_space_unlinked{}", topo.rank()).c_str());
+  }
+
+  SUBCASE("quota") {
+    auto path = fmt::format("/tmp/bb_ring_space_quota{}", topo.rank());
+    auto handler = store.open(mpi::comm{MPI_COMM_SELF}, path,
+                              O_RDWR | O_CREAT | O_TRUNC, 0644);
+    store.set_quota(path, 2500);
+    auto dat = std::string(1000, 'q');
+    // overwriting frees the data it replaces
+    for (int i = 0; i < 10; ++i) {
+      handler->pwrite(std::as_bytes(std::span{dat}), 0);
+    }
+    handler->pwrite(std::as_bytes(std::span{dat}), 1000);
+    auto error = 0;
+    try {
+      handler->pwrite(std::as_bytes(std::span{dat}), 2000);
+    } catch (const std::system_error& e) {
+      error = e.code().value();
+    }
+    CHECK(error == EDQUOT);
+    CHECK(handler->size() == 2000);
+    CHECK(store.space().usage(utils::get_ino(path)) <= 2500);
+  }
+}
+
+TEST_CASE("bb_handler snapshots") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, "/tmp/bb_snapshot_test",
+                            O_RDWR | O_CREAT | O_TRUNC, 0644);
+  CHECK(handler->snapshot() == nullptr);
+
+  // two chunks fit in the ring, a third one only if the first is reclaimed
+  auto chunk = std::string(store.local_ring().size() * 2 / 5,
+                           static_cast<char>('a' + topo.rank()));
+  auto ofs = chunk.size() * topo.rank();
+  handler->pwrite(std::as_bytes(std::span{chunk}), ofs);
+  handler->sync();
+  handler->publish();
+  auto snapshot = handler->snapshot();
+  REQUIRE(snapshot != nullptr);
+
+  // a reader on another thread sees the published data while this thread
+  // overwrites it
+  auto next = (topo.rank() + 1) % topo.size();
+  auto seen = std::string(chunk.size(), '\0');
+  auto reader = std::thread{[&] {
+    for (int i = 0; i < 10; ++i) {
+      handler->pread_snapshot(*snapshot, std::as_writable_bytes(std::span{seen}),
+                              chunk.size() * next);
+    }
+  }};
+  auto overwrite = std::string(chunk.size(), 'X');
+  handler->pwrite(std::as_bytes(std::span{overwrite}), ofs);
+  reader.join();
+  CHECK(seen == std::string(chunk.size(), static_cast<char>('a' + next)));
+
+  // the sync publishes a new snapshot, but the old one still pins the first
+  // chunk
+  handler->sync();
+  CHECK(handler->snapshot() != snapshot);
+  auto buf = std::string(chunk.size(), '\0');
+  handler->pread_snapshot(*handler->snapshot(),
+                          std::as_writable_bytes(std::span{buf}), ofs);
+  CHECK(buf == overwrite);
+  store.reclaim();
+  auto error = 0;
+  try {
+    handler->pwrite(std::as_bytes(std::span{overwrite}), ofs);
+  } catch (const std::system_error& e) {
+    error = e.code().value();
+  }
+  CHECK(error == ENOSPC);
+  handler->pread_snapshot(*snapshot, std::as_writable_bytes(std::span{buf}),
+                          ofs);
+  CHECK(buf == chunk);
+
+  // letting go of it frees the space
+  snapshot.reset();
+  store.reclaim();
+  CHECK(handler->pwrite(std::as_bytes(std::span{overwrite}), ofs) ==
+        static_cast<ssize_t>(overwrite.size()));
+}
+
+TEST_CASE("bb_store global tree limit") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  store.set_global_tree_limit(64, "/tmp");
+  auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, "/tmp/bb_spill_test",
+                            O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  // every rank writes records of its own, interleaved with gaps, so that
+  // none of the extents coalesce
+  const int nrecords = 400;
+  auto record = [&](int rank, int i) {
+    return fmt::format("{:c}{:07d}", 'a' + rank, i);
+  };
+  auto record_ofs = [&](int rank, int i) {
+    return static_cast<off_t>((i * topo.size() + rank) * 16);
+  };
+  for (int i = 0; i < nrecords; ++i) {
+    auto r = record(topo.rank(), i);
+    handler->pwrite(std::as_bytes(std::span{r}), record_ofs(topo.rank(), i));
+  }
+  handler->sync();
+  CHECK(handler->bb_ref().global_tree.size() <= 64);
+  if (topo.size() > 1) {
+    CHECK(handler->bb_ref().global_cold.size() != 0);
+    CHECK(store.spilled_bytes() != 0);
+  }
+  CHECK(handler->size() ==
+        static_cast<size_t>(record_ofs(topo.size() - 1, nrecords - 1) + 8));
+
+  // the spilled extents are paged in by reads, whole or in pieces
+  auto check_all = [&](auto&& read) {
+    auto ok = true;
+    for (int rank = 0; rank < topo.size(); ++rank) {
+      for (int i = 0; i < nrecords; ++i) {
+        auto buf = std::string(8, '\0');
+        read(buf, record_ofs(rank, i));
+        ok = ok && buf == record(rank, i);
+      }
+    }
+    return ok;
+  };
+  CHECK(check_all([&](std::string& buf, off_t ofs) {
+    handler->pread(std::as_writable_bytes(std::span{buf}), ofs);
+  }));
+  CHECK(handler->bb_ref().global_tree.size() <= 64);
+  auto whole = std::string(handler->size(), '\0');
+  handler->pread(std::as_writable_bytes(std::span{whole}), 0);
+  CHECK(check_all([&](std::string& buf, off_t ofs) {
+    buf = whole.substr(ofs, 8);
+  }));
+
+  // snapshots hold the whole tree
+  handler->publish();
+  auto snapshot = handler->snapshot();
+  CHECK(check_all([&](std::string& buf, off_t ofs) {
+    handler->pread_snapshot(*snapshot, std::as_writable_bytes(std::span{buf}),
+                            ofs);
+  }));
+
+  handler->truncate(record_ofs(0, nrecords / 2));
+  CHECK(handler->size() == static_cast<size_t>(record_ofs(0, nrecords / 2)));
+  auto buf = std::string(8, '\0');
+  handler->pread(std::as_writable_bytes(std::span{buf}),
+                 record_ofs(0, nrecords / 2 - 1));
+  CHECK(buf == record(0, nrecords / 2 - 1));
+
+  snapshot.reset();
+  handler.reset();
+  store.unlink("/tmp/bb_spill_test");
+  CHECK(store.spilled_bytes() == 0);
+}
+
+TEST_CASE("bb_store parallel merge") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  store.set_merge_threads(4, {0});
+  auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, "/tmp/bb_merge_test",
+                            O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  // enough records that do not coalesce to merge the deltas in parts
+  const int nrecords = 2048;
+  auto record = [&](char base, int rank, int i) {
+    return fmt::format("{:c}{:07d}", base + rank, i);
+  };
+  auto record_ofs = [&](int rank, int i) {
+    return static_cast<off_t>((i * topo.size() + rank) * 16);
+  };
+  for (int i = 0; i < nrecords; ++i) {
+    auto r = record('a', topo.rank(), i);
+    handler->pwrite(std::as_bytes(std::span{r}),
+                    record_ofs(topo.rank(), i));
+  }
+  handler->sync();
+
+  // then every rank overwrites a third of the records of the next one
+  auto next = (topo.rank() + 1) % topo.size();
+  for (int i = 0; i < nrecords; i += 3) {
+    auto r = record('A', topo.rank(), i);
+    handler->pwrite(std::as_bytes(std::span{r}), record_ofs(next, i));
+  }
+  handler->sync();
+
+  auto whole = std::string(handler->size(), '\0');
+  handler->pread(std::as_writable_bytes(std::span{whole}), 0);
+  auto ok = true;
+  for (int rank = 0; rank < topo.size(); ++rank) {
+    auto prev = (rank + topo.size() - 1) % topo.size();
+    for (int i = 0; i < nrecords; ++i) {
+      auto expected = i % 3 == 0 ? record('A', prev, i) : record('a', rank, i);
+      ok = ok && whole.substr(record_ofs(rank, i), 8) == expected;
+    }
+  }
+  CHECK(ok);
+
+  handler.reset();
+  store.unlink("/tmp/bb_merge_test");
+}
+
+TEST_CASE("bb_store compact") {
+  topology topo{};
+  rpm rpm{std::cref(topo), "/tmp/pmem2_devtest",
+          (2ULL << 20) * topo.intra_size()};
+  auto store = bb_store{rpm};
+  auto ring_size = store.local_ring().size();
+
+  // long-lived data at the tail of every ring, read by the next rank
+  auto shared = store.open(mpi::comm{MPI_COMM_WORLD}, "/tmp/bb_compact_shared",
+                           O_RDWR | O_CREAT | O_TRUNC, 0644);
+  auto piece = std::string(ring_size / 8, static_cast<char>('A' + topo.rank()));
+  shared->pwrite(std::as_bytes(std::span{piece}), piece.size() * topo.rank());
+  shared->sync();
+
+  // a checkpoint overwritten in every step; without compaction its dead
+  // copies pile up behind the shared data
+  auto ckpt = store.open(
+      mpi::comm{MPI_COMM_SELF},
+      fmt::format("/tmp/bb_compact_ckpt{}", topo.rank()),
+      O_RDWR | O_CREAT | O_TRUNC, 0644);
+  auto chunk = std::string(ring_size / 4, '\0');
+  for (int i = 0; i < 12; ++i) {
+    std::fill(chunk.begin(), chunk.end(), static_cast<char>('a' + i));
+    ckpt->pwrite(std::as_bytes(std::span{chunk}), 0);
+    // not synced yet when the data is moved
+    shared->pwrite(std::as_bytes(std::span{chunk}).subspan(0, 8),
+                   piece.size() * topo.size() + 8 * topo.rank());
+    store.compact();
+  }
+  shared->sync();
+
+  auto buf = std::string(chunk.size(), '\0');
+  CHECK(ckpt->pread(std::as_writable_bytes(std::span{buf}), 0) ==
+        static_cast<ssize_t>(buf.size()));
+  CHECK(buf == chunk);
+
+  auto target = (topo.rank() + 1) % topo.size();
+  buf.resize(piece.size());
+  shared->pread(std::as_writable_bytes(std::span{buf}), piece.size() * target);
+  CHECK(buf == std::string(piece.size(), static_cast<char>('A' + target)));
+  buf.resize(8);
+  shared->pread(std::as_writable_bytes(std::span{buf}),
+                piece.size() * topo.size() + 8 * target);
+  CHECK(buf == chunk.substr(0, 8));
+}
+
+#ifdef PEANUTS_USE_LOG_RECORDS
+TEST_CASE("bb_store recover without save") {
+  const char* pmem_path = "/tmp/pmem2_devtest_recover";
+  const char* file_path = "/tmp/bb_recover_testfile";
+  topology topo{};
+  auto dat = fmt::format("rank{:04}", topo.rank());
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, file_path,
+                              O_RDWR | O_CREAT, 0644);
+    handler->pwrite(std::as_bytes(std::span{dat}), dat.size() * topo.rank());
+    handler->pwrite(std::as_bytes(std::span{"overwritten", 11}),
+                    4096 + 16 * topo.rank());
+    handler->pwrite(std::as_bytes(std::span{"new", 3}),
+                    4096 + 16 * topo.rank());
+    // no save(): the job "dies" here
+  }
+
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    store.recover();
+    auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, file_path,
+                              O_RDWR | O_CREAT, 0644);
+    handler->sync();
+
+    // read what the next rank wrote
+    auto target = (topo.rank() + 1) % topo.size();
+    auto expected = fmt::format("rank{:04}", target);
+    std::string buf(expected.size(), '\0');
+    handler->pread(std::as_writable_bytes(std::span{buf}),
+                   expected.size() * target);
+    CHECK(expected == buf);
+    std::string buf2(11, '\0');
+    handler->pread(std::as_writable_bytes(std::span{buf2}), 4096 + 16 * target);
+    CHECK(std::string_view{"newrwritten"} == buf2);
+  }
+}
+
+TEST_CASE("bb_store recover after reclaiming space") {
+  const char* pmem_path = "/tmp/pmem2_devtest_recover";
+  topology topo{};
+  auto path = [&](int i) {
+    return fmt::format("/tmp/bb_recover_reclaim{}_{}", i, topo.rank());
+  };
+  auto chunk = std::string{};
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    chunk.assign(store.local_ring().size() / 3, '\0');
+    // the records of the last file wrap around the ring
+    for (int i = 0; i < 4; ++i) {
+      std::fill(chunk.begin(), chunk.end(), static_cast<char>('a' + i));
+      auto handler = store.open(mpi::comm{MPI_COMM_SELF}, path(i),
+                                O_RDWR | O_CREAT | O_TRUNC, 0644);
+      handler->pwrite(std::as_bytes(std::span{chunk}), 0);
+      if (i >= 1) {
+        store.unlink(path(i - 1));
+        store.reclaim();
+      }
+    }
+  }
+
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    store.recover();
+    auto handler =
+        store.open(mpi::comm{MPI_COMM_SELF}, path(3), O_RDWR | O_CREAT, 0644);
+    auto buf = std::string(chunk.size(), '\0');
+    CHECK(handler->pread(std::as_writable_bytes(std::span{buf}), 0) ==
+          static_cast<ssize_t>(buf.size()));
+    CHECK(buf == chunk);
+  }
+  for (int i = 0; i < 4; ++i) {
+    ::unlink(path(i).c_str());
+  }
+}
+
+TEST_CASE("bb_store recover after compacting overwritten data") {
+  const char* pmem_path = "/tmp/pmem2_devtest_recover";
+  const char* file_path = "/tmp/bb_recover_compact_testfile";
+  topology topo{};
+  auto path = [&](std::string_view name) {
+    return fmt::format("/tmp/bb_recover_compact_{}_{}", name, topo.rank());
+  };
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, file_path,
+                              O_RDWR | O_CREAT | O_TRUNC, 0644);
+    handler->pwrite(std::as_bytes(std::span{"old", 3}), 8 * topo.rank());
+    handler->sync();
+
+    // dead data behind the synced write, so that compact() moves it, then
+    // too much live data to move the overwriting one
+    auto ring_size = store.local_ring().size();
+    for (auto [name, size] : {std::pair{"dead", ring_size / 3},
+                              std::pair{"live", ring_size * 2 / 5}}) {
+      auto chunk = std::string(size, name[0]);
+      auto other = store.open(mpi::comm{MPI_COMM_SELF}, path(name),
+                              O_RDWR | O_CREAT | O_TRUNC, 0644);
+      other->pwrite(std::as_bytes(std::span{chunk}), 0);
+    }
+    store.unlink(path("dead"));
+
+    // the global tree still refers to "old", the local one to "new"
+    handler->pwrite(std::as_bytes(std::span{"new", 3}), 8 * topo.rank());
+    CHECK(store.compact() > 0);
+    // no save(): the job "dies" here
+  }
+
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    store.recover();
+    auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, file_path,
+                              O_RDWR | O_CREAT, 0644);
+    handler->sync();
+
+    for (auto target : {topo.rank(), (topo.rank() + 1) % topo.size()}) {
+      std::string buf(3, '\0');
+      handler->pread(std::as_writable_bytes(std::span{buf}), 8 * target);
+      CHECK(buf == "new");
+    }
+  }
+  ::unlink(path("dead").c_str());
+  ::unlink(path("live").c_str());
+}
+#endif
+
+#ifdef PEANUTS_USE_PERSISTENT_INDEX
+TEST_CASE("bb_store save/load with persistent index") {
+  const char* pmem_path = "/tmp/pmem2_devtest_persistent_index";
+  const char* file_path = "/tmp/bb_persistent_index_testfile";
+  topology topo{};
+  auto dat = fmt::format("rank{:04}", topo.rank());
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, file_path,
+                              O_RDWR | O_CREAT, 0644);
+    // every rank writes the same range, then rank 0 overwrites it
+    handler->pwrite(std::as_bytes(std::span{dat}), 0);
+    handler->sync();
+    if (topo.rank() == 0) {
+      handler->pwrite(std::as_bytes(std::span{"zero0000", 8}), 0);
+    }
+    handler->sync();
+    handler->pwrite(std::as_bytes(std::span{dat}),
+                    64 + dat.size() * topo.rank());
+    handler.reset();
+    store.save();
+
+    // not saved
+    handler = store.open(mpi::comm{MPI_COMM_WORLD}, file_path, O_RDWR, 0644);
+    handler->pwrite(std::as_bytes(std::span{"lost0000", 8}), 0);
+  }
+
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    store.load();
+    auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, file_path,
+                              O_RDWR | O_CREAT, 0644);
+    std::string buf(8, '\0');
+    handler->pread(std::as_writable_bytes(std::span{buf}), 0);
+    CHECK(std::string_view{"zero0000"} == buf);
+
+    auto target = (topo.rank() + 1) % topo.size();
+    auto expected = fmt::format("rank{:04}", target);
+    handler->pread(std::as_writable_bytes(std::span{buf}),
+                   64 + expected.size() * target);
+    CHECK(expected == buf);
+  }
+}
+
+TEST_CASE("bb_store load after compacting overwritten data") {
+  const char* pmem_path = "/tmp/pmem2_devtest_persistent_index";
+  const char* file_path = "/tmp/bb_persistent_index_compact_testfile";
+  topology topo{};
+  auto path = [&](std::string_view name) {
+    return fmt::format("/tmp/bb_persistent_index_{}_{}", name, topo.rank());
+  };
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, file_path,
+                              O_RDWR | O_CREAT | O_TRUNC, 0644);
+    handler->pwrite(std::as_bytes(std::span{"old", 3}), 8 * topo.rank());
+    handler->sync();
+
+    // see "bb_store recover after compacting overwritten data"
+    auto ring_size = store.local_ring().size();
+    for (auto [name, size] : {std::pair{"dead", ring_size / 3},
+                              std::pair{"live", ring_size * 2 / 5}}) {
+      auto chunk = std::string(size, name[0]);
+      auto other = store.open(mpi::comm{MPI_COMM_SELF}, path(name),
+                              O_RDWR | O_CREAT | O_TRUNC, 0644);
+      other->pwrite(std::as_bytes(std::span{chunk}), 0);
+    }
+    store.unlink(path("dead"));
+
+    handler->pwrite(std::as_bytes(std::span{"new", 3}), 8 * topo.rank());
+    CHECK(store.compact() > 0);
+    handler.reset();
+    store.save();
+  }
+
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    store.load();
+    auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, file_path,
+                              O_RDWR | O_CREAT, 0644);
+    for (auto target : {topo.rank(), (topo.rank() + 1) % topo.size()}) {
+      std::string buf(3, '\0');
+      handler->pread(std::as_writable_bytes(std::span{buf}), 8 * target);
+      CHECK(buf == "new");
+    }
+  }
+  ::unlink(path("dead").c_str());
+  ::unlink(path("live").c_str());
+}
+
+TEST_CASE("bb_store persistent index compaction") {
+  const char* pmem_path = "/tmp/pmem2_devtest_persistent_index";
+  const char* file_path = "/tmp/bb_persistent_index_compaction_testfile";
+  topology topo{};
+  const auto nwrites = 10000;
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, file_path,
+                              O_RDWR | O_CREAT, 0644);
+    // non-contiguous overwrites, far more than the index can hold
+    for (int i = 0; i < nwrites; ++i) {
+      auto c = static_cast<char>('a' + i % 26);
+      handler->pwrite(std::as_bytes(std::span{&c, 1}),
+                      4 * topo.rank() + 2 * (i % 2));
+    }
+    handler.reset();
+    store.save();
+  }
+
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    store.load();
+    auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, file_path,
+                              O_RDWR | O_CREAT, 0644);
+    auto target = (topo.rank() + 1) % topo.size();
+    char c;
+    handler->pread(std::as_writable_bytes(std::span{&c, 1}), 4 * target);
+    CHECK(c == 'a' + (nwrites - 2) % 26);
+    handler->pread(std::as_writable_bytes(std::span{&c, 1}), 4 * target + 2);
+    CHECK(c == 'a' + (nwrites - 1) % 26);
+  }
+}
+
+TEST_CASE("bb_store persistent index spill") {
+  const char* pmem_path = "/tmp/pmem2_devtest_persistent_index";
+  const char* small_path = "/tmp/bb_persistent_index_spill_small";
+  const char* large_path = "/tmp/bb_persistent_index_spill_large";
+  topology topo{};
+  auto dat = fmt::format("rank{:04}", topo.rank());
+  // records that do not coalesce, far more than the index can hold
+  const int nrecords = 8192;
+  auto record = [&](int rank, int i) {
+    return fmt::format("{:c}{:07d}", 'a' + rank, i);
+  };
+  auto record_ofs = [&](int rank, int i) {
+    return static_cast<off_t>((i * topo.size() + rank) * 16);
+  };
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, small_path,
+                              O_RDWR | O_CREAT | O_TRUNC, 0644);
+    handler->pwrite(std::as_bytes(std::span{dat}), dat.size() * topo.rank());
+    handler->sync();
+    handler.reset();
+    store.save();
+  }
+
+  // the small file is not opened while the index spills
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    store.load();
+    auto handler = store.open(mpi::comm{MPI_COMM_WORLD}, large_path,
+                              O_RDWR | O_CREAT | O_TRUNC, 0644);
+    for (int i = 0; i < nrecords; ++i) {
+      auto r = record(topo.rank(), i);
+      handler->pwrite(std::as_bytes(std::span{r}), record_ofs(topo.rank(), i));
+      if (i == nrecords / 2) {
+        handler->sync();
+      }
+    }
+    handler->sync();
+    handler.reset();
+    store.save();
+  }
+
+  {
+    rpm rpm{std::cref(topo), pmem_path, (2ULL << 20) * topo.intra_size()};
+    auto store = bb_store{rpm};
+    store.load();
+    auto small = store.open(mpi::comm{MPI_COMM_WORLD}, small_path, O_RDWR,
+                            0644);
+    auto large = store.open(mpi::comm{MPI_COMM_WORLD}, large_path, O_RDWR,
+                            0644);
+    auto target = (topo.rank() + 1) % topo.size();
+    std::string buf(8, '\0');
+    small->pread(std::as_writable_bytes(std::span{buf}), 8 * target);
+    CHECK(buf == fmt::format("rank{:04}", target));
+
+    auto ok = true;
+    for (int i = 0; i < nrecords; ++i) {
+      large->pread(std::as_writable_bytes(std::span{buf}),
+                   record_ofs(target, i));
+      ok = ok && buf == record(target, i);
+    }
+    CHECK(ok);
+    small.reset();
+    large.reset();
+    store.unlink(small_path);
+    store.unlink(large_path);
+  }
+  ::unlink(small_path);
+  ::unlink(large_path);
+}
+#endif
@@ -0,0 +1,26 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+
+#include "peanuts/utils/crc32c.hpp"
+#include <doctest/doctest.h>
+
+#include <string_view>
+
+using namespace peanuts::utils;
+
+TEST_CASE("crc32c check value") {
+  auto data = std::string_view{"123456789"};
+  CHECK(crc32c(std::as_bytes(std::span{data})) == 0xe3069283);
+}
+
+TEST_CASE("crc32c of empty data") {
+  CHECK(crc32c({}) == 0);
+}
+
+TEST_CASE("crc32c over split data") {
+  auto data = std::string_view{"The quick brown fox jumps over the lazy dog"};
+  auto bytes = std::as_bytes(std::span{data});
+  auto whole = crc32c(bytes);
+  for (size_t i = 0; i <= bytes.size(); ++i) {
+    CHECK(crc32c(bytes.subspan(i), crc32c(bytes.subspan(0, i))) == whole);
+  }
+}
@@ -121,4 +121,19 @@ TEST_SUITE("extent_list") {
     extent_list el2{{5, 20}, {35, 45}};
     CHECK(utils::to_string(intersection(el1, el2)) == "[5-10)[15-20)[35-40)");
   }
+
+  TEST_CASE("extent_list on an arena") {
+    extent_list::arena arena;
+    extent_list el{arena.resource()};
+    el.add({0, 10});
+    el.add({20, 30});
+    auto inverse_el = el.inverse({0, 40});
+    CHECK(utils::to_string(inverse_el) == "[10-20)[30-40)");
+    CHECK(utils::to_string(intersection(el, inverse_el)) == "");
+    // more nodes than fit on the arena
+    for (uint64_t i = 0; i < 1000; ++i) {
+      inverse_el.add({100 + 2 * i, 101 + 2 * i});
+    }
+    CHECK(utils::to_string(inverse_el.outer_extent()) == "10-2099");
+  }
 }
@@ -0,0 +1,116 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+
+#include "peanuts/extent_merger.hpp"
+#include <doctest/doctest.h>
+#include "peanuts/inspector.hpp"
+
+#include <memory_resource>
+#include <random>
+#include <vector>
+
+using namespace peanuts;
+
+namespace {
+// n writes of random lengths at random offsets below max_ofs
+auto random_tree(std::mt19937_64& rng,
+                 size_t n,
+                 uint64_t max_ofs,
+                 int client_id,
+                 uint32_t epoch) -> extent_tree {
+  extent_tree tree;
+  auto ofs = std::uniform_int_distribution<uint64_t>{0, max_ofs};
+  auto len = std::uniform_int_distribution<uint64_t>{1, 64};
+  for (size_t i = 0; i < n; ++i) {
+    auto begin = ofs(rng);
+    tree.add(begin, begin + len(rng), rng() % (1ULL << 40), client_id, epoch);
+  }
+  return tree;
+}
+}  // namespace
+
+TEST_CASE("extent_tree::merged_range and replace") {
+  extent_tree tree;
+  tree.add(0, 100, 1000, 0, 1);
+  tree.add(100, 200, 5000, 1, 1);
+  extent_tree delta;
+  delta.add(50, 150, 2050, 2, 2);
+
+  const extent_tree* others[] = {&delta};
+  auto parts = std::vector<extent_tree>{};
+  parts.push_back(tree.merged_range(others, 20, 120));
+  CHECK(utils::to_string(parts[0]) == "[20-50:1020:0][50-120:2050:2]");
+  parts.push_back(tree.merged_range(others, 120, 180));
+  CHECK(utils::to_string(parts[1]) == "[120-150:2120:2][150-180:5050:1]");
+
+  // the cuts at 20, 120 and 180 coalesce again
+  tree.replace(20, 180, parts);
+  auto expected = extent_tree{};
+  expected.add(0, 100, 1000, 0, 1);
+  expected.add(100, 200, 5000, 1, 1);
+  expected.merge(delta);
+  CHECK(tree == expected);
+  CHECK(utils::to_string(tree) ==
+        "[0-50:1000:0][50-150:2050:2][150-200:5050:1]");
+
+  // parts are allocated from the resource given, not from the tree's
+  std::pmr::unsynchronized_pool_resource pool;
+  auto part = tree.merged_range(others, 0, 200, &pool);
+  CHECK(part.nodes_.get_allocator().resource() == &pool);
+  CHECK(part == tree);
+}
+
+TEST_CASE("extent_merger") {
+  std::mt19937_64 rng{42};
+  auto global = random_tree(rng, 20000, 1 << 20, 0, 1);
+  auto deltas = std::vector<extent_tree>{};
+  for (int rank = 0; rank < 8; ++rank) {
+    deltas.push_back(random_tree(rng, 2000, 1 << 20, rank, 2));
+  }
+  // a rank that wrote past the end of the file
+  deltas.push_back(random_tree(rng, 3000, 1 << 18, 8, 2));
+  for (auto& n : deltas.back()) {
+    const_cast<extent_tree::node&>(n).ex.begin += 1 << 21;
+    const_cast<extent_tree::node&>(n).ex.end += 1 << 21;
+  }
+  auto others = std::vector<const extent_tree*>{};
+  for (const auto& delta : deltas) {
+    others.push_back(&delta);
+  }
+
+  auto expected = global;
+  for (const auto* other : others) {
+    expected.merge(*other);
+  }
+
+  for (size_t nthreads : {1, 2, 3, 8}) {
+    extent_merger merger{nthreads, {0}};
+    CHECK(merger.threads() == nthreads);
+    for (int i = 0; i < 3; ++i) {
+      auto tree = global;
+      merger.merge(tree, others);
+      CHECK(tree == expected);
+    }
+  }
+
+  SUBCASE("small merges stay sequential") {
+    extent_merger merger{4};
+    auto tree = global;
+    const extent_tree* small[] = {&deltas[0]};
+    merger.merge(tree, small);
+    auto small_expected = global;
+    small_expected.merge(deltas[0]);
+    CHECK(tree == small_expected);
+  }
+
+  SUBCASE("threads can be changed") {
+    extent_merger merger;
+    CHECK(merger.threads() == 1);
+    merger.set_threads(4);
+    CHECK(merger.threads() == 4);
+    auto tree = global;
+    merger.merge(tree, others);
+    CHECK(tree == expected);
+    merger.set_threads(1);
+    CHECK(merger.threads() == 1);
+  }
+}
@@ -0,0 +1,109 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+
+#include "peanuts/extent_spill.hpp"
+#include <doctest/doctest.h>
+#include "peanuts/inspector.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace peanuts;
+
+namespace {
+// n nodes of 10 bytes, 5 apart, with their data written sequentially and
+// synced over a few epochs
+auto make_tree(uint64_t n) -> extent_tree {
+  extent_tree tree;
+  for (uint64_t i = 0; i < n; ++i) {
+    tree.add(i * 15, i * 15 + 10, 1000 + i * 10, static_cast<int>(i % 2),
+             static_cast<uint32_t>(1 + i / 100));
+  }
+  return tree;
+}
+
+auto all_nodes(const extent_tree& hot, const cold_extents& cold)
+    -> extent_tree {
+  auto all = hot;
+  cold.for_each([&](const auto& node) {
+    all.add(node.ex.begin, node.ex.end, node.ptr, node.client_id,
+            node.epoch);
+  });
+  return all;
+}
+}  // namespace
+
+TEST_CASE("cold_extents") {
+  auto file = std::make_shared<spill_file>("/tmp");
+  auto expected = make_tree(1000);
+  auto hot = make_tree(1000);
+  cold_extents cold;
+
+  SUBCASE("without a limit nothing is spilled") {
+    cold.trim(hot);
+    CHECK(cold.empty());
+    CHECK(hot.size() == 1000);
+  }
+
+  cold.set_limit(hot, 256, file);
+  REQUIRE(!cold.empty());
+  CHECK(hot.size() <= 256);
+  CHECK(hot.size() + cold.size() == 1000);
+  CHECK(file->used() > 0);
+  // gaps, lengths, pointer deltas, clients and epoch deltas take a byte each
+  CHECK(file->used() < cold.size() * 6);
+  CHECK(cold.end_offset() == expected.back().ex.end);
+  CHECK(all_nodes(hot, cold) == expected);
+
+  SUBCASE("page in") {
+    // the runs around a range come back, the others stay spilled
+    cold.page_in(hot, {15 * 500, 15 * 500 + 1});
+    auto it = hot.find(15 * 500, 15 * 500 + 1);
+    REQUIRE(it != hot.end());
+    CHECK(*it == *expected.find(15 * 500, 15 * 500 + 1));
+    CHECK(!cold.empty());
+    CHECK(all_nodes(hot, cold) == expected);
+
+    // trimming spills the end farther away from it
+    cold.trim(hot);
+    CHECK(hot.size() <= 256);
+    CHECK(hot.find(15 * 500, 15 * 500 + 1) != hot.end());
+    CHECK(all_nodes(hot, cold) == expected);
+
+    cold.page_in_all(hot);
+    CHECK(cold.empty());
+    CHECK(hot == expected);
+    CHECK(file->used() == 0);
+  }
+
+  SUBCASE("truncate") {
+    cold.truncate(hot, 15 * 300 + 5);
+    hot.remove(15 * 300 + 5, UINT64_MAX);
+    expected.remove(15 * 300 + 5, UINT64_MAX);
+    CHECK(cold.end_offset() <= 15 * 300 + 5);
+    CHECK(all_nodes(hot, cold) == expected);
+  }
+
+  SUBCASE("transform") {
+    cold.transform([](extent_tree& tree) {
+      for (auto& node : tree.nodes_) {
+        const_cast<extent_tree::node&>(node).ptr += 1;
+      }
+    });
+    for (auto& node : expected.nodes_) {
+      if (hot.find(node.ex) == hot.end()) {
+        const_cast<extent_tree::node&>(node).ptr += 1;
+      }
+    }
+    CHECK(all_nodes(hot, cold) == expected);
+  }
+
+  SUBCASE("another file") {
+    cold.set_limit(hot, 0, nullptr);
+    CHECK(cold.empty());
+    CHECK(hot == expected);
+  }
+
+  cold.clear();
+  CHECK(file->used() == 0);
+}
@@ -4,6 +4,9 @@
 #include <doctest/doctest.h>
 #include "peanuts/inspector.hpp"
 
+#include <algorithm>
+#include <vector>
+
 using namespace peanuts;
 
 TEST_CASE("Test empty extent_tree") {
@@ -90,6 +93,28 @@ TEST_CASE("Test iterator ordering and overwrite") {
   CHECK(result == expected);
 }
 
+TEST_CASE("Test appends") {
+  extent_tree tree;
+  tree.add(0, 10, 100, 1);
+  tree.add(10, 20, 110, 1);
+  tree.add(20, 30, 120, 1);
+  CHECK(utils::to_string(tree) == "[0-30:100:1]");
+
+  // a gap, another ptr or another client start a new node
+  tree.add(40, 50, 140, 1);
+  tree.add(50, 60, 200, 1);
+  tree.add(60, 70, 210, 2);
+  CHECK(utils::to_string(tree) ==
+        "[0-30:100:1][40-50:140:1][50-60:200:1][60-70:210:2]");
+
+  // extended nodes are overwritten as usual
+  tree.add(70, 80, 220, 2);
+  tree.add(5, 75, 500, 3);
+  CHECK(utils::to_string(tree) == "[0-5:100:1][5-75:500:3][75-80:225:2]");
+  tree.add(80, 90, 230, 2);
+  CHECK(utils::to_string(tree) == "[0-5:100:1][5-75:500:3][75-90:225:2]");
+}
+
 TEST_CASE("Test long scenario imported from UnifyFS test code") {
   extent_tree tree;
 
@@ -305,3 +330,120 @@ TEST_CASE("Testing extent_tree::merge") {
   CHECK(tree1.size() == 6);
 
 }
+
+TEST_CASE("extent_tree::merge orders overlapping nodes by epoch") {
+  extent_tree old_sync;
+  old_sync.add(0, 100, 1000, 2, 1);
+  extent_tree new_sync;
+  new_sync.add(50, 150, 2050, 1, 2);
+  new_sync.add(200, 300, 3000, 1, 2);
+  extent_tree same_sync;
+  same_sync.add(250, 350, 4250, 0, 2);
+
+  auto merged = [](std::vector<const extent_tree*> trees) {
+    extent_tree tree;
+    for (const auto* t : trees) {
+      tree.merge(*t);
+    }
+    return tree;
+  };
+  auto expected = merged({&old_sync, &new_sync, &same_sync});
+  CHECK(utils::to_string(expected) ==
+        "[0-50:1000:2][50-150:2050:1][200-300:3000:1][300-350:4300:0]");
+
+  // any order gives the same tree
+  CHECK(merged({&new_sync, &old_sync, &same_sync}) == expected);
+  CHECK(merged({&same_sync, &new_sync, &old_sync}) == expected);
+  CHECK(merged({&same_sync, &old_sync, &new_sync}) == expected);
+
+  // a newer node kept over several older ones
+  extent_tree older;
+  older.add(60, 70, 5060, 3, 1);
+  older.add(80, 90, 6080, 3, 1);
+  older.add(140, 160, 7140, 3, 1);
+  auto kept = expected;
+  kept.merge(older);
+  CHECK(utils::to_string(kept) ==
+        "[0-50:1000:2][50-150:2050:1][150-160:7150:3][200-300:3000:1]"
+        "[300-350:4300:0]");
+
+  // nodes of other epochs do not coalesce
+  extent_tree tree;
+  tree.add(0, 100, 1000, 1, 1);
+  tree.add(100, 200, 1100, 1, 2);
+  CHECK(tree.size() == 2);
+
+  tree.stamp(3);
+  CHECK(std::all_of(tree.begin(), tree.end(),
+                    [](const auto& n) { return n.epoch == 3; }));
+}
+
+TEST_CASE("extent_tree with a memory resource") {
+  std::pmr::unsynchronized_pool_resource pool;
+  extent_tree tree{&pool};
+  tree.add(0, 10, 100, 1);
+  tree.add(20, 30, 200, 1);
+
+  // copies allocate from the same resource
+  auto copy = tree;
+  CHECK(copy.nodes_.get_allocator().resource() == &pool);
+  CHECK(copy == tree);
+
+  extent_tree other;
+  CHECK(other.nodes_.get_allocator().resource() == extent_tree::node_pool());
+  other = tree;
+  CHECK(other.nodes_.get_allocator().resource() == extent_tree::node_pool());
+  CHECK(utils::to_string(other) == "[0-10:100:1][20-30:200:1]");
+}
+
+TEST_CASE("extent_tree::query_sorted") {
+  extent_tree tree;
+  for (uint64_t i = 0; i < 100; ++i) {
+    tree.add(i * 10, i * 10 + 5, 1000 + i * 10, 1);
+  }
+
+  auto query = [&](const auto& queries) {
+    std::string result;
+    tree.query_sorted(queries, [&](const extent& q, const auto& node) {
+      result += utils::to_string(q) + utils::to_string(node);
+    });
+    return result;
+  };
+
+  SUBCASE("matches find for each query") {
+    // close and overlapping queries, a long skip and an empty query, which
+    // overlaps the node it falls in as with find()
+    auto queries = std::vector<extent>{{3, 12}, {8, 22}, {21, 22},
+                                       {500, 503}, {503, 503}, {985, 2000}};
+    std::string expected;
+    for (const auto& q : queries) {
+      for (auto it = tree.find(q); it != tree.end() && it->ex.overlaps(q);
+           ++it) {
+        expected += utils::to_string(q) + utils::to_string(*it);
+      }
+    }
+    CHECK(query(queries) == expected);
+    CHECK(query(queries) ==
+          "3-12[0-5:1000:1]3-12[10-15:1010:1]8-22[10-15:1010:1]"
+          "8-22[20-25:1020:1]21-22[20-25:1020:1]500-503[500-505:1500:1]"
+          "503-503[500-505:1500:1]985-2000[990-995:1990:1]");
+  }
+
+  SUBCASE("queries from another tree") {
+    extent_tree other;
+    other.add(0, 1, 0, 2);
+    other.add(42, 61, 0, 2);
+    CHECK(query(other) ==
+          "0-1[0-5:1000:1]42-61[40-45:1040:1]42-61[50-55:1050:1]"
+          "42-61[60-65:1060:1]");
+  }
+
+  SUBCASE("no queries or no nodes") {
+    CHECK(query(std::vector<extent>{}).empty());
+    extent_tree empty;
+    auto found = false;
+    empty.query_sorted(std::vector<extent>{{0, 100}},
+                       [&](const extent&, const auto&) { found = true; });
+    CHECK_FALSE(found);
+  }
+}
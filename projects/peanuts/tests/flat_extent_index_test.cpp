@@ -0,0 +1,41 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+
+#include "peanuts/flat_extent_index.hpp"
+#include <doctest/doctest.h>
+#include "peanuts/inspector.hpp"
+
+using namespace peanuts;
+
+TEST_CASE("flat_extent_index") {
+  extent_tree tree;
+
+  SUBCASE("empty") {
+    flat_extent_index index{tree};
+    CHECK(index.size() == 0);
+    CHECK(index.find(0, 10) == index.end());
+  }
+
+  SUBCASE("finds what the tree finds") {
+    // enough nodes for several leaves
+    for (uint64_t i = 0; i < 100; ++i) {
+      tree.add(i * 10, i * 10 + 5, 1000 + i * 10, static_cast<int>(i % 3));
+    }
+    flat_extent_index index{tree};
+    CHECK(index.size() == tree.size());
+    CHECK(utils::to_string(index) == utils::to_string(tree));
+    CHECK(index.back() == tree.back());
+
+    for (uint64_t begin = 0; begin < 1010; ++begin) {
+      for (auto end : {begin, begin + 1, begin + 7, begin + 100}) {
+        auto tree_it = tree.find(begin, end);
+        auto it = index.find(begin, end);
+        if (tree_it == tree.end()) {
+          CHECK(it == index.end());
+        } else {
+          REQUIRE(it != index.end());
+          CHECK(*it == *tree_it);
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,30 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+
+#include "peanuts/utils/leaf_search.hpp"
+#include <doctest/doctest.h>
+#include <algorithm>
+#include <vector>
+
+TEST_CASE("count_less_equal") {
+  using namespace peanuts::utils;
+
+  // every length up to a few vectors, so that the tails are covered too
+  for (size_t n = 0; n <= 20; ++n) {
+    auto keys = std::vector<uint64_t>(n);
+    for (size_t i = 0; i < n; ++i) {
+      keys[i] = 10 * (i + 1);
+    }
+    // keys above 2^63 are ordered as unsigned
+    if (n != 0) {
+      keys.back() = UINT64_MAX - 1;
+    }
+
+    for (auto key : {uint64_t{0}, uint64_t{10}, uint64_t{15}, uint64_t{105},
+                     uint64_t{1} << 63, UINT64_MAX - 1, UINT64_MAX}) {
+      auto expected = static_cast<size_t>(
+          std::upper_bound(keys.begin(), keys.end(), key) - keys.begin());
+      CHECK(count_less_equal_scalar(keys, key) == expected);
+      CHECK(count_less_equal(keys, key) == expected);
+    }
+  }
+}
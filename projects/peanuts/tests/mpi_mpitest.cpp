@@ -8,9 +8,12 @@
 using namespace peanuts;
 
 #include <mpi.h>
+#include <cerrno>
+#include <limits>
 #include <mutex>
 #include <numeric>
 #include <span>
+#include <system_error>
 #include <thread>
 
 int main(int argc, char** argv) {
@@ -175,6 +178,117 @@ TEST_CASE("comm::all_gather_v") {
   }
 }
 
+TEST_CASE("comm::all_to_all") {
+  const auto& comm = peanuts::mpi::comm::world();
+
+  SUBCASE("all_to_all") {
+    std::vector<int> send_data(comm.size());
+    for (int rank = 0; rank < comm.size(); ++rank) {
+      send_data[rank] = comm.rank() * comm.size() + rank;
+    }
+    std::vector<int> recv_data(comm.size());
+
+    comm.all_to_all(std::span<const int>{send_data}, std::span{recv_data});
+
+    for (int rank = 0; rank < comm.size(); ++rank) {
+      CHECK(recv_data[rank] == rank * comm.size() + comm.rank());
+    }
+  }
+
+  SUBCASE("all_to_all_v") {
+    // rank r sends r + 1 copies of r to every rank
+    std::vector<int> send_counts(comm.size(), comm.rank() + 1);
+    std::vector<int> send_data(comm.size() * (comm.rank() + 1), comm.rank());
+
+    std::vector<int> recv_counts(comm.size());
+    std::iota(recv_counts.begin(), recv_counts.end(), 1);
+    std::vector<int> recv_data(
+        std::accumulate(recv_counts.begin(), recv_counts.end(), 0));
+
+    comm.all_to_all_v(std::span<const int>{send_data},
+                      std::span<const int>{send_counts}, std::span{recv_data},
+                      std::span<const int>{recv_counts});
+
+    int index = 0;
+    for (int rank = 0; rank < comm.size(); ++rank) {
+      for (int i = 0; i < recv_counts[rank]; ++i) {
+        CHECK(recv_data[index++] == rank);
+      }
+    }
+  }
+}
+
+TEST_CASE("comm::gather") {
+  const auto& comm = peanuts::mpi::comm::world();
+  const int root = comm.size() - 1;
+
+  SUBCASE("gather") {
+    std::vector<int> recv_data(comm.rank() == root ? comm.size() : 0);
+    comm.gather(comm.rank() * 2, std::span{recv_data}, root);
+
+    if (comm.rank() == root) {
+      for (int rank = 0; rank < comm.size(); ++rank) {
+        CHECK(recv_data[rank] == rank * 2);
+      }
+    }
+  }
+
+  SUBCASE("gather_v") {
+    // rank r sends r + 1 copies of r
+    std::vector<int> send_data(comm.rank() + 1, comm.rank());
+    std::vector<int> recv_counts(comm.size());
+    std::iota(recv_counts.begin(), recv_counts.end(), 1);
+    std::vector<int> recv_data(
+        std::accumulate(recv_counts.begin(), recv_counts.end(), 0));
+
+    comm.gather_v(std::span<const int>{send_data}, std::span{recv_data},
+                  std::span<const int>{recv_counts}, root);
+
+    if (comm.rank() == root) {
+      int index = 0;
+      for (int rank = 0; rank < comm.size(); ++rank) {
+        for (int i = 0; i < recv_counts[rank]; ++i) {
+          CHECK(recv_data[index++] == rank);
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("comm::all_reduce") {
+  const auto& comm = peanuts::mpi::comm::world();
+  // rank r contributes r and UINT64_MAX - r
+  std::vector<uint64_t> data{static_cast<uint64_t>(comm.rank()),
+                             UINT64_MAX - comm.rank()};
+  comm.all_reduce(std::span{data}, MPI_MIN);
+  CHECK(data[0] == 0);
+  CHECK(data[1] == UINT64_MAX - (comm.size() - 1));
+}
+
+TEST_CASE("mpi::to_count") {
+  constexpr auto max = std::numeric_limits<int>::max();
+  auto overflows = [](auto&& fn) {
+    try {
+      fn();
+    } catch (const std::system_error& e) {
+      return e.code().value() == EOVERFLOW;
+    }
+    return false;
+  };
+
+  SUBCASE("to_count") {
+    CHECK(mpi::to_count(size_t{max}) == max);
+    CHECK(overflows([&] { mpi::to_count(size_t{max} + 1); }));
+  }
+
+  SUBCASE("to_displs") {
+    auto counts = std::vector<int>{max, 1};
+    CHECK(mpi::to_displs(counts) == std::vector<int>{0, max});
+    counts.push_back(1);
+    CHECK(overflows([&] { mpi::to_displs(counts); }));
+  }
+}
+
 TEST_CASE("win") {
   const auto& comm = mpi::comm::world();
   mpi::win win{comm};
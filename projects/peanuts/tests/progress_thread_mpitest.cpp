@@ -0,0 +1,102 @@
+#define DOCTEST_CONFIG_IMPLEMENT
+#include "doctest/extensions/doctest_mpi.h"
+
+#include "peanuts/mpi.hpp"
+#include "peanuts/progress_thread.hpp"
+using namespace peanuts;
+
+#include <mpi.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+int main(int argc, char** argv) {
+  doctest::mpi_init_thread(argc, argv, MPI_THREAD_MULTIPLE);
+
+  doctest::Context ctx;
+  ctx.setOption("abort-after", 5);
+  ctx.setOption("reporters", "MpiConsoleReporter");
+  ctx.setOption("force-colors", true);
+  ctx.applyCommandLine(argc, argv);
+
+  int test_result = ctx.run();
+
+  doctest::mpi_finalize();
+
+  return test_result;
+}
+
+TEST_CASE("progress_thread") {
+  progress_thread progress;
+
+  SUBCASE("tasks run on the caller until it is started") {
+    CHECK(!progress.running());
+    auto id = progress.submit([] { return std::this_thread::get_id(); });
+    CHECK(id.get() == std::this_thread::get_id());
+  }
+
+  SUBCASE("tasks run in order on the thread") {
+    using namespace std::chrono_literals;
+    for (auto interval : {0us, 100us}) {
+      progress.start(0, interval);
+      CHECK(progress.running());
+      auto order = std::vector<int>{};
+      auto futures = std::vector<std::future<std::thread::id>>{};
+      for (int i = 0; i < 100; ++i) {
+        futures.push_back(progress.submit([&order, i] {
+          order.push_back(i);
+          return std::this_thread::get_id();
+        }));
+      }
+      for (auto& f : futures) {
+        CHECK(f.get() != std::this_thread::get_id());
+      }
+      auto expected = std::vector<int>(100);
+      std::iota(expected.begin(), expected.end(), 0);
+      CHECK(order == expected);
+      progress.stop();
+      CHECK(!progress.running());
+    }
+  }
+
+  SUBCASE("exceptions reach the future") {
+    progress.start();
+    auto f = progress.submit([]() -> int { throw std::runtime_error{"x"}; });
+    CHECK_THROWS_AS(f.get(), std::runtime_error);
+  }
+
+  SUBCASE("queued tasks run before it stops") {
+    progress.start();
+    auto done = std::atomic<int>{0};
+    for (int i = 0; i < 100; ++i) {
+      progress.submit([&] { done.fetch_add(1); });
+    }
+    progress.stop();
+    CHECK(done.load() == 100);
+  }
+
+  SUBCASE("one-sided gets complete while it polls") {
+    progress.start();
+    auto rank = mpi::comm::world().rank();
+    auto size = mpi::comm::world().size();
+    auto local = std::vector<int>(1024, rank);
+    MPI_Win win;
+    MPI_Win_create(local.data(), local.size() * sizeof(int), sizeof(int),
+                   MPI_INFO_NULL, MPI_COMM_WORLD, &win);
+    MPI_Win_lock_all(0, win);
+    auto remote = std::vector<int>(local.size(), -1);
+    auto target = (rank + 1) % size;
+    MPI_Get(remote.data(), static_cast<int>(remote.size()), MPI_INT, target, 0,
+            static_cast<int>(remote.size()), MPI_INT, win);
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    MPI_Win_flush(target, win);
+    CHECK(remote == std::vector<int>(local.size(), target));
+    MPI_Win_unlock_all(win);
+    MPI_Win_free(&win);
+  }
+}
@@ -7,6 +7,7 @@ using namespace peanuts;
 
 #include <mpi.h>
 
+#include <algorithm>
 #include <unordered_set>
 
 int main(int argc, char** argv) {
@@ -110,3 +111,43 @@ TEST_CASE("local_ring_buffer") {
     CHECK(buffer.tail() == buffer.head());
   }
 }
+
+TEST_CASE("mirrored local_ring_buffer") {
+  topology topo{};
+  rpm rpm_instance{topo, "/tmp/pmem2_devtest", (16ULL << 20)};
+  auto block = rpm_local_block{rpm_instance, topo.intra_rank()};
+  block.enable_mirror(rpm_instance.block_size());
+  local_ring_buffer buffer(block, rpm_instance.block_size());
+
+  SUBCASE("pread and pwrite with wraparound") {
+    std::vector<std::byte> write_data(buffer.size() / 2);
+    for (size_t i = 0; i < write_data.size(); ++i) {
+      write_data[i] = static_cast<std::byte>(i);
+    }
+    CHECK(buffer.reserve_nb(buffer.size() * 0.8).has_value());
+    CHECK(buffer.consume_nb(buffer.size() * 0.8).has_value());
+
+    auto write_lsn = buffer.reserve_unsafe(write_data.size());
+    buffer.pwrite(write_data, write_lsn);
+
+    std::vector<std::byte> read_data(write_data.size());
+    buffer.pread(read_data, write_lsn);
+    CHECK(write_data == read_data);
+
+    // the same data through the unmirrored ring
+    auto unmirrored = local_ring_buffer{
+        rpm_local_block{rpm_instance, topo.intra_rank()}, buffer.size()};
+    std::fill(read_data.begin(), read_data.end(), std::byte{0});
+    unmirrored.pread(read_data, write_lsn);
+    CHECK(write_data == read_data);
+  }
+
+  SUBCASE("view across the end of the ring") {
+    auto lsn = buffer.size() - 4;
+    buffer.pwrite(std::as_bytes(std::span{"abcdefgh", 8}), lsn);
+    auto view = buffer.view(lsn, 8);
+    REQUIRE(view.has_value());
+    CHECK(std::equal(view->begin(), view->end(),
+                     std::as_bytes(std::span{"abcdefgh", 8}).begin()));
+  }
+}
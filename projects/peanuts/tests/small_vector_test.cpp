@@ -0,0 +1,35 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+
+#include "peanuts/utils/small_vector.hpp"
+#include <doctest/doctest.h>
+#include <numeric>
+
+TEST_CASE("small_vector") {
+  using namespace peanuts::utils;
+
+  small_vector<int, 4> vec;
+  CHECK(vec.empty());
+  for (int i = 0; i < 4; ++i) {
+    vec.push_back(i);
+  }
+  CHECK(vec.size() == 4);
+  CHECK(!vec.spilled());
+  CHECK(vec.back() == 3);
+
+  // grows beyond the inline capacity
+  for (int i = 4; i < 100; ++i) {
+    vec.push_back(i);
+  }
+  CHECK(vec.spilled());
+  CHECK(vec.size() == 100);
+  CHECK(vec[50] == 50);
+  CHECK(std::accumulate(vec.begin(), vec.end(), 0) == 4950);
+  vec.back() = -1;
+  CHECK(vec[99] == -1);
+
+  vec.clear();
+  CHECK(vec.empty());
+  CHECK(!vec.spilled());
+  vec.push_back(7);
+  CHECK(std::span<const int>{vec}.front() == 7);
+}
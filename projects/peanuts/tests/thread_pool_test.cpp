@@ -0,0 +1,94 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+
+#include "peanuts/utils/thread_pool.hpp"
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <numeric>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace peanuts::utils;
+
+namespace {
+auto fib(thread_pool& pool, int n) -> long {
+  if (n < 12) {
+    return n < 2 ? n : fib(pool, n - 1) + fib(pool, n - 2);
+  }
+  long a = 0;
+  auto group = task_group{pool};
+  group.run([&] { a = fib(pool, n - 1); });
+  auto b = fib(pool, n - 2);
+  group.wait();
+  return a + b;
+}
+}  // namespace
+
+TEST_CASE("thread_pool") {
+  SUBCASE("parallel_for visits every index once") {
+    thread_pool pool{4, {0}};
+    CHECK(pool.size() == 4);
+    auto visits = std::vector<std::atomic<int>>(10000);
+    pool.parallel_for(0, visits.size(), 64,
+                      [&](size_t i) { visits[i].fetch_add(1); });
+    CHECK(std::all_of(visits.begin(), visits.end(),
+                      [](const auto& v) { return v.load() == 1; }));
+
+    // an empty range and a grain of 0
+    pool.parallel_for(5, 5, 1, [&](size_t i) { visits[i].fetch_add(1); });
+    pool.parallel_for(0, 3, 0, [&](size_t i) { visits[i].fetch_add(1); });
+    CHECK(visits[2].load() == 2);
+    CHECK(visits[5].load() == 1);
+  }
+
+  SUBCASE("tasks run on the workers") {
+    thread_pool pool{3};
+    auto ids = std::set<std::thread::id>{};
+    std::mutex mutex;
+    pool.parallel_for(0, 3000, 1, [&](size_t) {
+      auto lock = std::lock_guard{mutex};
+      ids.insert(std::this_thread::get_id());
+    });
+    CHECK(ids.size() >= 1);
+    CHECK(ids.size() <= 4);
+  }
+
+  SUBCASE("task groups nest") {
+    thread_pool pool{4};
+    CHECK(fib(pool, 25) == 75025);
+  }
+
+  SUBCASE("exceptions reach the waiter") {
+    thread_pool pool{2};
+    auto done = std::atomic<int>{0};
+    CHECK_THROWS_AS(pool.parallel_for(0, 100, 1,
+                                      [&](size_t i) {
+                                        if (i == 42) {
+                                          throw std::runtime_error{"42"};
+                                        }
+                                        done.fetch_add(1);
+                                      }),
+                    std::runtime_error);
+    CHECK(done.load() == 99);
+  }
+
+  SUBCASE("without workers tasks run on the caller") {
+    thread_pool pool{0};
+    long sum = 0;
+    pool.parallel_for(0, 100, 7, [&](size_t i) { sum += i; });
+    CHECK(sum == 4950);
+  }
+
+  SUBCASE("queued tasks run before the pool goes away") {
+    auto done = std::atomic<int>{0};
+    {
+      thread_pool pool{2};
+      for (int i = 0; i < 1000; ++i) {
+        pool.submit([&] { done.fetch_add(1); });
+      }
+    }
+    CHECK(done.load() == 1000);
+  }
+}
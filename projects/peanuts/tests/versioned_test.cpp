@@ -0,0 +1,63 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+
+#include "peanuts/utils/versioned.hpp"
+#include <doctest/doctest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST_CASE("versioned") {
+  using namespace peanuts::utils;
+
+  versioned<std::vector<int>> v;
+  CHECK(v.load() == nullptr);
+  CHECK(v.version() == 0);
+
+  v.publish(std::make_shared<const std::vector<int>>(3, 1));
+  auto first = v.load();
+  REQUIRE(first != nullptr);
+  CHECK(v.version() == 1);
+
+  // readers keep the version they hold
+  v.publish(std::make_shared<const std::vector<int>>(5, 2));
+  CHECK(v.version() == 2);
+  CHECK(first->size() == 3);
+  CHECK(v.load()->size() == 5);
+
+  v.reset();
+  CHECK(v.load() == nullptr);
+  CHECK(first->size() == 3);
+}
+
+TEST_CASE("versioned with concurrent readers") {
+  using namespace peanuts::utils;
+
+  // every version holds n copies of n
+  versioned<std::vector<int>> v;
+  v.publish(std::make_shared<const std::vector<int>>(1, 1));
+  std::atomic<bool> done{false};
+  std::atomic<int> torn{0};
+
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&] {
+      while (!done.load()) {
+        auto version = v.load();
+        for (auto n : *version) {
+          if (n != static_cast<int>(version->size())) {
+            ++torn;
+          }
+        }
+      }
+    });
+  }
+  for (int n = 2; n < 1000; ++n) {
+    v.publish(std::make_shared<const std::vector<int>>(n, n));
+  }
+  done = true;
+  for (auto& t : readers) {
+    t.join();
+  }
+  CHECK(torn == 0);
+  CHECK(v.version() == 999);
+}
@@ -27,12 +27,22 @@ peanuts_store_t peanuts_store_create(MPI_Comm comm,
 int peanuts_store_free(peanuts_store_t store);
 int peanuts_store_save(peanuts_store_t store);
 int peanuts_store_load(peanuts_store_t store);
+int peanuts_store_recover(peanuts_store_t store);
 
 peanuts_handler_t peanuts_store_open(peanuts_store_t store,
                                      MPI_Comm comm,
                                      const char* pathname,
                                      int flags,
                                      mode_t mode);
+// Open count files over comm in one round. On success, handlers[i] is the
+// handler of pathnames[i]. comm must not be freed before the handlers.
+int peanuts_store_open_many(peanuts_store_t store,
+                            MPI_Comm comm,
+                            int count,
+                            const char* const pathnames[],
+                            int flags,
+                            mode_t mode,
+                            peanuts_handler_t handlers[]);
 int peanuts_store_unlink(peanuts_store_t store, const char* pathname);
 
 int peanuts_bb_close(peanuts_handler_t handler);
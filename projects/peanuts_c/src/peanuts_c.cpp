@@ -4,8 +4,11 @@
 #include <mpi.h>
 #include <sys/types.h>
 
+#include <cerrno>
 #include <cstddef>
 #include <cstdlib>
+#include <string>
+#include <vector>
 
 extern "C" {
 
@@ -51,6 +54,20 @@ int peanuts_store_load(peanuts_store_t store) try {
   return -1;
 }
 
+int peanuts_store_recover(peanuts_store_t store) try {
+#ifdef PEANUTS_USE_LOG_RECORDS
+  auto cpp_store = reinterpret_cast<peanuts::bb_store*>(store->store);
+  cpp_store->recover();
+  return 0;
+#else
+  (void)store;
+  errno = ENOTSUP;
+  return -1;
+#endif
+} catch (...) {
+  return -1;
+}
+
 peanuts_handler_t peanuts_store_open(peanuts_store_t store,
                                      MPI_Comm comm,
                                      const char* pathname,
@@ -67,6 +84,27 @@ peanuts_handler_t peanuts_store_open(peanuts_store_t store,
   return nullptr;
 }
 
+int peanuts_store_open_many(peanuts_store_t store,
+                            MPI_Comm comm,
+                            int count,
+                            const char* const pathnames[],
+                            int flags,
+                            mode_t mode,
+                            peanuts_handler_t handlers[]) try {
+  auto cpp_store = reinterpret_cast<peanuts::bb_store*>(store->store);
+  auto cpp_pathnames = std::vector<std::string>(pathnames, pathnames + count);
+  auto cpp_handlers = cpp_store->open_many(peanuts::mpi::comm{comm, false},
+                                           cpp_pathnames, flags, mode);
+  for (int i = 0; i < count; ++i) {
+    handlers[i] =
+        static_cast<peanuts_handler_t>(std::malloc(sizeof(peanuts_handler)));
+    handlers[i]->handler = cpp_handlers[i].release();
+  }
+  return 0;
+} catch (...) {
+  return -1;
+}
+
 int peanuts_store_unlink(peanuts_store_t store, const char* pathname) try {
   auto cpp_store = reinterpret_cast<peanuts::bb_store*>(store->store);
   cpp_store->unlink(pathname);
@@ -69,6 +69,23 @@ TEST_CASE("peanuts store and handler operations") {
     CHECK(close_result == 0);
   }
 
+  SUBCASE("peanuts open many") {
+    const char* files[] = {"./bb_store_open_many_test_file1",
+                           "./bb_store_open_many_test_file2",
+                           "./bb_store_open_many_test_file3"};
+    peanuts_handler_t handlers[3];
+    int open_result = peanuts_store_open_many(
+        store, MPI_COMM_WORLD, 3, files, O_RDWR | O_CREAT, 0644, handlers);
+    REQUIRE(open_result == 0);
+
+    for (int i = 0; i < 3; ++i) {
+      REQUIRE(handlers[i] != nullptr);
+      ssize_t written = peanuts_bb_pwrite(handlers[i], files[i], 4, 0);
+      CHECK(written == 4);
+      CHECK(peanuts_bb_close(handlers[i]) == 0);
+    }
+  }
+
   int free_result = peanuts_store_free(store);
   CHECK(free_result == 0);
 }
@@ -0,0 +1,720 @@
+#include "preload.hpp"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace peanuts::preload {
+
+namespace {
+
+auto to_open_flags(int amode) -> int {
+  // creation is left to PMPI_File_open(), which checks MPI_MODE_EXCL
+  if ((amode & MPI_MODE_RDONLY) != 0) {
+    return O_RDONLY;
+  } else if ((amode & MPI_MODE_WRONLY) != 0) {
+    return O_WRONLY;
+  }
+  return O_RDWR;
+}
+
+// strip ROMIO-style file system prefixes such as "ufs:"
+auto strip_fs_prefix(const char* filename) -> const char* {
+  auto colon = std::strchr(filename, ':');
+  auto slash = std::strchr(filename, '/');
+  return colon != nullptr && (slash == nullptr || colon < slash) ? colon + 1
+                                                                  : filename;
+}
+
+auto is_contiguous(MPI_Datatype dtype) -> bool {
+  MPI_Count lb, extent, true_lb, true_extent, size;
+  MPI_Type_get_extent_x(dtype, &lb, &extent);
+  MPI_Type_get_true_extent_x(dtype, &true_lb, &true_extent);
+  MPI_Type_size_x(dtype, &size);
+  return lb == 0 && true_lb == 0 && extent == size && true_extent == size;
+}
+
+auto type_size(MPI_Datatype dtype) -> MPI_Offset {
+  MPI_Count size;
+  MPI_Type_size_x(dtype, &size);
+  return size;
+}
+
+auto set_status(MPI_Status* status, ssize_t nbytes) -> void {
+  if (status != MPI_STATUS_IGNORE) {
+    MPI_Status_set_elements_x(status, MPI_BYTE, nbytes);
+    MPI_Status_set_cancelled(status, 0);
+  }
+}
+
+// Calls fn with the mpi_file of fh and returns an MPI error code, or returns
+// nullopt if fh is not ours.
+template <typename Fn>
+auto with_managed_file(MPI_File fh, Fn&& fn, call_kind kind = call_kind::local)
+    -> std::optional<int> {
+  if (!is_active()) {
+    return std::nullopt;
+  }
+  auto file = find_file(state().mpi_files, fh);
+  if (file == nullptr) {
+    return std::nullopt;
+  }
+  try {
+    return call_locked(*file, kind, std::forward<Fn>(fn));
+  } catch (...) {
+    return MPI_ERR_IO;
+  }
+}
+
+// Sets status for nbytes accessed, or fails if the access failed.
+auto complete(ssize_t nbytes, MPI_Status* status) -> int {
+  if (nbytes < 0) {
+    return MPI_ERR_IO;
+  }
+  set_status(status, nbytes);
+  return MPI_SUCCESS;
+}
+
+// Move the individual file pointer past the nbytes just accessed.
+auto advance(mpi_file& f, ssize_t nbytes) -> void {
+  if (nbytes > 0) {
+    f.position += nbytes / f.etype_size;
+  }
+}
+
+// Write count elements of dtype at offset, packing them first if they are
+// not contiguous in memory. Returns the number of bytes written.
+auto write_at(mpi_file& f,
+              MPI_Offset offset,
+              const void* buf,
+              int count,
+              MPI_Datatype dtype,
+              bool collective) -> ssize_t {
+  auto ofs = f.disp + offset * f.etype_size;
+  auto data = std::span<const std::byte>{static_cast<const std::byte*>(buf),
+                                         static_cast<size_t>(count) *
+                                             type_size(dtype)};
+  auto packed = std::vector<std::byte>{};
+  if (count > 0 && !is_contiguous(dtype)) {
+    int size = 0;
+    MPI_Pack_size(count, dtype, MPI_COMM_SELF, &size);
+    packed.resize(size);
+    int position = 0;
+    MPI_Pack(buf, count, dtype, packed.data(), size, &position, MPI_COMM_SELF);
+    data = std::span{packed}.subspan(0, position);
+  }
+
+  auto nbytes = ssize_t{0};
+  if (collective) {
+    nbytes = f.handler->pwrite_all(data, ofs);
+  } else if (!data.empty()) {
+    nbytes = f.handler->pwrite(data, ofs);
+  }
+  return nbytes;
+}
+
+// Read count elements of dtype at offset, unpacking them afterwards if they
+// are not contiguous in memory. Stops at the end of the file. Returns the
+// number of bytes read, or -1.
+auto read_at(mpi_file& f,
+             MPI_Offset offset,
+             void* buf,
+             int count,
+             MPI_Datatype dtype,
+             bool collective) -> ssize_t {
+  auto ofs = static_cast<uint64_t>(f.disp + offset * f.etype_size);
+  auto elem_size = type_size(dtype);
+  auto size = f.handler->size();
+  auto wanted = static_cast<uint64_t>(count * elem_size);
+  wanted = ofs >= size ? 0 : std::min(wanted, size - ofs);
+
+  auto contiguous = is_contiguous(dtype);
+  auto unpacked = std::vector<std::byte>{};
+  auto data = std::span<std::byte>{static_cast<std::byte*>(buf), wanted};
+  if (!contiguous) {
+    unpacked.resize(wanted);
+    data = std::span{unpacked};
+  }
+
+  auto nbytes = ssize_t{0};
+  if (collective) {
+    nbytes = f.handler->pread_all(data, ofs);
+  } else if (!data.empty()) {
+    nbytes = f.handler->pread(data, ofs);
+  }
+  if (nbytes > 0 && !contiguous && elem_size > 0) {
+    int position = 0;
+    MPI_Unpack(unpacked.data(), static_cast<int>(nbytes), &position, buf,
+               static_cast<int>(nbytes / elem_size), dtype, MPI_COMM_SELF);
+  }
+  return nbytes;
+}
+
+// The nonblocking calls are carried out when they are started, and return
+// a generalized request that is already complete.
+auto query_request(void* extra_state, MPI_Status* status) -> int {
+  set_status(status, *static_cast<ssize_t*>(extra_state));
+  status->MPI_SOURCE = MPI_UNDEFINED;
+  status->MPI_TAG = MPI_UNDEFINED;
+  return MPI_SUCCESS;
+}
+
+auto free_request(void* extra_state) -> int {
+  delete static_cast<ssize_t*>(extra_state);
+  return MPI_SUCCESS;
+}
+
+auto cancel_request(void*, int) -> int { return MPI_SUCCESS; }
+
+auto completed_request(ssize_t nbytes, MPI_Request* request) -> int {
+  if (nbytes < 0) {
+    return MPI_ERR_IO;
+  }
+  auto ret = MPI_Grequest_start(query_request, free_request, cancel_request,
+                                new ssize_t{nbytes}, request);
+  return ret != MPI_SUCCESS ? ret : MPI_Grequest_complete(*request);
+}
+
+// Refuses the calls that peanuts does not implement on its files, such as
+// those on the shared file pointer and the split collectives.
+auto unsupported(MPI_File fh) -> std::optional<int> {
+  return with_managed_file(
+      fh, [](mpi_file&) { return MPI_ERR_UNSUPPORTED_OPERATION; });
+}
+
+}  // namespace
+
+}  // namespace peanuts::preload
+
+using namespace peanuts::preload;
+
+extern "C" {
+
+int MPI_File_open(MPI_Comm comm,
+                  const char* filename,
+                  int amode,
+                  MPI_Info info,
+                  MPI_File* fh) {
+  const char* path = filename != nullptr ? strip_fs_prefix(filename) : nullptr;
+  if (!is_managed_path(path)) {
+    return PMPI_File_open(comm, filename, amode, info, fh);
+  }
+
+  auto& s = state();
+  auto scope = passthrough_scope{};
+  // the real file is opened as well, for the calls that are not intercepted
+  auto ret = PMPI_File_open(comm, filename, amode, info, fh);
+  if (ret != MPI_SUCCESS) {
+    return ret;
+  }
+  // MPI lets the application free comm right after the open, so the handler
+  // gets a duplicate of its own
+  MPI_Comm file_comm;
+  if (MPI_Comm_dup(comm, &file_comm) != MPI_SUCCESS) {
+    PMPI_File_close(fh);
+    return MPI_ERR_IO;
+  }
+  try {
+    auto file = std::make_shared<mpi_file>();
+    file->writable = (amode & MPI_MODE_RDONLY) == 0;
+    auto handler_comm = peanuts::mpi::comm{file_comm, true};
+    file->collective = handler_comm.size() > 1;
+    call_locked(*file, call_kind::collective, [&](mpi_file& f) {
+      f.handler = s.store->open(std::move(handler_comm), path,
+                                to_open_flags(amode), 0644);
+      if ((amode & MPI_MODE_APPEND) != 0) {
+        f.position = static_cast<MPI_Offset>(f.handler->size());
+      }
+    });
+    std::lock_guard lock{s.mutex};
+    s.mpi_files[*fh] = std::move(file);
+    return MPI_SUCCESS;
+  } catch (...) {
+    PMPI_File_close(fh);
+    return MPI_ERR_IO;
+  }
+}
+
+int MPI_File_close(MPI_File* fh) {
+  auto ret = with_managed_file(
+      *fh,
+      [](mpi_file& f) {
+        close_handler(*f.handler, f.writable);
+        f.handler.reset();
+        return MPI_SUCCESS;
+      },
+      call_kind::collective);
+  if (ret) {
+    {
+      std::lock_guard lock{state().mutex};
+      state().mpi_files.erase(*fh);
+    }
+    auto scope = passthrough_scope{};
+    auto close_ret = PMPI_File_close(fh);
+    return *ret != MPI_SUCCESS ? *ret : close_ret;
+  }
+  return PMPI_File_close(fh);
+}
+
+int MPI_File_set_view(MPI_File fh,
+                      MPI_Offset disp,
+                      MPI_Datatype etype,
+                      MPI_Datatype filetype,
+                      const char* datarep,
+                      MPI_Info info) {
+  auto ret = with_managed_file(
+      fh,
+      [&](mpi_file& f) {
+        // only views that map offsets linearly onto the file are supported
+        if (!is_contiguous(etype) || !is_contiguous(filetype) ||
+            std::string_view{datarep} != "native") {
+          return MPI_ERR_UNSUPPORTED_OPERATION;
+        }
+        auto view_ret =
+            PMPI_File_set_view(fh, disp, etype, filetype, datarep, info);
+        if (view_ret == MPI_SUCCESS) {
+          f.disp = disp;
+          f.etype_size = type_size(etype);
+          f.position = 0;
+        }
+        return view_ret;
+      },
+      call_kind::collective);
+  return ret ? *ret
+             : PMPI_File_set_view(fh, disp, etype, filetype, datarep, info);
+}
+
+int MPI_File_write_at(MPI_File fh,
+                      MPI_Offset offset,
+                      const void* buf,
+                      int count,
+                      MPI_Datatype datatype,
+                      MPI_Status* status) {
+  auto ret = with_managed_file(fh, [&](mpi_file& f) {
+    return complete(write_at(f, offset, buf, count, datatype, false), status);
+  });
+  return ret ? *ret
+             : PMPI_File_write_at(fh, offset, buf, count, datatype, status);
+}
+
+int MPI_File_write_at_all(MPI_File fh,
+                          MPI_Offset offset,
+                          const void* buf,
+                          int count,
+                          MPI_Datatype datatype,
+                          MPI_Status* status) {
+  auto ret = with_managed_file(
+      fh,
+      [&](mpi_file& f) {
+        return complete(write_at(f, offset, buf, count, datatype, true),
+                        status);
+      },
+      call_kind::collective);
+  return ret ? *ret
+             : PMPI_File_write_at_all(fh, offset, buf, count, datatype, status);
+}
+
+int MPI_File_read_at(MPI_File fh,
+                     MPI_Offset offset,
+                     void* buf,
+                     int count,
+                     MPI_Datatype datatype,
+                     MPI_Status* status) {
+  auto ret = with_managed_file(fh, [&](mpi_file& f) {
+    return complete(read_at(f, offset, buf, count, datatype, false), status);
+  });
+  return ret ? *ret
+             : PMPI_File_read_at(fh, offset, buf, count, datatype, status);
+}
+
+int MPI_File_read_at_all(MPI_File fh,
+                         MPI_Offset offset,
+                         void* buf,
+                         int count,
+                         MPI_Datatype datatype,
+                         MPI_Status* status) {
+  auto ret = with_managed_file(
+      fh,
+      [&](mpi_file& f) {
+        return complete(read_at(f, offset, buf, count, datatype, true), status);
+      },
+      call_kind::collective);
+  return ret ? *ret
+             : PMPI_File_read_at_all(fh, offset, buf, count, datatype, status);
+}
+
+int MPI_File_set_size(MPI_File fh, MPI_Offset size) {
+  auto ret = with_managed_file(
+      fh,
+      [&](mpi_file& f) {
+        f.handler->truncate(size);
+        return MPI_SUCCESS;
+      },
+      call_kind::collective);
+  return ret ? *ret : PMPI_File_set_size(fh, size);
+}
+
+int MPI_File_get_size(MPI_File fh, MPI_Offset* size) {
+  auto ret = with_managed_file(fh, [&](mpi_file& f) {
+    *size = static_cast<MPI_Offset>(f.handler->size());
+    return MPI_SUCCESS;
+  });
+  return ret ? *ret : PMPI_File_get_size(fh, size);
+}
+
+int MPI_File_sync(MPI_File fh) {
+  auto ret = with_managed_file(
+      fh,
+      [](mpi_file& f) {
+        f.handler->sync();
+        return MPI_SUCCESS;
+      },
+      call_kind::collective);
+  return ret ? *ret : PMPI_File_sync(fh);
+}
+
+// The calls on the individual file pointer go through the explicit offset
+// ones above.
+
+int MPI_File_write(MPI_File fh,
+                   const void* buf,
+                   int count,
+                   MPI_Datatype datatype,
+                   MPI_Status* status) {
+  auto ret = with_managed_file(fh, [&](mpi_file& f) {
+    auto nbytes = write_at(f, f.position, buf, count, datatype, false);
+    advance(f, nbytes);
+    return complete(nbytes, status);
+  });
+  return ret ? *ret : PMPI_File_write(fh, buf, count, datatype, status);
+}
+
+int MPI_File_write_all(MPI_File fh,
+                       const void* buf,
+                       int count,
+                       MPI_Datatype datatype,
+                       MPI_Status* status) {
+  auto ret = with_managed_file(
+      fh,
+      [&](mpi_file& f) {
+        auto nbytes = write_at(f, f.position, buf, count, datatype, true);
+        advance(f, nbytes);
+        return complete(nbytes, status);
+      },
+      call_kind::collective);
+  return ret ? *ret : PMPI_File_write_all(fh, buf, count, datatype, status);
+}
+
+int MPI_File_read(MPI_File fh,
+                  void* buf,
+                  int count,
+                  MPI_Datatype datatype,
+                  MPI_Status* status) {
+  auto ret = with_managed_file(fh, [&](mpi_file& f) {
+    auto nbytes = read_at(f, f.position, buf, count, datatype, false);
+    advance(f, nbytes);
+    return complete(nbytes, status);
+  });
+  return ret ? *ret : PMPI_File_read(fh, buf, count, datatype, status);
+}
+
+int MPI_File_read_all(MPI_File fh,
+                      void* buf,
+                      int count,
+                      MPI_Datatype datatype,
+                      MPI_Status* status) {
+  auto ret = with_managed_file(
+      fh,
+      [&](mpi_file& f) {
+        auto nbytes = read_at(f, f.position, buf, count, datatype, true);
+        advance(f, nbytes);
+        return complete(nbytes, status);
+      },
+      call_kind::collective);
+  return ret ? *ret : PMPI_File_read_all(fh, buf, count, datatype, status);
+}
+
+int MPI_File_seek(MPI_File fh, MPI_Offset offset, int whence) {
+  auto ret = with_managed_file(fh, [&](mpi_file& f) {
+    auto base = MPI_Offset{0};
+    if (whence == MPI_SEEK_CUR) {
+      base = f.position;
+    } else if (whence == MPI_SEEK_END) {
+      auto size = static_cast<MPI_Offset>(f.handler->size());
+      base = std::max(size - f.disp, MPI_Offset{0}) / f.etype_size;
+    } else if (whence != MPI_SEEK_SET) {
+      return MPI_ERR_ARG;
+    }
+    if (base + offset < 0) {
+      return MPI_ERR_ARG;
+    }
+    f.position = base + offset;
+    return MPI_SUCCESS;
+  });
+  return ret ? *ret : PMPI_File_seek(fh, offset, whence);
+}
+
+int MPI_File_get_position(MPI_File fh, MPI_Offset* offset) {
+  auto ret = with_managed_file(fh, [&](mpi_file& f) {
+    *offset = f.position;
+    return MPI_SUCCESS;
+  });
+  return ret ? *ret : PMPI_File_get_position(fh, offset);
+}
+
+int MPI_File_iwrite_at(MPI_File fh,
+                       MPI_Offset offset,
+                       const void* buf,
+                       int count,
+                       MPI_Datatype datatype,
+                       MPI_Request* request) {
+  auto ret = with_managed_file(fh, [&](mpi_file& f) {
+    return completed_request(
+        write_at(f, offset, buf, count, datatype, false), request);
+  });
+  return ret ? *ret
+             : PMPI_File_iwrite_at(fh, offset, buf, count, datatype, request);
+}
+
+int MPI_File_iread_at(MPI_File fh,
+                      MPI_Offset offset,
+                      void* buf,
+                      int count,
+                      MPI_Datatype datatype,
+                      MPI_Request* request) {
+  auto ret = with_managed_file(fh, [&](mpi_file& f) {
+    return completed_request(read_at(f, offset, buf, count, datatype, false),
+                             request);
+  });
+  return ret ? *ret
+             : PMPI_File_iread_at(fh, offset, buf, count, datatype, request);
+}
+
+int MPI_File_iwrite(MPI_File fh,
+                    const void* buf,
+                    int count,
+                    MPI_Datatype datatype,
+                    MPI_Request* request) {
+  auto ret = with_managed_file(fh, [&](mpi_file& f) {
+    auto nbytes = write_at(f, f.position, buf, count, datatype, false);
+    advance(f, nbytes);
+    return completed_request(nbytes, request);
+  });
+  return ret ? *ret : PMPI_File_iwrite(fh, buf, count, datatype, request);
+}
+
+int MPI_File_iread(MPI_File fh,
+                   void* buf,
+                   int count,
+                   MPI_Datatype datatype,
+                   MPI_Request* request) {
+  auto ret = with_managed_file(fh, [&](mpi_file& f) {
+    auto nbytes = read_at(f, f.position, buf, count, datatype, false);
+    advance(f, nbytes);
+    return completed_request(nbytes, request);
+  });
+  return ret ? *ret : PMPI_File_iread(fh, buf, count, datatype, request);
+}
+
+// The nonblocking collectives, the shared file pointer and the split
+// collectives are not implemented on peanuts files.
+
+int MPI_File_iwrite_at_all(MPI_File fh,
+                           MPI_Offset offset,
+                           const void* buf,
+                           int count,
+                           MPI_Datatype datatype,
+                           MPI_Request* request) {
+  auto ret = unsupported(fh);
+  return ret ? *ret
+             : PMPI_File_iwrite_at_all(fh, offset, buf, count, datatype,
+                                       request);
+}
+
+int MPI_File_iread_at_all(MPI_File fh,
+                          MPI_Offset offset,
+                          void* buf,
+                          int count,
+                          MPI_Datatype datatype,
+                          MPI_Request* request) {
+  auto ret = unsupported(fh);
+  return ret ? *ret
+             : PMPI_File_iread_at_all(fh, offset, buf, count, datatype,
+                                      request);
+}
+
+int MPI_File_iwrite_all(MPI_File fh,
+                        const void* buf,
+                        int count,
+                        MPI_Datatype datatype,
+                        MPI_Request* request) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_iwrite_all(fh, buf, count, datatype, request);
+}
+
+int MPI_File_iread_all(MPI_File fh,
+                       void* buf,
+                       int count,
+                       MPI_Datatype datatype,
+                       MPI_Request* request) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_iread_all(fh, buf, count, datatype, request);
+}
+
+int MPI_File_write_shared(MPI_File fh,
+                          const void* buf,
+                          int count,
+                          MPI_Datatype datatype,
+                          MPI_Status* status) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_write_shared(fh, buf, count, datatype, status);
+}
+
+int MPI_File_read_shared(MPI_File fh,
+                         void* buf,
+                         int count,
+                         MPI_Datatype datatype,
+                         MPI_Status* status) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_read_shared(fh, buf, count, datatype, status);
+}
+
+int MPI_File_iwrite_shared(MPI_File fh,
+                           const void* buf,
+                           int count,
+                           MPI_Datatype datatype,
+                           MPI_Request* request) {
+  auto ret = unsupported(fh);
+  return ret ? *ret
+             : PMPI_File_iwrite_shared(fh, buf, count, datatype, request);
+}
+
+int MPI_File_iread_shared(MPI_File fh,
+                          void* buf,
+                          int count,
+                          MPI_Datatype datatype,
+                          MPI_Request* request) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_iread_shared(fh, buf, count, datatype, request);
+}
+
+int MPI_File_write_ordered(MPI_File fh,
+                           const void* buf,
+                           int count,
+                           MPI_Datatype datatype,
+                           MPI_Status* status) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_write_ordered(fh, buf, count, datatype, status);
+}
+
+int MPI_File_read_ordered(MPI_File fh,
+                          void* buf,
+                          int count,
+                          MPI_Datatype datatype,
+                          MPI_Status* status) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_read_ordered(fh, buf, count, datatype, status);
+}
+
+int MPI_File_seek_shared(MPI_File fh, MPI_Offset offset, int whence) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_seek_shared(fh, offset, whence);
+}
+
+int MPI_File_get_position_shared(MPI_File fh, MPI_Offset* offset) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_get_position_shared(fh, offset);
+}
+
+int MPI_File_write_at_all_begin(MPI_File fh,
+                                MPI_Offset offset,
+                                const void* buf,
+                                int count,
+                                MPI_Datatype datatype) {
+  auto ret = unsupported(fh);
+  return ret ? *ret
+             : PMPI_File_write_at_all_begin(fh, offset, buf, count, datatype);
+}
+
+int MPI_File_write_at_all_end(MPI_File fh,
+                              const void* buf,
+                              MPI_Status* status) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_write_at_all_end(fh, buf, status);
+}
+
+int MPI_File_read_at_all_begin(MPI_File fh,
+                               MPI_Offset offset,
+                               void* buf,
+                               int count,
+                               MPI_Datatype datatype) {
+  auto ret = unsupported(fh);
+  return ret ? *ret
+             : PMPI_File_read_at_all_begin(fh, offset, buf, count, datatype);
+}
+
+int MPI_File_read_at_all_end(MPI_File fh, void* buf, MPI_Status* status) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_read_at_all_end(fh, buf, status);
+}
+
+int MPI_File_write_all_begin(MPI_File fh,
+                             const void* buf,
+                             int count,
+                             MPI_Datatype datatype) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_write_all_begin(fh, buf, count, datatype);
+}
+
+int MPI_File_write_all_end(MPI_File fh, const void* buf, MPI_Status* status) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_write_all_end(fh, buf, status);
+}
+
+int MPI_File_read_all_begin(MPI_File fh,
+                            void* buf,
+                            int count,
+                            MPI_Datatype datatype) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_read_all_begin(fh, buf, count, datatype);
+}
+
+int MPI_File_read_all_end(MPI_File fh, void* buf, MPI_Status* status) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_read_all_end(fh, buf, status);
+}
+
+int MPI_File_write_ordered_begin(MPI_File fh,
+                                 const void* buf,
+                                 int count,
+                                 MPI_Datatype datatype) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_write_ordered_begin(fh, buf, count, datatype);
+}
+
+int MPI_File_write_ordered_end(MPI_File fh,
+                               const void* buf,
+                               MPI_Status* status) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_write_ordered_end(fh, buf, status);
+}
+
+int MPI_File_read_ordered_begin(MPI_File fh,
+                                void* buf,
+                                int count,
+                                MPI_Datatype datatype) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_read_ordered_begin(fh, buf, count, datatype);
+}
+
+int MPI_File_read_ordered_end(MPI_File fh, void* buf, MPI_Status* status) {
+  auto ret = unsupported(fh);
+  return ret ? *ret : PMPI_File_read_ordered_end(fh, buf, status);
+}
+
+}  // extern "C"
@@ -0,0 +1,180 @@
+// Interposes the POSIX and MPI-IO file I/O calls of unmodified applications
+// and routes the ones on files under $PEANUTS_PRELOAD_PREFIX through a
+// bb_store:
+//
+//   export PEANUTS_PRELOAD_PREFIX=/path/to/files
+//   export PEANUTS_PRELOAD_PMEM_PATH=/dev/dax0.0
+//   export PEANUTS_PRELOAD_PMEM_SIZE=<bytes per node>
+//   mpirun -x LD_PRELOAD=libpeanuts_preload.so ... ./app
+//
+// The store is created in MPI_Init() and saved in MPI_Finalize(). Files
+// opened with open() are opened over MPI_COMM_SELF (N-N) unless
+// PEANUTS_PRELOAD_COMM=world, in which case open, ftruncate, fsync and close
+// are collective over MPI_COMM_WORLD (N-1); files opened with
+// MPI_File_open() use the communicator they are opened with. stat() and
+// friends report the size seen through peanuts for open files, and flock()
+// and fcntl() locks are taken on the file itself. On MPI-IO files, the calls
+// on the shared file pointer, the split collectives and the nonblocking
+// collectives fail with MPI_ERR_UNSUPPORTED_OPERATION.
+// Everything else is passed to libc and MPI.
+//
+// Writes go to the burst buffer, not to the files themselves. By default
+// they stay there: MPI_Finalize() syncs the files still open and saves the
+// store, and a later run on the same nodes with PEANUTS_PRELOAD_LOAD=1 loads
+// it and sees them again, but the files on disk are not updated. With
+// PEANUTS_PRELOAD_FLUSH=1, the data of a file is also written back to it
+// when it is closed, and at MPI_Finalize() for the files still open.
+
+#include "preload.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <vector>
+
+namespace peanuts::preload {
+
+namespace {
+
+std::atomic<bool> active{false};
+
+auto start() -> void {
+  const char* prefix = std::getenv("PEANUTS_PRELOAD_PREFIX");
+  const char* pmem_path = std::getenv("PEANUTS_PRELOAD_PMEM_PATH");
+  const char* pmem_size = std::getenv("PEANUTS_PRELOAD_PMEM_SIZE");
+  if (prefix == nullptr || prefix[0] == '\0' || pmem_path == nullptr ||
+      pmem_size == nullptr) {
+    return;
+  }
+
+  auto& s = state();
+  std::lock_guard lock{s.mutex};
+  auto scope = passthrough_scope{};
+  try {
+    s.prefix = prefix;
+    const char* comm = std::getenv("PEANUTS_PRELOAD_COMM");
+    s.world = comm != nullptr && std::string_view{comm} == "world";
+    const char* flush = std::getenv("PEANUTS_PRELOAD_FLUSH");
+    s.flush = flush != nullptr && std::string_view{flush} == "1";
+    s.topo = std::make_unique<topology>(mpi::comm{MPI_COMM_WORLD});
+    s.rpm = std::make_unique<rpm>(std::cref(*s.topo), pmem_path,
+                                  std::strtoull(pmem_size, nullptr, 0));
+    s.store = std::make_unique<bb_store>(*s.rpm);
+    if (const char* load = std::getenv("PEANUTS_PRELOAD_LOAD");
+        load != nullptr && std::string_view{load} == "1") {
+      s.store->load();
+    }
+    active.store(true, std::memory_order_release);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "peanuts_preload: disabled: %s\n", e.what());
+    s.store.reset();
+    s.rpm.reset();
+    s.topo.reset();
+  }
+}
+
+auto stop() -> void {
+  if (!active.exchange(false)) {
+    return;
+  }
+  auto& s = state();
+  std::lock_guard lock{s.mutex};
+  auto scope = passthrough_scope{};
+  static const auto next_close = next_symbol<int (*)(int)>("close");
+  // in fd order, which is the same on every rank for files opened over
+  // MPI_COMM_WORLD in the same order
+  auto fds = std::vector<int>{};
+  for (const auto& [fd, f] : s.posix_files) {
+    fds.push_back(fd);
+  }
+  std::sort(fds.begin(), fds.end());
+  for (auto fd : fds) {
+    auto& f = *s.posix_files.at(fd);
+    try {
+      close_handler(*f.handler, f.access_mode != O_RDONLY);
+    } catch (const std::exception& e) {
+      std::fprintf(stderr, "peanuts_preload: failed to close fd %d: %s\n", fd,
+                   e.what());
+    }
+    if (f.lock_fd >= 0) {
+      next_close(f.lock_fd);
+    }
+    next_close(fd);
+  }
+  s.posix_files.clear();
+  // MPI files must have been closed by now
+  s.mpi_files.clear();
+  try {
+    s.store->save();
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "peanuts_preload: failed to save: %s\n", e.what());
+  }
+  s.store.reset();
+  s.rpm.reset();
+  s.topo.reset();
+}
+
+}  // namespace
+
+auto state() -> preload_state& {
+  static preload_state instance;
+  return instance;
+}
+
+auto is_active() -> bool {
+  return active.load(std::memory_order_acquire) && passthrough_depth == 0;
+}
+
+auto is_managed_path(const char* path) -> bool {
+  if (!is_active() || path == nullptr || path[0] == '\0') {
+    return false;
+  }
+
+  auto abs_path = std::string{};
+  if (path[0] != '/') {
+    char cwd[PATH_MAX];
+    if (::getcwd(cwd, sizeof(cwd)) == nullptr) {
+      return false;
+    }
+    abs_path = std::string{cwd} + "/" + path;
+    path = abs_path.c_str();
+  }
+
+  const auto& prefix = state().prefix;
+  auto p = std::string_view{path};
+  return p.starts_with(prefix) &&
+         (p.size() == prefix.size() || prefix.back() == '/' ||
+          p[prefix.size()] == '/');
+}
+
+}  // namespace peanuts::preload
+
+extern "C" {
+
+int MPI_Init(int* argc, char*** argv) {
+  auto ret = PMPI_Init(argc, argv);
+  if (ret == MPI_SUCCESS) {
+    peanuts::preload::start();
+  }
+  return ret;
+}
+
+int MPI_Init_thread(int* argc, char*** argv, int required, int* provided) {
+  auto ret = PMPI_Init_thread(argc, argv, required, provided);
+  if (ret == MPI_SUCCESS) {
+    peanuts::preload::start();
+  }
+  return ret;
+}
+
+int MPI_Finalize() {
+  peanuts::preload::stop();
+  return PMPI_Finalize();
+}
+
+}  // extern "C"
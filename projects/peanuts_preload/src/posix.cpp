@@ -0,0 +1,576 @@
+#include "preload.hpp"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdarg>
+#include <string>
+#include <optional>
+#include <type_traits>
+
+namespace peanuts::preload {
+
+namespace {
+
+using open_fn = int (*)(const char*, int, ...);
+using openat_fn = int (*)(int, const char*, int, ...);
+using read_fn = ssize_t (*)(int, void*, size_t);
+using write_fn = ssize_t (*)(int, const void*, size_t);
+using pread_fn = ssize_t (*)(int, void*, size_t, off64_t);
+using pwrite_fn = ssize_t (*)(int, const void*, size_t, off64_t);
+using lseek_fn = off64_t (*)(int, off64_t, int);
+using ftruncate_fn = int (*)(int, off64_t);
+using fd_fn = int (*)(int);
+using fcntl_fn = int (*)(int, int, ...);
+using flock_fn = int (*)(int, int);
+using fstat_fn = int (*)(int, struct stat*);
+using fstat64_fn = int (*)(int, struct stat64*);
+using fxstat_fn = int (*)(int, int, struct stat*);
+using fxstat64_fn = int (*)(int, int, struct stat64*);
+using stat_fn = int (*)(const char*, struct stat*);
+using stat64_fn = int (*)(const char*, struct stat64*);
+using xstat_fn = int (*)(int, const char*, struct stat*);
+using xstat64_fn = int (*)(int, const char*, struct stat64*);
+using fstatat_fn = int (*)(int, const char*, struct stat*, int);
+using fstatat64_fn = int (*)(int, const char*, struct stat64*, int);
+using statx_fn = int (*)(int, const char*, int, unsigned int, struct statx*);
+
+auto open_managed(const char* path, int flags, mode_t mode) -> int {
+  auto& s = state();
+  auto scope = passthrough_scope{};
+  try {
+    auto file = std::make_shared<posix_file>();
+    file->append = (flags & O_APPEND) != 0;
+    file->access_mode = flags & O_ACCMODE;
+    file->collective = s.world && s.topo->size() > 1;
+    auto comm = mpi::comm{s.world ? MPI_COMM_WORLD : MPI_COMM_SELF};
+    // appends are done by the wrappers; the file itself is written at offsets
+    call_locked(*file, call_kind::collective, [&](posix_file& f) {
+      f.handler = s.store->open(std::move(comm), path, flags & ~O_APPEND, mode);
+      if ((flags & O_TRUNC) != 0) {
+        f.handler->truncate(0);
+      }
+    });
+
+    // a descriptor of the file itself, so that the calls that are not
+    // intercepted fail with EBADF rather than bypass peanuts
+    static const auto next_open = next_symbol<open_fn>("open");
+    auto fd = next_open(path, O_PATH | (flags & O_CLOEXEC));
+    std::lock_guard lock{s.mutex};
+    if (fd < 0) {
+      file->handler.reset();
+      return -1;
+    }
+    s.posix_files[fd] = std::move(file);
+    return fd;
+  } catch (const std::system_error& e) {
+    errno = errno_of(e);
+    return -1;
+  } catch (...) {
+    errno = EIO;
+    return -1;
+  }
+}
+
+// Calls fn with the posix_file of fd, or returns nullopt if fd is not ours.
+template <typename Fn>
+auto with_managed_fd(int fd, Fn&& fn, call_kind kind = call_kind::local)
+    -> std::optional<std::invoke_result_t<Fn, posix_file&>> {
+  using result_t = std::invoke_result_t<Fn, posix_file&>;
+  if (!is_active()) {
+    return std::nullopt;
+  }
+  auto file = find_file(state().posix_files, fd);
+  if (file == nullptr) {
+    return std::nullopt;
+  }
+  try {
+    return call_locked(*file, kind, std::forward<Fn>(fn));
+  } catch (const std::system_error& e) {
+    errno = errno_of(e);
+    return static_cast<result_t>(-1);
+  } catch (...) {
+    errno = EIO;
+    return static_cast<result_t>(-1);
+  }
+}
+
+auto read_at(posix_file& f, void* buf, size_t count, off_t ofs) -> ssize_t {
+  if (ofs < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  auto size = f.handler->size();
+  if (static_cast<size_t>(ofs) >= size) {
+    return 0;
+  }
+  count = std::min(count, size - ofs);
+  return f.handler->pread({static_cast<std::byte*>(buf), count}, ofs);
+}
+
+auto write_at(posix_file& f, const void* buf, size_t count, off_t ofs)
+    -> ssize_t {
+  if (ofs < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (count == 0) {
+    return 0;
+  }
+  return f.handler->pwrite({static_cast<const std::byte*>(buf), count}, ofs);
+}
+
+auto seek(posix_file& f, off_t ofs, int whence) -> off_t {
+  auto base = off_t{0};
+  switch (whence) {
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      base = f.offset;
+      break;
+    case SEEK_END:
+      base = static_cast<off_t>(f.handler->size());
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+  if (base + ofs < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  f.offset = base + ofs;
+  return f.offset;
+}
+
+auto sync_file(posix_file& f) -> int {
+  f.handler->sync();
+  return 0;
+}
+
+// The descriptor of the file is an O_PATH one, on which locks fail with
+// EBADF, so they are taken on a real descriptor reopened through /proc.
+auto lock_fd(int fd, posix_file& f) -> int {
+  if (f.lock_fd < 0) {
+    static const auto next_open = next_symbol<open_fn>("open");
+    auto proc_path = "/proc/self/fd/" + std::to_string(fd);
+    f.lock_fd = next_open(proc_path.c_str(), f.access_mode | O_CLOEXEC);
+  }
+  return f.lock_fd;
+}
+
+auto is_lock_cmd(int cmd) -> bool {
+  switch (cmd) {
+    case F_GETLK:
+    case F_SETLK:
+    case F_SETLKW:
+    case F_OFD_GETLK:
+    case F_OFD_SETLK:
+    case F_OFD_SETLKW:
+      return true;
+    default:
+      return false;
+  }
+}
+
+auto fcntl_impl(fcntl_fn next, int fd, int cmd, void* arg) -> int {
+  if (is_lock_cmd(cmd)) {
+    // taken outside the lock of the state, as F_SETLKW may block
+    auto real_fd = with_managed_fd(fd, [&](posix_file& f) {
+      return lock_fd(fd, f);
+    });
+    return next(real_fd ? *real_fd : fd, cmd, arg);
+  }
+  auto ret = with_managed_fd(fd, [&](posix_file& f) -> std::optional<int> {
+    switch (cmd) {
+      case F_GETFL:
+        return f.access_mode | (f.append ? O_APPEND : 0);
+      case F_SETFL:
+        f.append = (reinterpret_cast<intptr_t>(arg) & O_APPEND) != 0;
+        return 0;
+      default:
+        return std::nullopt;
+    }
+  });
+  return ret && *ret ? **ret : next(fd, cmd, arg);
+}
+
+// The size of the open file with the given inode as seen through peanuts,
+// or nullopt if it is not open.
+auto open_file_size(ino_t ino) -> std::optional<size_t> {
+  auto& s = state();
+  auto posix = std::shared_ptr<posix_file>{};
+  auto mpi = std::shared_ptr<mpi_file>{};
+  {
+    std::lock_guard lock{s.mutex};
+    for (const auto& [fd, f] : s.posix_files) {
+      if (f->handler->bb_ref().ino == ino) {
+        posix = f;
+        break;
+      }
+    }
+    for (const auto& [fh, f] : s.mpi_files) {
+      if (posix == nullptr && mpi == nullptr &&
+          f->handler->bb_ref().ino == ino) {
+        mpi = f;
+      }
+    }
+  }
+  auto size = [](auto& f) { return f.handler->size(); };
+  if (posix != nullptr) {
+    return call_locked(*posix, call_kind::local, size);
+  } else if (mpi != nullptr) {
+    return call_locked(*mpi, call_kind::local, size);
+  }
+  return std::nullopt;
+}
+
+// fstat() and friends work on the O_PATH descriptor but see the size of the
+// file on disk, which is replaced with the one seen through peanuts.
+template <typename Stat>
+auto fix_fstat(int fd, int ret, Stat* buf) -> int {
+  if (ret == 0) {
+    with_managed_fd(fd, [&](posix_file& f) {
+      buf->st_size = static_cast<off_t>(f.handler->size());
+      return 0;
+    });
+  }
+  return ret;
+}
+
+// The same for a path, if the file is open.
+template <typename Stat>
+auto fix_stat(const char* path, int ret, Stat* buf) -> int {
+  if (ret == 0 && is_managed_path(path)) {
+    if (auto size = open_file_size(buf->st_ino)) {
+      buf->st_size = static_cast<off_t>(*size);
+    }
+  }
+  return ret;
+}
+
+template <typename Stat>
+auto fix_fstatat(int dirfd, const char* path, int flags, int ret, Stat* buf)
+    -> int {
+  if (path != nullptr && path[0] == '\0' && (flags & AT_EMPTY_PATH) != 0) {
+    return fix_fstat(dirfd, ret, buf);
+  } else if (dirfd == AT_FDCWD || (path != nullptr && path[0] == '/')) {
+    return fix_stat(path, ret, buf);
+  }
+  return ret;
+}
+
+auto open_impl(open_fn next, const char* path, int flags, mode_t mode)
+    -> int {
+  if ((flags & O_DIRECTORY) != 0 || !is_managed_path(path)) {
+    return next(path, flags, mode);
+  }
+  return open_managed(path, flags, mode);
+}
+
+auto openat_impl(openat_fn next,
+                 int dirfd,
+                 const char* path,
+                 int flags,
+                 mode_t mode) -> int {
+  // paths relative to other directories are left alone
+  if ((dirfd != AT_FDCWD && (path == nullptr || path[0] != '/')) ||
+      (flags & O_DIRECTORY) != 0 || !is_managed_path(path)) {
+    return next(dirfd, path, flags, mode);
+  }
+  return open_managed(path, flags, mode);
+}
+
+auto va_mode(int flags, va_list ap) -> mode_t {
+  return (flags & (O_CREAT | O_TMPFILE)) != 0 ? va_arg(ap, mode_t) : 0;
+}
+
+}  // namespace
+
+}  // namespace peanuts::preload
+
+using namespace peanuts::preload;
+
+extern "C" {
+
+int open(const char* path, int flags, ...) {
+  static const auto next = next_symbol<open_fn>("open");
+  va_list ap;
+  va_start(ap, flags);
+  auto mode = va_mode(flags, ap);
+  va_end(ap);
+  return open_impl(next, path, flags, mode);
+}
+
+int open64(const char* path, int flags, ...) {
+  static const auto next = next_symbol<open_fn>("open64");
+  va_list ap;
+  va_start(ap, flags);
+  auto mode = va_mode(flags, ap);
+  va_end(ap);
+  return open_impl(next, path, flags, mode);
+}
+
+int openat(int dirfd, const char* path, int flags, ...) {
+  static const auto next = next_symbol<openat_fn>("openat");
+  va_list ap;
+  va_start(ap, flags);
+  auto mode = va_mode(flags, ap);
+  va_end(ap);
+  return openat_impl(next, dirfd, path, flags, mode);
+}
+
+int openat64(int dirfd, const char* path, int flags, ...) {
+  static const auto next = next_symbol<openat_fn>("openat64");
+  va_list ap;
+  va_start(ap, flags);
+  auto mode = va_mode(flags, ap);
+  va_end(ap);
+  return openat_impl(next, dirfd, path, flags, mode);
+}
+
+ssize_t read(int fd, void* buf, size_t count) {
+  static const auto next = next_symbol<read_fn>("read");
+  auto ret = with_managed_fd(fd, [&](posix_file& f) -> ssize_t {
+    auto n = read_at(f, buf, count, f.offset);
+    if (n > 0) {
+      f.offset += n;
+    }
+    return n;
+  });
+  return ret ? *ret : next(fd, buf, count);
+}
+
+ssize_t write(int fd, const void* buf, size_t count) {
+  static const auto next = next_symbol<write_fn>("write");
+  auto ret = with_managed_fd(fd, [&](posix_file& f) -> ssize_t {
+    auto ofs = f.append ? static_cast<off_t>(f.handler->size()) : f.offset;
+    auto n = write_at(f, buf, count, ofs);
+    if (n >= 0) {
+      f.offset = ofs + n;
+    }
+    return n;
+  });
+  return ret ? *ret : next(fd, buf, count);
+}
+
+ssize_t pread(int fd, void* buf, size_t count, off_t ofs) {
+  static const auto next = next_symbol<pread_fn>("pread");
+  auto ret = with_managed_fd(
+      fd, [&](posix_file& f) { return read_at(f, buf, count, ofs); });
+  return ret ? *ret : next(fd, buf, count, ofs);
+}
+
+ssize_t pread64(int fd, void* buf, size_t count, off64_t ofs) {
+  static const auto next = next_symbol<pread_fn>("pread64");
+  auto ret = with_managed_fd(
+      fd, [&](posix_file& f) { return read_at(f, buf, count, ofs); });
+  return ret ? *ret : next(fd, buf, count, ofs);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t ofs) {
+  static const auto next = next_symbol<pwrite_fn>("pwrite");
+  auto ret = with_managed_fd(
+      fd, [&](posix_file& f) { return write_at(f, buf, count, ofs); });
+  return ret ? *ret : next(fd, buf, count, ofs);
+}
+
+ssize_t pwrite64(int fd, const void* buf, size_t count, off64_t ofs) {
+  static const auto next = next_symbol<pwrite_fn>("pwrite64");
+  auto ret = with_managed_fd(
+      fd, [&](posix_file& f) { return write_at(f, buf, count, ofs); });
+  return ret ? *ret : next(fd, buf, count, ofs);
+}
+
+off_t lseek(int fd, off_t ofs, int whence) {
+  static const auto next = next_symbol<lseek_fn>("lseek");
+  auto ret =
+      with_managed_fd(fd, [&](posix_file& f) { return seek(f, ofs, whence); });
+  return ret ? *ret : next(fd, ofs, whence);
+}
+
+off64_t lseek64(int fd, off64_t ofs, int whence) {
+  static const auto next = next_symbol<lseek_fn>("lseek64");
+  auto ret =
+      with_managed_fd(fd, [&](posix_file& f) { return seek(f, ofs, whence); });
+  return ret ? *ret : next(fd, ofs, whence);
+}
+
+int ftruncate(int fd, off_t length) {
+  static const auto next = next_symbol<ftruncate_fn>("ftruncate");
+  auto ret = with_managed_fd(
+      fd,
+      [&](posix_file& f) {
+        f.handler->truncate(length);
+        return 0;
+      },
+      call_kind::collective);
+  return ret ? *ret : next(fd, length);
+}
+
+int ftruncate64(int fd, off64_t length) {
+  static const auto next = next_symbol<ftruncate_fn>("ftruncate64");
+  auto ret = with_managed_fd(
+      fd,
+      [&](posix_file& f) {
+        f.handler->truncate(length);
+        return 0;
+      },
+      call_kind::collective);
+  return ret ? *ret : next(fd, length);
+}
+
+int fsync(int fd) {
+  static const auto next = next_symbol<fd_fn>("fsync");
+  auto ret = with_managed_fd(fd, sync_file, call_kind::collective);
+  return ret ? *ret : next(fd);
+}
+
+int fdatasync(int fd) {
+  static const auto next = next_symbol<fd_fn>("fdatasync");
+  auto ret = with_managed_fd(fd, sync_file, call_kind::collective);
+  return ret ? *ret : next(fd);
+}
+
+int close(int fd) {
+  static const auto next = next_symbol<fd_fn>("close");
+  auto ret = with_managed_fd(
+      fd,
+      [](posix_file& f) {
+        close_handler(*f.handler, f.access_mode != O_RDONLY);
+        return 0;
+      },
+      call_kind::collective);
+  if (ret) {
+    with_managed_fd(fd, [&](posix_file& f) {
+      f.handler.reset();
+      if (f.lock_fd >= 0) {
+        next(f.lock_fd);
+      }
+      state().posix_files.erase(fd);
+      return 0;
+    });
+    next(fd);
+    return *ret;
+  }
+  return next(fd);
+}
+
+int fcntl(int fd, int cmd, ...) {
+  static const auto next = next_symbol<fcntl_fn>("fcntl");
+  va_list ap;
+  va_start(ap, cmd);
+  auto arg = va_arg(ap, void*);
+  va_end(ap);
+  return fcntl_impl(next, fd, cmd, arg);
+}
+
+int fcntl64(int fd, int cmd, ...) {
+  static const auto next = next_symbol<fcntl_fn>("fcntl64");
+  va_list ap;
+  va_start(ap, cmd);
+  auto arg = va_arg(ap, void*);
+  va_end(ap);
+  return fcntl_impl(next, fd, cmd, arg);
+}
+
+int flock(int fd, int operation) {
+  static const auto next = next_symbol<flock_fn>("flock");
+  // taken outside the lock of the state, as it may block
+  auto real_fd =
+      with_managed_fd(fd, [&](posix_file& f) { return lock_fd(fd, f); });
+  return next(real_fd ? *real_fd : fd, operation);
+}
+
+int fstat(int fd, struct stat* buf) {
+  static const auto next = next_symbol<fstat_fn>("fstat");
+  return fix_fstat(fd, next(fd, buf), buf);
+}
+
+int fstat64(int fd, struct stat64* buf) {
+  static const auto next = next_symbol<fstat64_fn>("fstat64");
+  return fix_fstat(fd, next(fd, buf), buf);
+}
+
+int __fxstat(int ver, int fd, struct stat* buf) {
+  static const auto next = next_symbol<fxstat_fn>("__fxstat");
+  return fix_fstat(fd, next(ver, fd, buf), buf);
+}
+
+int __fxstat64(int ver, int fd, struct stat64* buf) {
+  static const auto next = next_symbol<fxstat64_fn>("__fxstat64");
+  return fix_fstat(fd, next(ver, fd, buf), buf);
+}
+
+int stat(const char* path, struct stat* buf) {
+  static const auto next = next_symbol<stat_fn>("stat");
+  return fix_stat(path, next(path, buf), buf);
+}
+
+int stat64(const char* path, struct stat64* buf) {
+  static const auto next = next_symbol<stat64_fn>("stat64");
+  return fix_stat(path, next(path, buf), buf);
+}
+
+int lstat(const char* path, struct stat* buf) {
+  static const auto next = next_symbol<stat_fn>("lstat");
+  return fix_stat(path, next(path, buf), buf);
+}
+
+int lstat64(const char* path, struct stat64* buf) {
+  static const auto next = next_symbol<stat64_fn>("lstat64");
+  return fix_stat(path, next(path, buf), buf);
+}
+
+int __xstat(int ver, const char* path, struct stat* buf) {
+  static const auto next = next_symbol<xstat_fn>("__xstat");
+  return fix_stat(path, next(ver, path, buf), buf);
+}
+
+int __xstat64(int ver, const char* path, struct stat64* buf) {
+  static const auto next = next_symbol<xstat64_fn>("__xstat64");
+  return fix_stat(path, next(ver, path, buf), buf);
+}
+
+int __lxstat(int ver, const char* path, struct stat* buf) {
+  static const auto next = next_symbol<xstat_fn>("__lxstat");
+  return fix_stat(path, next(ver, path, buf), buf);
+}
+
+int __lxstat64(int ver, const char* path, struct stat64* buf) {
+  static const auto next = next_symbol<xstat64_fn>("__lxstat64");
+  return fix_stat(path, next(ver, path, buf), buf);
+}
+
+int fstatat(int dirfd, const char* path, struct stat* buf, int flags) {
+  static const auto next = next_symbol<fstatat_fn>("fstatat");
+  return fix_fstatat(dirfd, path, flags, next(dirfd, path, buf, flags), buf);
+}
+
+int fstatat64(int dirfd, const char* path, struct stat64* buf, int flags) {
+  static const auto next = next_symbol<fstatat64_fn>("fstatat64");
+  return fix_fstatat(dirfd, path, flags, next(dirfd, path, buf, flags), buf);
+}
+
+int statx(int dirfd,
+          const char* path,
+          int flags,
+          unsigned int mask,
+          struct statx* buf) {
+  static const auto next = next_symbol<statx_fn>("statx");
+  auto ret = next(dirfd, path, flags, mask, buf);
+  if (ret != 0) {
+    return ret;
+  }
+  // statx has its own field names
+  struct stat st {};
+  st.st_ino = buf->stx_ino;
+  st.st_size = static_cast<off_t>(buf->stx_size);
+  fix_fstatat(dirfd, path, flags, ret, &st);
+  buf->stx_size = static_cast<uint64_t>(st.st_size);
+  return ret;
+}
+
+}  // extern "C"
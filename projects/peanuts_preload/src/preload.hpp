@@ -0,0 +1,145 @@
+#pragma once
+
+// the wrappers must define the plain symbols, not fortified or 64-bit aliases
+#undef _FORTIFY_SOURCE
+#undef _FILE_OFFSET_BITS
+
+#include "peanuts/bb.hpp"
+
+#include <dlfcn.h>
+#include <mpi.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <cerrno>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+
+namespace peanuts::preload {
+
+template <typename F>
+auto next_symbol(const char* name) -> F {
+  return reinterpret_cast<F>(::dlsym(RTLD_NEXT, name));
+}
+
+// set while peanuts itself is running, so that its own I/O goes to libc
+inline thread_local int passthrough_depth = 0;
+
+struct passthrough_scope {
+  passthrough_scope() { ++passthrough_depth; }
+  ~passthrough_scope() { --passthrough_depth; }
+  passthrough_scope(const passthrough_scope&) = delete;
+  auto operator=(const passthrough_scope&) -> passthrough_scope& = delete;
+};
+
+// a file opened with open()
+struct posix_file {
+  std::unique_ptr<bb_handler> handler;
+  off_t offset = 0;  // file offset used by read, write and lseek
+  bool append = false;
+  int access_mode = 0;  // O_RDONLY, O_WRONLY or O_RDWR
+  // real descriptor of the file for flock() and fcntl() locks, opened by the
+  // first of them
+  int lock_fd = -1;
+  bool collective = false;  // opened over more than one rank
+  std::mutex mutex;         // serializes the calls on the file
+};
+
+// a file opened with MPI_File_open()
+struct mpi_file {
+  std::unique_ptr<bb_handler> handler;
+  // contiguous file view: offsets are in etypes, starting at disp
+  MPI_Offset disp = 0;
+  MPI_Offset etype_size = 1;
+  MPI_Offset position = 0;  // individual file pointer, in etypes
+  bool writable = true;
+  bool collective = false;  // opened over more than one rank
+  std::mutex mutex;         // serializes the calls on the file
+};
+
+struct preload_state {
+  std::string prefix;
+  bool world = false;
+  bool flush = false;  // write files back when they are closed
+  std::unique_ptr<peanuts::topology> topo;
+  std::unique_ptr<peanuts::rpm> rpm;
+  std::unique_ptr<peanuts::bb_store> store;
+  std::unordered_map<int, std::shared_ptr<posix_file>> posix_files;
+  std::unordered_map<MPI_File, std::shared_ptr<mpi_file>> mpi_files;
+  // Guards the maps and the store, taken after the lock of a file. Every
+  // intercepted call takes it to look up its fd, so it is never held while
+  // waiting for other ranks: calls that are collective over more than one
+  // rank only hold the lock of their file. Otherwise a thread blocked in one
+  // would stall the I/O of the other threads of the rank, which the other
+  // ranks may be waiting for. As the store is not thread-safe, such calls
+  // must still not overlap with peanuts calls on other files.
+  std::mutex mutex;
+
+  ~preload_state() {
+    // MPI is gone if the application never called MPI_Finalize(), so the
+    // communicators of the MPI files cannot be freed any more
+    posix_files.clear();
+    for (auto& [fh, f] : mpi_files) {
+      (void)f->handler.release();
+    }
+    mpi_files.clear();
+    (void)store.release();
+    (void)rpm.release();
+    (void)topo.release();
+  }
+};
+
+auto state() -> preload_state&;
+
+// true between MPI_Init() and MPI_Finalize() if peanuts is configured
+auto is_active() -> bool;
+
+// true if path is under the prefix and peanuts is not running already
+auto is_managed_path(const char* path) -> bool;
+
+// collective
+// Called when a file is closed. If it was opened for writing, its data is
+// written back to the file itself with PEANUTS_PRELOAD_FLUSH=1. Otherwise
+// it is only synced.
+inline auto close_handler(bb_handler& handler, bool writable) -> void {
+  if (state().flush && writable) {
+    handler.flush_to_file();
+  } else {
+    handler.sync();
+  }
+}
+
+enum class call_kind {
+  local,
+  collective,
+};
+
+// The file of key, or nullptr if it is not ours.
+template <typename Map, typename Key>
+auto find_file(Map& files, const Key& key) -> typename Map::mapped_type {
+  std::lock_guard lock{state().mutex};
+  auto it = files.find(key);
+  return it != files.end() ? it->second : nullptr;
+}
+
+// Calls fn(file) under the lock of file and, unless the call is collective
+// over more than one rank, of the state.
+template <typename File, typename Fn>
+auto call_locked(File& file, call_kind kind, Fn&& fn) -> decltype(fn(file)) {
+  std::lock_guard file_lock{file.mutex};
+  auto state_lock = std::unique_lock{state().mutex, std::defer_lock};
+  if (kind == call_kind::local || !file.collective) {
+    state_lock.lock();
+  }
+  auto scope = passthrough_scope{};
+  return fn(file);
+}
+
+inline auto errno_of(const std::system_error& e) -> int {
+  return e.code().value() != 0 ? e.code().value() : EIO;
+}
+
+}  // namespace peanuts::preload
@@ -0,0 +1,347 @@
+#define DOCTEST_CONFIG_IMPLEMENT
+#include "doctest/extensions/doctest_mpi.h"
+
+#include <mpi.h>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// run with PEANUTS_PRELOAD_PREFIX=/tmp/peanuts_preload_test, and once more
+// with PEANUTS_PRELOAD_FLUSH=1, see CMakeLists.txt
+
+int main(int argc, char** argv) {
+  ::mkdir("/tmp/peanuts_preload_test", 0755);
+
+  doctest::mpi_init_thread(argc, argv, MPI_THREAD_MULTIPLE);
+
+  doctest::Context ctx;
+  ctx.setOption("abort-after", 5);
+  ctx.setOption("reporters", "MpiConsoleReporter");
+  ctx.setOption("force-colors", true);
+  ctx.applyCommandLine(argc, argv);
+
+  int test_result = ctx.run();
+
+  doctest::mpi_finalize();
+
+  return test_result;
+}
+
+// the size of the file on disk; stat() itself reports the size seen through
+// peanuts while the file is open
+static auto real_file_size(const std::string& path) -> off_t {
+  struct stat buf;
+  REQUIRE(::syscall(SYS_newfstatat, AT_FDCWD, path.c_str(), &buf, 0) == 0);
+  return buf.st_size;
+}
+
+static auto real_file_data(const std::string& path) -> std::string {
+  auto fd = static_cast<int>(
+      ::syscall(SYS_openat, AT_FDCWD, path.c_str(), O_RDONLY));
+  REQUIRE(fd >= 0);
+  auto data = std::string(real_file_size(path), '\0');
+  CHECK(::syscall(SYS_pread64, fd, data.data(), data.size(), 0) ==
+        static_cast<long>(data.size()));
+  ::syscall(SYS_close, fd);
+  return data;
+}
+
+// files are written back when they are closed
+static auto flush_on_close() -> bool {
+  const char* flush = std::getenv("PEANUTS_PRELOAD_FLUSH");
+  return flush != nullptr && std::string_view{flush} == "1";
+}
+
+TEST_CASE("POSIX I/O under the prefix goes through peanuts") {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  auto path = "/tmp/peanuts_preload_test/file" + std::to_string(rank);
+
+  auto fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  REQUIRE(fd >= 0);
+
+  CHECK(::write(fd, "hello", 5) == 5);
+  CHECK(::write(fd, "world", 5) == 5);
+  CHECK(::lseek(fd, 0, SEEK_CUR) == 10);
+  // the data is in the burst buffer, not in the file
+  CHECK(real_file_size(path) == 0);
+
+  std::string buf(10, '\0');
+  CHECK(::lseek(fd, 0, SEEK_SET) == 0);
+  CHECK(::read(fd, buf.data(), buf.size()) == 10);
+  CHECK(buf == "helloworld");
+  CHECK(::read(fd, buf.data(), buf.size()) == 0);
+
+  CHECK(::pwrite(fd, "x", 1, 100) == 1);
+  CHECK(::lseek(fd, 0, SEEK_END) == 101);
+  CHECK(::pread(fd, buf.data(), 2, 99) == 2);
+  CHECK(buf.substr(0, 2) == std::string{"\0x", 2});
+
+  CHECK(::ftruncate(fd, 5) == 0);
+  CHECK(::lseek(fd, 0, SEEK_END) == 5);
+  CHECK(::fsync(fd) == 0);
+  CHECK(::close(fd) == 0);
+
+  fd = ::open(path.c_str(), O_RDONLY | O_APPEND);
+  REQUIRE(fd >= 0);
+  buf.assign(10, '\0');
+  CHECK(::read(fd, buf.data(), buf.size()) == 5);
+  CHECK(buf.substr(0, 5) == "hello");
+  CHECK(::close(fd) == 0);
+
+  fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+  REQUIRE(fd >= 0);
+  CHECK(::write(fd, "!", 1) == 1);
+  CHECK(::pread(fd, buf.data(), buf.size(), 0) == 6);
+  CHECK(buf.substr(0, 6) == "hello!");
+  CHECK(::close(fd) == 0);
+}
+
+TEST_CASE("POSIX stat and locks under the prefix") {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  auto path = "/tmp/peanuts_preload_test/stat" + std::to_string(rank);
+
+  auto fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  REQUIRE(fd >= 0);
+  CHECK(::pwrite(fd, "hello", 5, 95) == 5);
+
+  // the size seen through peanuts, not the one of the file on disk
+  struct stat buf;
+  CHECK(::fstat(fd, &buf) == 0);
+  CHECK(buf.st_size == 100);
+  CHECK(S_ISREG(buf.st_mode));
+  CHECK(::stat(path.c_str(), &buf) == 0);
+  CHECK(buf.st_size == 100);
+  CHECK(::fstatat(fd, "", &buf, AT_EMPTY_PATH) == 0);
+  CHECK(buf.st_size == 100);
+  struct statx xbuf;
+  CHECK(::statx(AT_FDCWD, path.c_str(), 0, STATX_SIZE, &xbuf) == 0);
+  CHECK(xbuf.stx_size == 100);
+  CHECK(real_file_size(path) == 0);
+
+  CHECK((::fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDWR);
+  CHECK(::flock(fd, LOCK_EX | LOCK_NB) == 0);
+  CHECK(::flock(fd, LOCK_UN) == 0);
+  struct flock lock {};
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  CHECK(::fcntl(fd, F_SETLK, &lock) == 0);
+  lock.l_type = F_UNLCK;
+  CHECK(::fcntl(fd, F_SETLK, &lock) == 0);
+  CHECK(::close(fd) == 0);
+
+  if (flush_on_close()) {
+    CHECK(real_file_data(path) == std::string(95, '\0') + "hello");
+  } else {
+    CHECK(real_file_size(path) == 0);
+  }
+}
+
+TEST_CASE("POSIX I/O outside the prefix goes to libc") {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  auto path = "/tmp/peanuts_preload_other" + std::to_string(rank);
+
+  auto fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  REQUIRE(fd >= 0);
+  CHECK(::write(fd, "hello", 5) == 5);
+  CHECK(::close(fd) == 0);
+  CHECK(real_file_size(path) == 5);
+  ::unlink(path.c_str());
+}
+
+TEST_CASE("MPI-IO under the prefix goes through peanuts") {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  auto path = std::string{"/tmp/peanuts_preload_test/mpiio"};
+
+  MPI_File fh;
+  REQUIRE(MPI_File_open(MPI_COMM_WORLD, path.c_str(),
+                        MPI_MODE_CREATE | MPI_MODE_RDWR, MPI_INFO_NULL,
+                        &fh) == MPI_SUCCESS);
+  CHECK(MPI_File_set_size(fh, 0) == MPI_SUCCESS);
+
+  // each rank writes its own record and reads the one of the next rank
+  auto dat = std::string{"rank"} + std::to_string(1000 + rank);
+  CHECK(MPI_File_write_at_all(fh, dat.size() * rank, dat.data(), dat.size(),
+                              MPI_CHAR, MPI_STATUS_IGNORE) == MPI_SUCCESS);
+  CHECK(MPI_File_sync(fh) == MPI_SUCCESS);
+  auto next = (rank + 1) % size;
+  std::string buf(dat.size(), '\0');
+  MPI_Status status;
+  CHECK(MPI_File_read_at_all(fh, dat.size() * next, buf.data(), buf.size(),
+                             MPI_CHAR, &status) == MPI_SUCCESS);
+  CHECK(buf == std::string{"rank"} + std::to_string(1000 + next));
+  int count;
+  MPI_Get_count(&status, MPI_CHAR, &count);
+  CHECK(count == static_cast<int>(dat.size()));
+
+  // a contiguous view of ints behind the records, written from a strided
+  // memory layout
+  auto disp = static_cast<MPI_Offset>(dat.size() * size);
+  CHECK(MPI_File_set_view(fh, disp, MPI_INT, MPI_INT, "native",
+                          MPI_INFO_NULL) == MPI_SUCCESS);
+  int strided[] = {2 * rank, -1, 2 * rank + 1};
+  MPI_Datatype every_other;
+  MPI_Type_vector(2, 1, 2, MPI_INT, &every_other);
+  MPI_Type_commit(&every_other);
+  CHECK(MPI_File_write_at(fh, 2 * rank, strided, 1, every_other,
+                          MPI_STATUS_IGNORE) == MPI_SUCCESS);
+  MPI_Type_free(&every_other);
+  CHECK(MPI_File_sync(fh) == MPI_SUCCESS);
+
+  std::vector<int> ints(2 * size + 1, -1);
+  CHECK(MPI_File_read_at(fh, 0, ints.data(), ints.size(), MPI_INT, &status) ==
+        MPI_SUCCESS);
+  MPI_Get_count(&status, MPI_INT, &count);
+  CHECK(count == 2 * size);
+  for (int i = 0; i < 2 * size; ++i) {
+    CHECK(ints[i] == i);
+  }
+
+  MPI_Offset file_size;
+  CHECK(MPI_File_get_size(fh, &file_size) == MPI_SUCCESS);
+  CHECK(file_size == disp + 2 * size * static_cast<MPI_Offset>(sizeof(int)));
+  // the data is in the burst buffer, not in the file
+  CHECK(real_file_size(path) == 0);
+
+  CHECK(MPI_File_close(&fh) == MPI_SUCCESS);
+  if (flush_on_close()) {
+    auto data = real_file_data(path);
+    CHECK(data.size() == static_cast<size_t>(file_size));
+    CHECK(data.substr(dat.size() * rank, dat.size()) == dat);
+  } else {
+    CHECK(real_file_size(path) == 0);
+  }
+}
+
+TEST_CASE("MPI-IO on the individual file pointer") {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  auto path = std::string{"/tmp/peanuts_preload_test/mpiio_pointer"};
+
+  MPI_File fh;
+  REQUIRE(MPI_File_open(MPI_COMM_WORLD, path.c_str(),
+                        MPI_MODE_CREATE | MPI_MODE_RDWR, MPI_INFO_NULL,
+                        &fh) == MPI_SUCCESS);
+  CHECK(MPI_File_set_size(fh, 0) == MPI_SUCCESS);
+  CHECK(MPI_File_set_view(fh, 0, MPI_INT, MPI_INT, "native", MPI_INFO_NULL) ==
+        MPI_SUCCESS);
+
+  // each rank writes four ints behind its own seek
+  CHECK(MPI_File_seek(fh, 4 * rank, MPI_SEEK_SET) == MPI_SUCCESS);
+  int first[] = {4 * rank, 4 * rank + 1};
+  CHECK(MPI_File_write_all(fh, first, 2, MPI_INT, MPI_STATUS_IGNORE) ==
+        MPI_SUCCESS);
+  int second[] = {4 * rank + 2, 4 * rank + 3};
+  MPI_Request request;
+  CHECK(MPI_File_iwrite(fh, second, 2, MPI_INT, &request) == MPI_SUCCESS);
+  CHECK(MPI_Wait(&request, MPI_STATUS_IGNORE) == MPI_SUCCESS);
+  MPI_Offset position;
+  CHECK(MPI_File_get_position(fh, &position) == MPI_SUCCESS);
+  CHECK(position == 4 * rank + 4);
+  CHECK(MPI_File_sync(fh) == MPI_SUCCESS);
+
+  std::vector<int> ints(4 * size + 1, -1);
+  MPI_Status status;
+  int count;
+  CHECK(MPI_File_seek(fh, 0, MPI_SEEK_SET) == MPI_SUCCESS);
+  CHECK(MPI_File_read_all(fh, ints.data(), ints.size(), MPI_INT, &status) ==
+        MPI_SUCCESS);
+  MPI_Get_count(&status, MPI_INT, &count);
+  CHECK(count == 4 * size);
+  for (int i = 0; i < 4 * size; ++i) {
+    CHECK(ints[i] == i);
+  }
+  // the pointer only moves past the data that was read
+  CHECK(MPI_File_get_position(fh, &position) == MPI_SUCCESS);
+  CHECK(position == 4 * size);
+  CHECK(MPI_File_read(fh, ints.data(), 1, MPI_INT, &status) == MPI_SUCCESS);
+  MPI_Get_count(&status, MPI_INT, &count);
+  CHECK(count == 0);
+
+  CHECK(MPI_File_seek(fh, -1, MPI_SEEK_END) == MPI_SUCCESS);
+  int last = -1;
+  CHECK(MPI_File_iread(fh, &last, 1, MPI_INT, &request) == MPI_SUCCESS);
+  CHECK(MPI_Wait(&request, &status) == MPI_SUCCESS);
+  MPI_Get_count(&status, MPI_INT, &count);
+  CHECK(count == 1);
+  CHECK(last == 4 * size - 1);
+  CHECK(MPI_File_seek(fh, -1, MPI_SEEK_SET) == MPI_ERR_ARG);
+
+  // the shared file pointer is not implemented
+  CHECK(MPI_File_write_shared(fh, first, 2, MPI_INT, MPI_STATUS_IGNORE) ==
+        MPI_ERR_UNSUPPORTED_OPERATION);
+  CHECK(MPI_File_get_position_shared(fh, &position) ==
+        MPI_ERR_UNSUPPORTED_OPERATION);
+
+  CHECK(MPI_File_close(&fh) == MPI_SUCCESS);
+}
+
+TEST_CASE("MPI-IO on a communicator freed after the open") {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  auto path = std::string{"/tmp/peanuts_preload_test/mpiio_freed_comm"};
+
+  MPI_Comm comm;
+  MPI_Comm_dup(MPI_COMM_WORLD, &comm);
+  MPI_File fh;
+  REQUIRE(MPI_File_open(comm, path.c_str(), MPI_MODE_CREATE | MPI_MODE_RDWR,
+                        MPI_INFO_NULL, &fh) == MPI_SUCCESS);
+  MPI_Comm_free(&comm);
+
+  auto dat = std::string{"rank"} + std::to_string(1000 + rank);
+  CHECK(MPI_File_write_at_all(fh, dat.size() * rank, dat.data(), dat.size(),
+                              MPI_CHAR, MPI_STATUS_IGNORE) == MPI_SUCCESS);
+  CHECK(MPI_File_sync(fh) == MPI_SUCCESS);
+  auto next = (rank + 1) % size;
+  std::string buf(dat.size(), '\0');
+  CHECK(MPI_File_read_at_all(fh, dat.size() * next, buf.data(), buf.size(),
+                             MPI_CHAR, MPI_STATUS_IGNORE) == MPI_SUCCESS);
+  CHECK(buf == std::string{"rank"} + std::to_string(1000 + next));
+  CHECK(MPI_File_close(&fh) == MPI_SUCCESS);
+}
+
+TEST_CASE("I/O of other threads while a collective call waits") {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  auto path = std::string{"/tmp/peanuts_preload_test/mpiio_threads"};
+
+  MPI_File fh;
+  REQUIRE(MPI_File_open(MPI_COMM_WORLD, path.c_str(),
+                        MPI_MODE_CREATE | MPI_MODE_RDWR, MPI_INFO_NULL,
+                        &fh) == MPI_SUCCESS);
+
+  // Rank 1 only joins the sync once another thread of rank 0 has written to
+  // a file outside the prefix, while rank 0 is already waiting in the sync.
+  auto helper = std::thread{};
+  if (rank == 0 && size > 1) {
+    helper = std::thread{[] {
+      auto fd = ::open("/dev/null", O_WRONLY);
+      CHECK(::write(fd, "x", 1) == 1);
+      ::close(fd);
+      MPI_Send(nullptr, 0, MPI_BYTE, 1, 0, MPI_COMM_WORLD);
+    }};
+  } else if (rank == 1) {
+    MPI_Recv(nullptr, 0, MPI_BYTE, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  }
+  CHECK(MPI_File_sync(fh) == MPI_SUCCESS);
+  if (helper.joinable()) {
+    helper.join();
+  }
+  CHECK(MPI_File_close(&fh) == MPI_SUCCESS);
+}
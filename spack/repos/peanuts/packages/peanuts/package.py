@@ -20,6 +20,9 @@ class Peanuts(CMakePackage):
     variant("deferred_open", default=True, description="use deferred open")
     variant("agg_read", default=True, description="use aggregate read")
     variant("profiler", default=False, description="enable profiler")
+    variant("mirrored_ring", default=False, description="map local rings twice to avoid wrap-around copies")
+    variant("log_records", default=False, description="write self-describing log records for crash recovery")
+    variant("persistent_index", default=False, description="keep the local extent index in pmem")
 
     version("master", branch="master")
     version("0.10.3", tag="v0.10.3")
@@ -39,5 +42,8 @@ class Peanuts(CMakePackage):
             self.define_from_variant("PEANUTS_USE_DEFERRED_OPEN", "deferred_open"),
             self.define_from_variant("PEANUTS_USE_AGG_READ", "agg_read"),
             self.define_from_variant("PEANUTS_ENABLE_PROFILER", "profiler"),
+            self.define_from_variant("PEANUTS_USE_MIRRORED_RING", "mirrored_ring"),
+            self.define_from_variant("PEANUTS_USE_LOG_RECORDS", "log_records"),
+            self.define_from_variant("PEANUTS_USE_PERSISTENT_INDEX", "persistent_index"),
         ]
         return args